@@ -321,6 +321,8 @@ void AmneziaApplication::initModels()
 
     m_sitesModel.reset(new SitesModel(m_settings, this));
     m_engine->rootContext()->setContextProperty("SitesModel", m_sitesModel.get());
+    m_sitesFilterModel.reset(new SitesFilterModel(m_sitesModel.get(), this));
+    m_engine->rootContext()->setContextProperty("SitesFilterModel", m_sitesFilterModel.get());
 
     m_appSplitTunnelingModel.reset(new AppSplitTunnelingModel(m_settings, this));
     m_engine->rootContext()->setContextProperty("AppSplitTunnelingModel", m_appSplitTunnelingModel.get());
@@ -86,6 +86,7 @@ namespace amnezia
         OpenVpnUnknownError = 701,
         OpenVpnTapAdapterError = 702,
         AddressPoolError = 703,
+        NetworkSetupError = 704,
 
         // 3rd party utils errors
         OpenSslFailed = 800,
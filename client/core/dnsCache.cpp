@@ -0,0 +1,100 @@
+#include "dnsCache.h"
+
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+
+namespace {
+// Keeps a flood of short lived answers from making every name look expired
+constexpr quint32 kMinTtl = 60;
+constexpr quint32 kMaxTtl = 24 * 60 * 60;
+// Answers nobody asked about for this long are dropped when loading
+constexpr qint64 kMaxAge = 30 * 24 * 60 * 60;
+}
+
+DnsCache::DnsCache(const QString &fileName) : m_fileName(fileName)
+{
+    load();
+}
+
+QStringList DnsCache::expired(const QStringList &hostnames) const
+{
+    const qint64 now = QDateTime::currentSecsSinceEpoch();
+    QStringList result;
+    for (const QString &hostname : hostnames) {
+        const auto entry = m_entries.constFind(hostname);
+        if (entry == m_entries.constEnd() || entry->lastSeen + entry->ttl <= now) {
+            result.append(hostname);
+        }
+    }
+    return result;
+}
+
+void DnsCache::insert(const QString &hostname, const QList<QHostAddress> &addresses, quint32 ttl)
+{
+    Entry &entry = m_entries[hostname];
+    entry.addresses.clear();
+    for (const QHostAddress &address : addresses) {
+        entry.addresses.append(address.toString());
+    }
+    entry.addresses.removeDuplicates();
+    entry.ttl = qBound(kMinTtl, ttl, kMaxTtl);
+    entry.lastSeen = QDateTime::currentSecsSinceEpoch();
+    m_dirty = true;
+}
+
+void DnsCache::load()
+{
+    QFile file(m_fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return;
+    }
+
+    const qint64 now = QDateTime::currentSecsSinceEpoch();
+    const QJsonObject cache = QJsonDocument::fromJson(file.readAll()).object();
+    for (auto i = cache.constBegin(); i != cache.constEnd(); ++i) {
+        const QJsonObject object = i.value().toObject();
+        Entry entry;
+        entry.ttl = object.value("ttl").toInt();
+        entry.lastSeen = object.value("seen").toInteger();
+        if (entry.lastSeen + kMaxAge < now) {
+            m_dirty = true;
+            continue;
+        }
+        for (const QJsonValue &address : object.value("addresses").toArray()) {
+            entry.addresses.append(address.toString());
+        }
+        m_entries.insert(i.key(), entry);
+    }
+}
+
+void DnsCache::save()
+{
+    if (!m_dirty) {
+        return;
+    }
+
+    QJsonObject cache;
+    for (auto i = m_entries.constBegin(); i != m_entries.constEnd(); ++i) {
+        QJsonObject object;
+        object.insert("addresses", QJsonArray::fromStringList(i->addresses));
+        object.insert("ttl", static_cast<qint64>(i->ttl));
+        object.insert("seen", i->lastSeen);
+        cache.insert(i.key(), object);
+    }
+
+    QDir().mkpath(QFileInfo(m_fileName).absolutePath());
+    QSaveFile file(m_fileName);
+    const QByteArray data = QJsonDocument(cache).toJson(QJsonDocument::Compact);
+    if (!file.open(QIODevice::WriteOnly) || file.write(data) != data.size() || !file.commit()) {
+        qWarning() << "DnsCache: failed to save" << m_fileName << file.errorString();
+        return;
+    }
+    m_dirty = false;
+}
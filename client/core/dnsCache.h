@@ -0,0 +1,44 @@
+#ifndef DNSCACHE_H
+#define DNSCACHE_H
+
+#include <QHash>
+#include <QHostAddress>
+#include <QString>
+#include <QStringList>
+
+/**
+ * @brief The DnsCache class - remembers what split tunneling domains resolved to
+ *
+ * Every answer is kept with all of its addresses, its TTL and the time it was
+ * seen, and the cache is saved to disk, so a connect can route the known
+ * addresses right away and only has to look up names whose answers expired.
+ */
+class DnsCache
+{
+public:
+    explicit DnsCache(const QString &fileName);
+
+    bool contains(const QString &hostname) const { return m_entries.contains(hostname); }
+    QStringList addresses(const QString &hostname) const { return m_entries.value(hostname).addresses; }
+    // Hostnames out of the given ones that are unknown or whose answer expired
+    QStringList expired(const QStringList &hostnames) const;
+
+    void insert(const QString &hostname, const QList<QHostAddress> &addresses, quint32 ttl);
+    void save();
+
+private:
+    struct Entry {
+        QStringList addresses;
+        quint32 ttl = 0;
+        // Seconds since epoch
+        qint64 lastSeen = 0;
+    };
+
+    void load();
+
+    QString m_fileName;
+    QHash<QString, Entry> m_entries;
+    bool m_dirty = false;
+};
+
+#endif // DNSCACHE_H
@@ -0,0 +1,164 @@
+#include "dnsResolverPool.h"
+
+#include <QDebug>
+#include <QDnsLookup>
+#include <QHostInfo>
+
+#include <limits>
+
+namespace {
+// Results are handed out once this many hostnames are done...
+constexpr int kBatchSize = 256;
+// ...or this long after the last result came in
+constexpr int kFlushDelayMsec = 200;
+// QHostInfo does not report a TTL
+constexpr quint32 kHostInfoTtl = 300;
+}
+
+DnsResolverPool::DnsResolverPool(int maxConcurrent, QObject *parent)
+    : QObject(parent), m_maxConcurrent(qMax(1, maxConcurrent)), m_flushTimer(this)
+{
+    m_flushTimer.setSingleShot(true);
+    m_flushTimer.setInterval(kFlushDelayMsec);
+    connect(&m_flushTimer, &QTimer::timeout, this, &DnsResolverPool::flushResults);
+}
+
+DnsResolverPool::~DnsResolverPool()
+{
+    abort();
+}
+
+void DnsResolverPool::setMaxConcurrent(int maxConcurrent)
+{
+    m_maxConcurrent = qMax(1, maxConcurrent);
+    startLookups();
+}
+
+void DnsResolverPool::resolve(const QStringList &hostnames)
+{
+    for (const QString &hostname : hostnames) {
+        if (hostname.isEmpty() || m_pending.contains(hostname)) {
+            continue;
+        }
+        m_pending.insert(hostname);
+        m_queue.enqueue(hostname);
+    }
+    startLookups();
+}
+
+void DnsResolverPool::abort()
+{
+    for (const Job &job : std::as_const(m_jobs)) {
+        for (QDnsLookup *lookup : job.lookups) {
+            lookup->disconnect(this);
+            lookup->abort();
+            lookup->deleteLater();
+        }
+        if (job.hostInfoId >= 0) {
+            QHostInfo::abortHostLookup(job.hostInfoId);
+        }
+    }
+    m_jobs.clear();
+    m_hostInfoLookups.clear();
+    m_queue.clear();
+    m_pending.clear();
+    m_results.clear();
+    m_flushTimer.stop();
+}
+
+void DnsResolverPool::startLookups()
+{
+    while (m_jobs.size() < m_maxConcurrent && !m_queue.isEmpty()) {
+        const QString hostname = m_queue.dequeue();
+        Job &job = m_jobs[hostname];
+        job.answer.ttl = std::numeric_limits<quint32>::max();
+
+        for (const QDnsLookup::Type type : { QDnsLookup::A, QDnsLookup::AAAA }) {
+            auto lookup = new QDnsLookup(type, hostname, this);
+            connect(lookup, &QDnsLookup::finished, this,
+                    [this, hostname, lookup]() { onDnsLookupFinished(hostname, lookup); });
+            job.lookups.append(lookup);
+        }
+        // Only start once both are registered, a lookup may finish right away
+        for (QDnsLookup *lookup : std::as_const(job.lookups)) {
+            lookup->lookup();
+        }
+    }
+}
+
+void DnsResolverPool::onDnsLookupFinished(const QString &hostname, QDnsLookup *lookup)
+{
+    lookup->deleteLater();
+    auto it = m_jobs.find(hostname);
+    if (it == m_jobs.end()) {
+        return;
+    }
+    Job &job = it.value();
+    job.lookups.removeOne(lookup);
+
+    if (lookup->error() == QDnsLookup::NoError) {
+        // CNAMEs are followed by the resolver, every address belongs to the name
+        for (const QDnsHostAddressRecord &record : lookup->hostAddressRecords()) {
+            job.answer.addresses.append(record.value());
+            job.answer.ttl = qMin(job.answer.ttl, record.timeToLive());
+        }
+    }
+    if (!job.lookups.isEmpty()) {
+        return;
+    }
+
+    if (job.answer.addresses.isEmpty()) {
+        job.hostInfoId = QHostInfo::lookupHost(hostname, this, &DnsResolverPool::onHostInfoFinished);
+        m_hostInfoLookups.insert(job.hostInfoId, hostname);
+        return;
+    }
+    complete(hostname);
+}
+
+void DnsResolverPool::onHostInfoFinished(const QHostInfo &hostInfo)
+{
+    const QString hostname = m_hostInfoLookups.take(hostInfo.lookupId());
+    auto it = m_jobs.find(hostname);
+    if (hostname.isEmpty() || it == m_jobs.end()) {
+        // Aborted lookup
+        return;
+    }
+
+    if (hostInfo.error() == QHostInfo::NoError) {
+        it->answer.addresses = hostInfo.addresses();
+        it->answer.ttl = kHostInfoTtl;
+    }
+    complete(hostname);
+}
+
+void DnsResolverPool::complete(const QString &hostname)
+{
+    const DnsAnswer answer = m_jobs.take(hostname).answer;
+    m_pending.remove(hostname);
+
+    if (!answer.addresses.isEmpty()) {
+        m_results.insert(hostname, answer);
+    } else {
+        qDebug() << "DnsResolverPool: failed to resolve" << hostname;
+    }
+
+    startLookups();
+
+    if (m_results.size() >= kBatchSize || isIdle()) {
+        flushResults();
+    } else {
+        m_flushTimer.start();
+    }
+}
+
+void DnsResolverPool::flushResults()
+{
+    m_flushTimer.stop();
+    if (!m_results.isEmpty()) {
+        const QMap<QString, DnsAnswer> results = std::exchange(m_results, {});
+        emit resolved(results);
+    }
+    if (isIdle()) {
+        emit finished();
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef DNSRESOLVERPOOL_H
+#define DNSRESOLVERPOOL_H
+
+#include <QHash>
+#include <QHostAddress>
+#include <QMap>
+#include <QObject>
+#include <QQueue>
+#include <QSet>
+#include <QTimer>
+
+class QDnsLookup;
+class QHostInfo;
+
+struct DnsAnswer
+{
+    QList<QHostAddress> addresses;
+    // Seconds, the smallest TTL among the records
+    quint32 ttl = 0;
+};
+Q_DECLARE_METATYPE(DnsAnswer)
+
+/**
+ * @brief The DnsResolverPool class - resolves many hostnames with a bounded number of lookups in flight
+ *
+ * Hostnames are queued by resolve() and looked up with QDnsLookup, A and AAAA
+ * in parallel, at most maxConcurrent() hostnames at a time. A hostname that
+ * is already queued or being looked up is not requested again. Names the DNS
+ * query can't answer (e.g. ones only in the hosts file) fall back to
+ * QHostInfo. Results are handed out in batches through resolved(), either
+ * once enough hostnames are done or shortly after the last one finished.
+ */
+class DnsResolverPool : public QObject
+{
+    Q_OBJECT
+public:
+    explicit DnsResolverPool(int maxConcurrent = 16, QObject *parent = nullptr);
+    ~DnsResolverPool() override;
+
+    int maxConcurrent() const { return m_maxConcurrent; }
+    void setMaxConcurrent(int maxConcurrent);
+
+    bool isIdle() const { return m_queue.isEmpty() && m_jobs.isEmpty(); }
+
+public slots:
+    void resolve(const QStringList &hostnames);
+    // Drops everything queued or in flight, nothing more is reported
+    void abort();
+
+signals:
+    // Hostnames that failed to resolve are left out
+    void resolved(const QMap<QString, DnsAnswer> &results);
+    void finished();
+
+private slots:
+    void onHostInfoFinished(const QHostInfo &hostInfo);
+    void flushResults();
+
+private:
+    struct Job {
+        QList<QDnsLookup *> lookups;
+        DnsAnswer answer;
+        int hostInfoId = -1;
+    };
+
+    void startLookups();
+    void onDnsLookupFinished(const QString &hostname, QDnsLookup *lookup);
+    void complete(const QString &hostname);
+
+    int m_maxConcurrent;
+    QQueue<QString> m_queue;
+    QSet<QString> m_pending;
+    QHash<QString, Job> m_jobs;
+    QHash<int, QString> m_hostInfoLookups;
+
+    QMap<QString, DnsAnswer> m_results;
+    QTimer m_flushTimer;
+};
+
+#endif // DNSRESOLVERPOOL_H
@@ -0,0 +1,236 @@
+#include "geoIpDatabase.h"
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QHostAddress>
+#include <QtAlgorithms>
+#include <QtEndian>
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+namespace {
+const QByteArray kMagic("AGEO");
+constexpr quint32 kVersion = 1;
+constexpr qint64 kHeaderSize = 16;
+constexpr qint64 kSelectorSize = 28;
+constexpr int kNameSize = 12;
+constexpr qint64 kV4RangeSize = 8;
+constexpr qint64 kV6RangeSize = 32;
+
+// Addresses of both families as 128 bit numbers, IPv4 ones in the low bits
+struct Address {
+    quint64 hi = 0;
+    quint64 lo = 0;
+
+    bool operator<(const Address &other) const { return hi != other.hi ? hi < other.hi : lo < other.lo; }
+    bool operator==(const Address &other) const { return hi == other.hi && lo == other.lo; }
+    bool isZero() const { return hi == 0 && lo == 0; }
+};
+using Range = std::pair<Address, Address>;
+
+Address plus(const Address &a, const Address &b)
+{
+    Address result { a.hi + b.hi, a.lo + b.lo };
+    if (result.lo < a.lo) {
+        result.hi++;
+    }
+    return result;
+}
+
+Address minus(const Address &a, const Address &b)
+{
+    Address result { a.hi - b.hi, a.lo - b.lo };
+    if (a.lo < b.lo) {
+        result.hi--;
+    }
+    return result;
+}
+
+Address powerOfTwo(int bit)
+{
+    return bit >= 64 ? Address { quint64(1) << (bit - 64), 0 } : Address { 0, quint64(1) << bit };
+}
+
+int trailingZeros(const Address &a)
+{
+    if (a.lo) {
+        return qCountTrailingZeroBits(a.lo);
+    }
+    return a.hi ? 64 + qCountTrailingZeroBits(a.hi) : 128;
+}
+
+int highestBit(const Address &a)
+{
+    return a.hi ? 127 - qCountLeadingZeroBits(a.hi) : 63 - qCountLeadingZeroBits(a.lo);
+}
+
+QString addressString(const Address &a, int bits)
+{
+    if (bits == 32) {
+        return QHostAddress(static_cast<quint32>(a.lo)).toString();
+    }
+    quint8 bytes[16];
+    qToBigEndian<quint64>(a.hi, bytes);
+    qToBigEndian<quint64>(a.lo, bytes + 8);
+    return QHostAddress(bytes).toString();
+}
+
+void sortAndMerge(std::vector<Range> &ranges)
+{
+    std::sort(ranges.begin(), ranges.end());
+    std::vector<Range> merged;
+    for (const Range &range : ranges) {
+        // Adjacent ranges are merged too, they may make up a wider prefix
+        if (!merged.empty()
+            && (plus(merged.back().second, Address { 0, 1 }) == range.first || !(merged.back().second < range.first))) {
+            if (merged.back().second < range.second) {
+                merged.back().second = range.second;
+            }
+            continue;
+        }
+        merged.push_back(range);
+    }
+    ranges = std::move(merged);
+}
+
+// Smallest set of prefixes that exactly covers first..last
+void appendPrefixes(Address first, const Address &last, int bits, QStringList &prefixes)
+{
+    while (!(last < first)) {
+        const Address span = plus(minus(last, first), Address { 0, 1 });
+        int size = qMin(trailingZeros(first), bits);
+        // A span of zero wrapped around, the range covers the whole space
+        if (!span.isZero()) {
+            size = qMin(size, highestBit(span));
+        }
+        prefixes.append(QString("%1/%2").arg(addressString(first, bits)).arg(bits - size));
+
+        if (size >= bits) {
+            break;
+        }
+        const Address next = plus(first, powerOfTwo(size));
+        if (next < first || (bits == 32 && next.lo > 0xFFFFFFFFull)) {
+            break;
+        }
+        first = next;
+    }
+}
+}
+
+GeoIpDatabase::GeoIpDatabase(const QString &fileName) : m_file(fileName)
+{
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        qDebug() << "GeoIpDatabase: can't open" << fileName;
+        return;
+    }
+
+    m_size = m_file.size();
+    const uchar *data = m_file.map(0, m_size);
+    if (!data || m_size < kHeaderSize || std::memcmp(data, kMagic.constData(), 4) != 0
+        || qFromLittleEndian<quint32>(data + 4) != kVersion) {
+        qWarning() << "GeoIpDatabase: invalid database" << fileName;
+        return;
+    }
+
+    m_selectorCount = qFromLittleEndian<quint32>(data + 8);
+    if (kHeaderSize + m_selectorCount * kSelectorSize > m_size) {
+        qWarning() << "GeoIpDatabase: truncated database" << fileName;
+        return;
+    }
+    m_data = data;
+}
+
+QString GeoIpDatabase::defaultFileName()
+{
+#ifdef Q_OS_MACOS
+    return QCoreApplication::applicationDirPath() + "/../Resources/geoip.dat";
+#else
+    return QCoreApplication::applicationDirPath() + "/geoip.dat";
+#endif
+}
+
+QStringList GeoIpDatabase::selectors() const
+{
+    QStringList result;
+    for (quint32 i = 0; isValid() && i < m_selectorCount; ++i) {
+        const char *name = reinterpret_cast<const char *>(m_data + kHeaderSize + i * kSelectorSize);
+        result.append(QString::fromLatin1(name, qstrnlen(name, kNameSize)));
+    }
+    return result;
+}
+
+qint64 GeoIpDatabase::findSelector(const QString &name) const
+{
+    const QByteArray latin1 = name.trimmed().toUpper().toLatin1();
+    if (!isValid() || latin1.isEmpty() || latin1.size() > kNameSize) {
+        return -1;
+    }
+    char key[kNameSize] = {};
+    std::memcpy(key, latin1.constData(), latin1.size());
+
+    quint32 low = 0;
+    quint32 high = m_selectorCount;
+    while (low < high) {
+        const quint32 middle = low + (high - low) / 2;
+        const qint64 offset = kHeaderSize + middle * kSelectorSize;
+        const int order = std::memcmp(m_data + offset, key, kNameSize);
+        if (order == 0) {
+            return offset;
+        }
+        if (order < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return -1;
+}
+
+QStringList GeoIpDatabase::prefixes(const QStringList &selectors) const
+{
+    std::vector<Range> v4;
+    std::vector<Range> v6;
+    for (const QString &name : selectors) {
+        const qint64 selector = findSelector(name);
+        if (selector < 0) {
+            qDebug() << "GeoIpDatabase: unknown selector" << name;
+            continue;
+        }
+
+        const qint64 v4Offset = qFromLittleEndian<quint32>(m_data + selector + kNameSize);
+        const qint64 v4Count = qFromLittleEndian<quint32>(m_data + selector + kNameSize + 4);
+        const qint64 v6Offset = qFromLittleEndian<quint32>(m_data + selector + kNameSize + 8);
+        const qint64 v6Count = qFromLittleEndian<quint32>(m_data + selector + kNameSize + 12);
+        if (v4Offset + v4Count * kV4RangeSize > m_size || v6Offset + v6Count * kV6RangeSize > m_size) {
+            qWarning() << "GeoIpDatabase: ranges of" << name << "are out of bounds";
+            continue;
+        }
+
+        for (qint64 i = 0; i < v4Count; ++i) {
+            const uchar *range = m_data + v4Offset + i * kV4RangeSize;
+            v4.push_back({ Address { 0, qFromLittleEndian<quint32>(range) },
+                           Address { 0, qFromLittleEndian<quint32>(range + 4) } });
+        }
+        for (qint64 i = 0; i < v6Count; ++i) {
+            const uchar *range = m_data + v6Offset + i * kV6RangeSize;
+            v6.push_back({ Address { qFromBigEndian<quint64>(range), qFromBigEndian<quint64>(range + 8) },
+                           Address { qFromBigEndian<quint64>(range + 16), qFromBigEndian<quint64>(range + 24) } });
+        }
+    }
+
+    // Several selectors may border on or overlap each other
+    sortAndMerge(v4);
+    sortAndMerge(v6);
+
+    QStringList result;
+    for (const Range &range : v4) {
+        appendPrefixes(range.first, range.second, 32, result);
+    }
+    for (const Range &range : v6) {
+        appendPrefixes(range.first, range.second, 128, result);
+    }
+    return result;
+}
@@ -0,0 +1,49 @@
+#ifndef GEOIPDATABASE_H
+#define GEOIPDATABASE_H
+
+#include <QFile>
+#include <QString>
+#include <QStringList>
+
+/**
+ * @brief The GeoIpDatabase class - country and ASN address ranges for split tunneling
+ *
+ * The database is a single file shipped next to the application and mapped
+ * into memory, nothing is parsed or copied when it is opened. All integers
+ * are little endian:
+ *
+ *   header    "AGEO", version, selector count, reserved        (4 x 4 bytes)
+ *   selectors name (12 bytes, zero padded, e.g. "DE" or "AS13335"),
+ *             IPv4 range offset and count, IPv6 range offset and count
+ *             (28 bytes each, sorted by name)
+ *   ranges    IPv4: first and last address (2 x 4 bytes)
+ *             IPv6: first and last address (2 x 16 bytes, network order)
+ *
+ * Offsets are in bytes from the start of the file, the ranges of every
+ * selector are sorted and do not overlap.
+ */
+class GeoIpDatabase
+{
+public:
+    explicit GeoIpDatabase(const QString &fileName = defaultFileName());
+
+    static QString defaultFileName();
+
+    bool isValid() const { return m_data != nullptr; }
+    QStringList selectors() const;
+
+    // Prefixes covering all ranges of the given countries and ASNs, merged
+    // into as few of them as possible. Unknown selectors are skipped.
+    QStringList prefixes(const QStringList &selectors) const;
+
+private:
+    // File offset of the selector record, -1 if there is none
+    qint64 findSelector(const QString &name) const;
+
+    QFile m_file;
+    const uchar *m_data = nullptr;
+    qint64 m_size = 0;
+    quint32 m_selectorCount = 0;
+};
+
+#endif // GEOIPDATABASE_H
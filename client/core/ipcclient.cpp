@@ -1,5 +1,6 @@
 #include "ipcclient.h"
 #include <QRemoteObjectNode>
+#include <QTimer>
 
 IpcClient *IpcClient::m_instance = nullptr;
 
@@ -18,6 +19,13 @@ bool IpcClient::isSocketConnected() const
     return m_isSocketConnected;
 }
 
+void IpcClient::flush()
+{
+    if (Instance() && Instance()->m_localSocket) {
+        Instance()->m_localSocket->flush();
+    }
+}
+
 IpcClient *IpcClient::Instance()
 {
     return m_instance;
@@ -38,12 +46,14 @@ bool IpcClient::init(IpcClient *instance)
         Instance()->m_ClientNode.addClientSideConnection(Instance()->m_localSocket.data());
 
         Instance()->m_ipcClient.reset(Instance()->m_ClientNode.acquire<IpcInterfaceReplica>());
-        Instance()->m_ipcClient->waitForSource(1000);
-
-        if (!Instance()->m_ipcClient->isReplicaValid()) {
-            qWarning() << "IpcClient replica is not connected!";
-        }
+        Instance()->m_isSocketConnected = true;
 
+        // Callers wait for the source with whenReady()
+        IpcClient::whenReady(Instance()->m_ipcClient.data(), Instance(), 1000, [](bool ready) {
+            if (!ready) {
+                qWarning() << "IpcClient replica is not connected!";
+            }
+        });
     });
 
     connect(Instance()->m_localSocket, &QLocalSocket::disconnected, [instance](){
@@ -60,7 +70,38 @@ bool IpcClient::init(IpcClient *instance)
     }
     qDebug() << "IpcClient::init succeed";
 
-    return Instance()->m_ipcClient->isReplicaValid();
+    return true;
+}
+
+void IpcClient::whenReady(QRemoteObjectReplica *replica, QObject *context, int msecs,
+                          const std::function<void(bool)> &callback)
+{
+    if (!replica) {
+        callback(false);
+        return;
+    }
+    if (replica->isInitialized()) {
+        callback(true);
+        return;
+    }
+
+    // Whichever comes first answers, the other one is dropped
+    auto answered = QSharedPointer<bool>::create(false);
+    auto connection = QSharedPointer<QMetaObject::Connection>::create();
+    *connection = connect(replica, &QRemoteObjectReplica::initialized, context, [answered, connection, callback]() {
+        QObject::disconnect(*connection);
+        if (!*answered) {
+            *answered = true;
+            callback(true);
+        }
+    });
+    QTimer::singleShot(msecs, context, [answered, connection, callback]() {
+        QObject::disconnect(*connection);
+        if (!*answered) {
+            *answered = true;
+            callback(false);
+        }
+    });
 }
 
 QSharedPointer<PrivilegedProcess> IpcClient::CreatePrivilegedProcess()
@@ -90,11 +131,7 @@ QSharedPointer<PrivilegedProcess> IpcClient::CreatePrivilegedProcess()
             qWarning() << "Acquire PrivilegedProcess failed";
         }
         else {
-            pd->ipcProcess->waitForSource(1000);
-            if (!pd->ipcProcess->isReplicaValid()) {
-                qWarning() << "PrivilegedProcess replica is not connected!";
-            }
-
+            // Callers wait for the source with whenReady()
             QObject::connect(pd->ipcProcess.data(), &PrivilegedProcess::destroyed, pd->ipcProcess.data(), [pd](){
                 pd->replicaNode->deleteLater();
             });
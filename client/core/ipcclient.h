@@ -4,6 +4,8 @@
 #include <QLocalSocket>
 #include <QObject>
 
+#include <functional>
+
 #include "ipc.h"
 #include "rep_ipc_interface_replica.h"
 
@@ -20,8 +22,18 @@ public:
    static QSharedPointer<IpcInterfaceReplica> Interface();
    static QSharedPointer<PrivilegedProcess> CreatePrivilegedProcess();
 
+   // Calls back with true once the replica is initialized, or with false
+   // after msecs, without spinning an event loop. Nothing is called when
+   // context is destroyed first.
+   static void whenReady(QRemoteObjectReplica *replica, QObject *context, int msecs,
+                         const std::function<void(bool)> &callback);
+
    bool isSocketConnected() const;
 
+   // Hands calls made so far to the system without waiting for replies,
+   // for when no event loop will run to write them out
+   static void flush();
+
 signals:
 
 private:
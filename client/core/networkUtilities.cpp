@@ -33,6 +33,8 @@
 
 #include <QHostAddress>
 #include <QHostInfo>
+#include <QSet>
+#include <QVector>
 
 QRegularExpression NetworkUtilities::ipAddressRegExp()
 {
@@ -90,21 +92,164 @@ QString NetworkUtilities::ipAddressFromIpWithSubnet(const QString ip)
     return ip.split("/").first();
 }
 
-QStringList NetworkUtilities::summarizeRoutes(const QStringList &ips, const QString cidr)
+namespace {
+// Binary radix trie over the prefixes of one address family, used by
+// summarizeRoutes(). Addresses are kept in network byte order, IPv4 ones in
+// the first four bytes. Nodes live in a flat pool and refer to their children
+// by index.
+class RouteTrie
 {
-    //    QMap<int, int>
-    //    QHostAddress
+public:
+    explicit RouteTrie(QAbstractSocket::NetworkLayerProtocol protocol)
+        : m_protocol(protocol), m_bits(protocol == QAbstractSocket::IPv6Protocol ? 128 : 32)
+    {
+        m_nodes.append(Node());
+    }
+
+    void insert(const QHostAddress &address, int prefix)
+    {
+        const Q_IPV6ADDR addr = bytes(address);
+        int node = 0;
+        for (int depth = 0; depth < prefix; ++depth) {
+            // Already covered by a shorter prefix
+            if (m_nodes.at(node).terminal) {
+                return;
+            }
+            const int bit = (addr[depth / 8] >> (7 - depth % 8)) & 1;
+            if (m_nodes.at(node).child[bit] < 0) {
+                m_nodes[node].child[bit] = m_nodes.size();
+                m_nodes.append(Node());
+            }
+            node = m_nodes.at(node).child[bit];
+        }
+        // Anything below is covered by this prefix now
+        m_nodes[node].terminal = true;
+        m_nodes[node].child[0] = m_nodes[node].child[1] = -1;
+    }
+
+    // Merges sibling prefixes bottom-up. A parent replaces its two children
+    // when it covers at most maxOverCoverage addresses that weren't requested.
+    // Prefixes of 2^64 addresses and more can't be counted, those only merge
+    // children that are both fully covered. Returns the number of requested
+    // addresses below the node.
+    quint64 collapse(quint64 maxOverCoverage, int node = 0, int depth = 0)
+    {
+        const int hostBits = m_bits - depth;
+        const bool countable = hostBits < 64;
+        const quint64 size = countable ? quint64(1) << hostBits : 0;
+        if (m_nodes.at(node).terminal) {
+            return size;
+        }
 
-           //    QMap<QString, QStringList> subnets; // <"a.b", <list subnets>>
+        quint64 covered = 0;
+        for (int bit : { 0, 1 }) {
+            const int child = m_nodes.at(node).child[bit];
+            if (child >= 0) {
+                covered += collapse(maxOverCoverage, child, depth + 1);
+            }
+        }
 
-           //    for (const QString &ip : ips) {
-           //        if (ip.count(".") != 3) continue;
+        Node &n = m_nodes[node];
+        if (n.child[0] < 0 || n.child[1] < 0) {
+            return covered;
+        }
+        const bool merge = countable ? size - covered <= maxOverCoverage
+                                     : m_nodes.at(n.child[0]).terminal && m_nodes.at(n.child[1]).terminal;
+        if (merge) {
+            n.terminal = true;
+            n.child[0] = n.child[1] = -1;
+        }
+        return covered;
+    }
 
-           //        const QStringList &parts = ip.split(".");
-           //        subnets[parts.at(0) + "." + parts.at(1)].append(ip);
-           //    }
+    void collect(QStringList &result) const
+    {
+        Q_IPV6ADDR addr = {};
+        collect(result, addr, 0, 0);
+    }
+
+private:
+    struct Node
+    {
+        int child[2] = { -1, -1 };
+        bool terminal = false;
+    };
 
-    return QStringList();
+    Q_IPV6ADDR bytes(const QHostAddress &address) const
+    {
+        Q_IPV6ADDR addr = {};
+        if (m_protocol == QAbstractSocket::IPv6Protocol) {
+            return address.toIPv6Address();
+        }
+        const quint32 ip4 = address.toIPv4Address();
+        for (int i = 0; i < 4; ++i) {
+            addr[i] = quint8(ip4 >> (24 - 8 * i));
+        }
+        return addr;
+    }
+
+    QHostAddress address(const Q_IPV6ADDR &addr) const
+    {
+        if (m_protocol == QAbstractSocket::IPv6Protocol) {
+            return QHostAddress(addr);
+        }
+        return QHostAddress(quint32(addr[0]) << 24 | quint32(addr[1]) << 16 | quint32(addr[2]) << 8 | addr[3]);
+    }
+
+    void collect(QStringList &result, Q_IPV6ADDR &addr, int node, int depth) const
+    {
+        const Node &n = m_nodes.at(node);
+        if (n.terminal) {
+            const QString ip = address(addr).toString();
+            result.append(depth == m_bits ? ip : QString("%1/%2").arg(ip).arg(depth));
+            return;
+        }
+        for (int bit : { 0, 1 }) {
+            if (n.child[bit] >= 0) {
+                const quint8 mask = quint8(0x80 >> (depth % 8));
+                if (bit) {
+                    addr[depth / 8] |= mask;
+                }
+                collect(result, addr, n.child[bit], depth + 1);
+                addr[depth / 8] &= quint8(~mask);
+            }
+        }
+    }
+
+    QAbstractSocket::NetworkLayerProtocol m_protocol;
+    int m_bits;
+    QVector<Node> m_nodes;
+};
+}
+
+QStringList NetworkUtilities::summarizeRoutes(const QStringList &ips, quint64 maxOverCoverage)
+{
+    RouteTrie v4(QAbstractSocket::IPv4Protocol);
+    RouteTrie v6(QAbstractSocket::IPv6Protocol);
+    QStringList result;
+    QSet<QString> passedThrough;
+
+    for (const QString &ip : ips) {
+        const bool isV6 = ip.contains(':');
+        const QPair<QHostAddress, int> subnet =
+                QHostAddress::parseSubnet(ip.contains("/") ? ip : ip + (isV6 ? "/128" : "/32"));
+        const QAbstractSocket::NetworkLayerProtocol protocol = subnet.first.protocol();
+        if (protocol == QAbstractSocket::IPv4Protocol) {
+            v4.insert(subnet.first, subnet.second);
+        } else if (protocol == QAbstractSocket::IPv6Protocol) {
+            v6.insert(subnet.first, subnet.second);
+        } else if (!ip.isEmpty() && !passedThrough.contains(ip)) {
+            // Host names and anything else are passed through untouched
+            passedThrough.insert(ip);
+            result.append(ip);
+        }
+    }
+
+    v4.collapse(maxOverCoverage);
+    v4.collect(result);
+    v6.collapse(maxOverCoverage);
+    v6.collect(result);
+    return result;
 }
 
 QString NetworkUtilities::getIPAddress(const QString &host)
@@ -29,7 +29,11 @@ public:
     static QString netMaskFromIpWithSubnet(const QString ip);
     static QString ipAddressFromIpWithSubnet(const QString ip);
 
-    static QStringList summarizeRoutes(const QStringList &ips, const QString cidr);
+    // Merges adjacent and overlapping routes of each address family into the
+    // minimal covering set. With maxOverCoverage > 0 a merged route may
+    // additionally cover up to that many addresses that weren't in the input.
+    // Host names and other entries are kept as is.
+    static QStringList summarizeRoutes(const QStringList &ips, quint64 maxOverCoverage = 0);
 
 };
 
@@ -0,0 +1,127 @@
+#include "routeStream.h"
+
+#include <QDebug>
+
+#include "ipcclient.h"
+
+RouteStream::RouteStream(QObject *parent) : QObject(parent)
+{
+}
+
+int RouteStream::add(const QString &gw, const QStringList &ips)
+{
+    return start(gw, ips, true);
+}
+
+int RouteStream::remove(const QString &gw, const QStringList &ips)
+{
+    return start(gw, ips, false);
+}
+
+int RouteStream::start(const QString &gw, const QStringList &ips, bool add)
+{
+    IpcInterfaceReplica *service = replica();
+    if (!service) {
+        qWarning() << "RouteStream: service is not connected, dropping" << ips.size() << "routes";
+        return -1;
+    }
+
+    const int batchId = m_nextBatchId++;
+    Batch batch;
+    batch.ips = ips;
+    m_batches.insert(batchId, batch);
+
+    service->routeBatchBegin(batchId, gw, add, ips.size());
+    pump(batchId);
+    return batchId;
+}
+
+void RouteStream::pump(int batchId)
+{
+    auto it = m_batches.find(batchId);
+    IpcInterfaceReplica *service = replica();
+    if (it == m_batches.end() || !service) {
+        return;
+    }
+
+    while (it->sent < it->ips.size() && it->sent - it->done < chunkSize() * windowSize()) {
+        const QStringList chunk = it->ips.mid(it->sent, chunkSize());
+        service->routeBatchChunk(batchId, chunk);
+        it->sent += chunk.size();
+    }
+    if (it->sent == it->ips.size() && !it->ended) {
+        service->routeBatchEnd(batchId);
+        it->ended = true;
+    }
+}
+
+void RouteStream::cancel(int batchId)
+{
+    if (!m_batches.contains(batchId)) {
+        return;
+    }
+    if (IpcInterfaceReplica *service = replica()) {
+        // finished() follows from the service with what was applied so far
+        service->routeBatchCancel(batchId);
+    } else {
+        m_batches.remove(batchId);
+        emit finished(batchId, 0, true);
+    }
+}
+
+void RouteStream::cancelAll()
+{
+    const QList<int> batchIds = m_batches.keys();
+    for (int batchId : batchIds) {
+        cancel(batchId);
+    }
+}
+
+void RouteStream::onProgress(int batchId, int done, int total)
+{
+    auto it = m_batches.find(batchId);
+    if (it == m_batches.end()) {
+        return;
+    }
+    it->done = done;
+    emit progressChanged(batchId, done, total);
+    pump(batchId);
+}
+
+void RouteStream::onFailed(int batchId, const QStringList &ips, const QString &error)
+{
+    if (!m_batches.contains(batchId)) {
+        return;
+    }
+    qWarning() << "RouteStream: batch" << batchId << error << ips;
+    emit failed(batchId, ips, error);
+}
+
+void RouteStream::onFinished(int batchId, int applied, bool cancelled)
+{
+    if (!m_batches.remove(batchId)) {
+        return;
+    }
+    emit finished(batchId, applied, cancelled);
+}
+
+IpcInterfaceReplica *RouteStream::replica()
+{
+    const QSharedPointer<IpcInterfaceReplica> service = IpcClient::Interface();
+    if (!service) {
+        return nullptr;
+    }
+    if (m_replica != service.data()) {
+        // Batches sent to a previous service are gone with it
+        const QList<int> batchIds = m_batches.keys();
+        m_batches.clear();
+        for (int batchId : batchIds) {
+            emit finished(batchId, 0, true);
+        }
+        m_replica = service.data();
+        connect(service.data(), &IpcInterfaceReplica::routeBatchProgress, this, &RouteStream::onProgress);
+        connect(service.data(), &IpcInterfaceReplica::routeBatchFailed, this, &RouteStream::onFailed);
+        connect(service.data(), &IpcInterfaceReplica::routeBatchFinished, this, &RouteStream::onFinished);
+    }
+    return service.data();
+}
@@ -0,0 +1,67 @@
+#ifndef ROUTESTREAM_H
+#define ROUTESTREAM_H
+
+#include <QHash>
+#include <QObject>
+#include <QPointer>
+#include <QStringList>
+
+class IpcInterfaceReplica;
+
+/**
+ * @brief The RouteStream class - adds and deletes large route lists through the service in chunks
+ *
+ * A list is split into chunks of chunkSize() routes. Up to windowSize() chunks
+ * are sent ahead of the service's progress, so it always has work queued but
+ * never holds more than a few chunks of a batch. Progress and routes the
+ * service failed to apply are reported per batch, and a batch can be
+ * cancelled while chunks are still pending.
+ */
+class RouteStream : public QObject
+{
+    Q_OBJECT
+public:
+    explicit RouteStream(QObject *parent = nullptr);
+
+    static constexpr int chunkSize() { return 512; }
+    static constexpr int windowSize() { return 4; }
+
+    // Start a batch, returns its id or -1 if the service isn't connected
+    int add(const QString &gw, const QStringList &ips);
+    int remove(const QString &gw, const QStringList &ips);
+
+    bool isRunning() const { return !m_batches.isEmpty(); }
+
+public slots:
+    void cancel(int batchId);
+    void cancelAll();
+
+signals:
+    void progressChanged(int batchId, int done, int total);
+    void failed(int batchId, const QStringList &ips, const QString &error);
+    void finished(int batchId, int applied, bool cancelled);
+
+private slots:
+    void onProgress(int batchId, int done, int total);
+    void onFailed(int batchId, const QStringList &ips, const QString &error);
+    void onFinished(int batchId, int applied, bool cancelled);
+
+private:
+    struct Batch {
+        QStringList ips;
+        int sent = 0;
+        int done = 0;
+        bool ended = false;
+    };
+
+    int start(const QString &gw, const QStringList &ips, bool add);
+    void pump(int batchId);
+    // The replica is recreated when the service restarts
+    IpcInterfaceReplica *replica();
+
+    QHash<int, Batch> m_batches;
+    int m_nextBatchId = 1;
+    QPointer<IpcInterfaceReplica> m_replica;
+};
+
+#endif // ROUTESTREAM_H
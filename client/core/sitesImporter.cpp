@@ -0,0 +1,202 @@
+#include "sitesImporter.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QThread>
+
+#include "core/networkUtilities.h"
+
+namespace {
+constexpr qint64 kChunkSize = 64 * 1024;
+// Sites handed to the GUI thread at once, one store write and one route request each
+constexpr int kBatchSize = 5000;
+constexpr int kProgressInterval = 1024;
+const QByteArray kUtf8Bom("\xEF\xBB\xBF");
+}
+
+SitesImporter::SitesImporter(const QString &fileName, QObject *parent)
+    : QObject(parent),
+      m_fileName(fileName),
+      m_ipMatcher(QRegularExpression::anchoredPattern(NetworkUtilities::ipAddressWithSubnetRegExp().pattern()))
+{
+    m_ipMatcher.optimize();
+}
+
+void SitesImporter::run()
+{
+    QFile file(m_fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        emit finished(0, 0, tr("Can't open file: %1").arg(m_fileName));
+        return;
+    }
+
+    if (file.peek(kUtf8Bom.size()) == kUtf8Bom) {
+        file.read(kUtf8Bom.size());
+    }
+
+    // The export writes JSON, anything else is read line by line
+    QString errorMessage;
+    const QByteArray head = file.peek(kChunkSize).trimmed();
+    if (head.startsWith('[') || head.startsWith('{')) {
+        readJson(file, errorMessage);
+    } else {
+        readLines(file);
+    }
+    flushBatch();
+
+    if (errorMessage.isEmpty()) {
+        emit progressChanged(100);
+    }
+    qDebug() << "SitesImporter: imported" << m_imported << "sites, skipped" << m_skipped;
+    emit finished(m_imported, m_skipped, errorMessage);
+}
+
+// Walks the top level array and hands each element to QJsonDocument on its
+// own, so only one entry is ever parsed at a time.
+bool SitesImporter::readJson(QFile &file, QString &errorMessage)
+{
+    int depth = 0;
+    bool inString = false;
+    bool escaped = false;
+    QByteArray element;
+
+    while (!file.atEnd()) {
+        if (isCancelled()) {
+            return true;
+        }
+
+        const QByteArray chunk = file.read(kChunkSize);
+        for (const char c : chunk) {
+            if (depth >= 2) {
+                element.append(c);
+            }
+
+            if (inString) {
+                if (escaped) {
+                    escaped = false;
+                } else if (c == '\\') {
+                    escaped = true;
+                } else if (c == '"') {
+                    inString = false;
+                }
+                continue;
+            }
+
+            switch (c) {
+            case '"': inString = true; break;
+            case '[':
+            case '{':
+                if (depth == 0 && c != '[') {
+                    errorMessage = tr("The JSON data is not an array in file: %1").arg(m_fileName);
+                    return false;
+                }
+                if (++depth == 2) {
+                    element = QByteArray(1, c);
+                }
+                break;
+            case ']':
+            case '}':
+                if (--depth == 1) {
+                    const QJsonObject object = QJsonDocument::fromJson(element).object();
+                    if (object.isEmpty()) {
+                        m_skipped++;
+                    } else {
+                        addEntry(object.value("hostname").toString(""), object.value("ip").toString(""));
+                    }
+                    element.clear();
+                } else if (depth == 0) {
+                    return true;
+                }
+                break;
+            default: break;
+            }
+        }
+        reportProgress(file);
+    }
+
+    errorMessage = tr("Failed to parse JSON data from file: %1").arg(m_fileName);
+    return false;
+}
+
+void SitesImporter::readLines(QFile &file)
+{
+    int lines = 0;
+    while (!file.atEnd()) {
+        QString line = QString::fromUtf8(file.readLine());
+        const int comment = line.indexOf('#');
+        if (comment >= 0) {
+            line.truncate(comment);
+        }
+        line = line.simplified();
+        if (line.isEmpty()) {
+            continue;
+        }
+
+        // hosts file lines carry the hostname after an address
+        const QStringList tokens = line.split(' ');
+        if (tokens.size() > 1 && m_ipMatcher.match(tokens.first()).hasMatch()) {
+            addEntry(tokens.at(1), "");
+        } else {
+            addEntry(tokens.first(), "");
+        }
+
+        if (++lines % kProgressInterval == 0) {
+            if (isCancelled()) {
+                return;
+            }
+            reportProgress(file);
+        }
+    }
+}
+
+void SitesImporter::addEntry(QString hostname, const QString &ip)
+{
+    if (!m_ipMatcher.match(hostname).hasMatch()) {
+        // Same clean up as for a site added by hand
+        hostname.remove("https://");
+        hostname.remove("http://");
+        hostname.remove("ftp://");
+        hostname = hostname.section('/', 0, 0, QString::SectionSkipEmpty);
+
+        if (!hostname.contains(".")) {
+            m_skipped++;
+            return;
+        }
+    }
+
+    m_batch.insert(hostname, ip);
+    m_batchIps.append(ip.isEmpty() ? hostname : ip);
+    m_imported++;
+    if (m_batch.size() >= kBatchSize) {
+        flushBatch();
+    }
+}
+
+void SitesImporter::flushBatch()
+{
+    if (m_batch.isEmpty()) {
+        return;
+    }
+    emit batchReady(m_batch, m_batchIps);
+    m_batch.clear();
+    m_batchIps.clear();
+}
+
+void SitesImporter::reportProgress(const QFile &file)
+{
+    if (file.size() <= 0) {
+        return;
+    }
+    const int percent = static_cast<int>(file.pos() * 100 / file.size());
+    if (percent != m_percent) {
+        m_percent = percent;
+        emit progressChanged(percent);
+    }
+}
+
+bool SitesImporter::isCancelled() const
+{
+    return QThread::currentThread()->isInterruptionRequested();
+}
@@ -0,0 +1,56 @@
+#ifndef SITESIMPORTER_H
+#define SITESIMPORTER_H
+
+#include <QMap>
+#include <QObject>
+#include <QRegularExpression>
+#include <QStringList>
+
+class QFile;
+
+/**
+ * @brief The SitesImporter class - reads a site list file on a worker thread
+ *
+ * The file is read as a stream and handed out in batches, so lists with
+ * hundreds of thousands of entries never have to be held in memory or parsed
+ * on the GUI thread at once. Three formats are accepted:
+ *  - the JSON array written by the export, [{"hostname": ..., "ip": ...}]
+ *  - plain text, one hostname, IP or CIDR subnet per line ('#' starts a comment)
+ *  - hosts files, "0.0.0.0 example.com" lines
+ */
+class SitesImporter : public QObject
+{
+    Q_OBJECT
+public:
+    explicit SitesImporter(const QString &fileName, QObject *parent = nullptr);
+
+public slots:
+    void run();
+
+signals:
+    // sites is <site, ip>, ips holds the addresses to route for this batch
+    void batchReady(const QMap<QString, QString> &sites, const QStringList &ips);
+    void progressChanged(int percent);
+    // errorMessage is empty on success
+    void finished(int imported, int skipped, const QString &errorMessage);
+
+private:
+    bool readJson(QFile &file, QString &errorMessage);
+    void readLines(QFile &file);
+
+    void addEntry(QString hostname, const QString &ip);
+    void flushBatch();
+    void reportProgress(const QFile &file);
+    bool isCancelled() const;
+
+    QString m_fileName;
+    const QRegularExpression m_ipMatcher;
+
+    QMap<QString, QString> m_batch;
+    QStringList m_batchIps;
+    int m_imported = 0;
+    int m_skipped = 0;
+    int m_percent = -1;
+};
+
+#endif // SITESIMPORTER_H
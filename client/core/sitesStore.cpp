@@ -0,0 +1,228 @@
+#include "sitesStore.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+
+namespace {
+// The log is compacted once it holds more than twice as many records as
+// there are sites, but never for small lists
+constexpr int kCompactMinRecords = 1024;
+
+// One record per line: "+site\tip", "-site" or "*" (remove everything)
+QByteArray addRecord(const QString &site, const QString &ip)
+{
+    return '+' + site.toUtf8() + '\t' + ip.toUtf8() + '\n';
+}
+
+QByteArray removeRecord(const QString &site)
+{
+    return '-' + site.toUtf8() + '\n';
+}
+
+bool isValidEntry(const QString &site, const QString &ip)
+{
+    const auto valid = [](const QString &s) { return !s.contains('\n') && !s.contains('\t'); };
+    return !site.isEmpty() && valid(site) && valid(ip);
+}
+}
+
+SitesStore::SitesStore(const QString &fileName) : m_fileName(fileName)
+{
+    load();
+}
+
+SitesStore::~SitesStore()
+{
+    m_log.close();
+}
+
+bool SitesStore::exists() const
+{
+    return QFile::exists(m_fileName);
+}
+
+QVariantMap SitesStore::toVariantMap() const
+{
+    QVariantMap sites;
+    for (auto i = m_sites.constBegin(); i != m_sites.constEnd(); ++i) {
+        sites.insert(i.key(), i.value());
+    }
+    return sites;
+}
+
+void SitesStore::insert(const QString &site, const QString &ip)
+{
+    if (!isValidEntry(site, ip)) {
+        qWarning() << "SitesStore: skipping invalid site" << site;
+        return;
+    }
+    const auto existing = m_sites.constFind(site);
+    if (existing != m_sites.constEnd() && existing.value() == ip) {
+        return;
+    }
+
+    m_sites.insert(site, ip);
+    append(addRecord(site, ip), 1);
+}
+
+void SitesStore::insert(const QMap<QString, QString> &sites)
+{
+    QByteArray records;
+    int count = 0;
+    for (auto i = sites.constBegin(); i != sites.constEnd(); ++i) {
+        if (!isValidEntry(i.key(), i.value())) {
+            qWarning() << "SitesStore: skipping invalid site" << i.key();
+            continue;
+        }
+        const auto existing = m_sites.constFind(i.key());
+        if (existing != m_sites.constEnd() && existing.value() == i.value()) {
+            continue;
+        }
+
+        m_sites.insert(i.key(), i.value());
+        records.append(addRecord(i.key(), i.value()));
+        count++;
+    }
+    append(records, count);
+}
+
+bool SitesStore::remove(const QString &site)
+{
+    if (!m_sites.remove(site)) {
+        return false;
+    }
+    append(removeRecord(site), 1);
+    return true;
+}
+
+void SitesStore::remove(const QStringList &sites)
+{
+    QByteArray records;
+    int count = 0;
+    for (const QString &site : sites) {
+        if (m_sites.remove(site)) {
+            records.append(removeRecord(site));
+            count++;
+        }
+    }
+    append(records, count);
+}
+
+void SitesStore::replace(const QVariantMap &sites)
+{
+    m_sites.clear();
+    m_sites.reserve(sites.size());
+    for (auto i = sites.constBegin(); i != sites.constEnd(); ++i) {
+        const QString ip = i.value().toString();
+        if (isValidEntry(i.key(), ip)) {
+            m_sites.insert(i.key(), ip);
+        }
+    }
+    compact();
+}
+
+void SitesStore::clear()
+{
+    if (m_sites.isEmpty() && !exists()) {
+        return;
+    }
+    m_sites.clear();
+    append("*\n", 1);
+}
+
+void SitesStore::load()
+{
+    QFile file(m_fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return;
+    }
+    const QByteArray data = file.readAll();
+    file.close();
+
+    qsizetype pos = 0;
+    while (pos < data.size()) {
+        const qsizetype end = data.indexOf('\n', pos);
+        if (end < 0) {
+            break;
+        }
+        const QByteArray line = data.mid(pos, end - pos);
+        pos = end + 1;
+        m_records++;
+
+        if (line.startsWith('+')) {
+            const qsizetype tab = line.indexOf('\t');
+            const QString site = QString::fromUtf8(line.mid(1, tab < 0 ? -1 : tab - 1));
+            const QString ip = tab < 0 ? QString() : QString::fromUtf8(line.mid(tab + 1));
+            m_sites.insert(site, ip);
+        } else if (line.startsWith('-')) {
+            m_sites.remove(QString::fromUtf8(line.mid(1)));
+        } else if (line.startsWith('*')) {
+            m_sites.clear();
+        }
+    }
+
+    // A write that was cut short leaves a partial last record, drop it
+    if (pos < data.size()) {
+        qWarning() << "SitesStore: dropping incomplete record at the end of" << m_fileName;
+        QFile::resize(m_fileName, pos);
+    }
+
+    maybeCompact();
+}
+
+bool SitesStore::openLog()
+{
+    if (m_log.isOpen()) {
+        return true;
+    }
+
+    QDir().mkpath(QFileInfo(m_fileName).absolutePath());
+    m_log.setFileName(m_fileName);
+    if (!m_log.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        qWarning() << "SitesStore: failed to open" << m_fileName << m_log.errorString();
+        return false;
+    }
+    return true;
+}
+
+void SitesStore::append(const QByteArray &records, int count)
+{
+    if (count == 0 || !openLog()) {
+        return;
+    }
+
+    if (m_log.write(records) != records.size() || !m_log.flush()) {
+        qWarning() << "SitesStore: failed to write" << m_fileName << m_log.errorString();
+    }
+    m_records += count;
+    maybeCompact();
+}
+
+void SitesStore::maybeCompact()
+{
+    if (m_records > kCompactMinRecords && m_records > 2 * m_sites.size()) {
+        compact();
+    }
+}
+
+// Rewrites the log as a snapshot of the current sites. The new file replaces
+// the old one atomically, so a crash leaves one or the other intact.
+void SitesStore::compact()
+{
+    m_log.close();
+    QDir().mkpath(QFileInfo(m_fileName).absolutePath());
+
+    QByteArray snapshot;
+    for (auto i = m_sites.constBegin(); i != m_sites.constEnd(); ++i) {
+        snapshot.append(addRecord(i.key(), i.value()));
+    }
+
+    QSaveFile file(m_fileName);
+    if (!file.open(QIODevice::WriteOnly) || file.write(snapshot) != snapshot.size() || !file.commit()) {
+        qWarning() << "SitesStore: failed to compact" << m_fileName << file.errorString();
+        return;
+    }
+    m_records = m_sites.size();
+}
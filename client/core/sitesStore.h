@@ -0,0 +1,56 @@
+#ifndef SITESSTORE_H
+#define SITESSTORE_H
+
+#include <QFile>
+#include <QHash>
+#include <QString>
+#include <QStringList>
+#include <QVariantMap>
+
+/**
+ * @brief The SitesStore class - split tunneling sites of one route mode, kept on disk
+ *
+ * The sites are held in memory in a hash (site -> ip) and every change is
+ * appended to a text log, so adding or removing a site costs one short write
+ * instead of rewriting the whole list. When the log has grown well past the
+ * number of live sites it is compacted into a fresh snapshot.
+ */
+class SitesStore
+{
+public:
+    explicit SitesStore(const QString &fileName);
+    ~SitesStore();
+
+    // False until the first change has been written, used for migration
+    bool exists() const;
+
+    int size() const { return m_sites.size(); }
+    bool contains(const QString &site) const { return m_sites.contains(site); }
+    QString value(const QString &site) const { return m_sites.value(site); }
+    const QHash<QString, QString> &sites() const { return m_sites; }
+    QVariantMap toVariantMap() const;
+
+    void insert(const QString &site, const QString &ip);
+    void insert(const QMap<QString, QString> &sites);
+    bool remove(const QString &site);
+    void remove(const QStringList &sites);
+    void replace(const QVariantMap &sites);
+    void clear();
+
+private:
+    SitesStore(SitesStore const &) = delete;
+    SitesStore& operator= (SitesStore const&) = delete;
+
+    void load();
+    bool openLog();
+    void append(const QByteArray &records, int count);
+    void maybeCompact();
+    void compact();
+
+    QString m_fileName;
+    QFile m_log;
+    QHash<QString, QString> m_sites;
+    int m_records = 0;
+};
+
+#endif // SITESSTORE_H
@@ -121,9 +121,17 @@ bool Daemon::activate(const InterfaceConfig& config) {
   }
 
   // Configure routing for excluded addresses.
+  wgutils()->beginRouteBatch();
   for (const QString& i : config.m_excludedAddresses) {
     addExclusionRoute(IPAddress(i));
   }
+  QStringList failedExclusions;
+  if (!wgutils()->commitRouteBatch(&failedExclusions)) {
+    for (const QString& prefix : failedExclusions) {
+      logger.warning() << "Exclusion route could not be added for"
+                       << logger.sensitive(prefix);
+    }
+  }
 
   // Add the peer to this interface.
   if (!wgutils()->updatePeer(config)) {
@@ -145,13 +153,19 @@ bool Daemon::activate(const InterfaceConfig& config) {
   }
 
   // set routing
+  wgutils()->beginRouteBatch();
   for (const IPAddress& ip : config.m_allowedIPAddressRanges) {
     if (!wgutils()->updateRoutePrefix(ip)) {
+      wgutils()->commitRouteBatch();
       logger.debug() << "Routing configuration failed for"
                      << logger.sensitive(ip.toString());
       return false;
     }
   }
+  if (!wgutils()->commitRouteBatch()) {
+    logger.debug() << "Routing configuration failed";
+    return false;
+  }
 
   bool status = run(Up, config);
   logger.debug() << "Connection status:" << status;
@@ -48,6 +48,16 @@ class WireguardUtils : public QObject {
 
   virtual bool addExclusionRoute(const IPAddress& prefix) = 0;
   virtual bool deleteExclusionRoute(const IPAddress& prefix) = 0;
+
+  // Route changes made between these calls may be submitted without waiting
+  // for each of them, so their own results only tell whether they were sent.
+  // commitRouteBatch() reports whether all of them worked and lists the
+  // prefixes that didn't in failed.
+  virtual void beginRouteBatch() {}
+  virtual bool commitRouteBatch(QStringList* failed = nullptr) {
+    Q_UNUSED(failed);
+    return true;
+  }
 };
 
 #endif  // WIREGUARDUTILS_H
@@ -31,8 +31,11 @@
 // along with this file. If not, see <https://www.gnu.org/licenses/>.
 
 #include "linuxfirewall.h"
+#include "linuxnftables.h"
 #include "logger.h"
+#include <QElapsedTimer>
 #include <QProcess>
+#include <QSet>
 
 #define BRAND_CODE "amn"
 
@@ -49,6 +52,36 @@ const QString enabledKeyTemplate = "enabled:%1:%2";
 const QString disabledKeyTemplate = "disabled:%1:%2";
 const QString kVpnGroupName = BRAND_CODE "vpn";
 QHash<QString, LinuxFirewall::FilterCallbackFunc> anchorCallbacks;
+// Last list applied to each address list anchor; absent means unknown
+QHash<QString, QStringList> appliedLists;
+// Kernel operations avoided by diff-based list updates, for the debug log
+quint64 savedOps = 0;
+
+// AMNEZIA_FIREWALL_RESTORE=0 applies every change rule by rule, the way it
+// was done before iptables-restore, so that both can be compared
+bool& restoreEnabled()
+{
+    static bool enabled = qEnvironmentVariable("AMNEZIA_FIREWALL_RESTORE") != QLatin1String("0");
+    return enabled;
+}
+
+// Cached view of our chains in the kernel, see LinuxFirewall::refreshState()
+struct FirewallState
+{
+    bool known = false;
+    bool installed = false;
+    QSet<QString> anchors[2];
+    QSet<QString> enabled[2];
+};
+FirewallState state;
+
+void resetAppliedLists()
+{
+    // Freshly installed list anchors are empty
+    appliedLists.clear();
+    for (const QString& anchor : {QStringLiteral("320.allowDNS"), QStringLiteral("120.blockNets"), QStringLiteral("110.allowNets")})
+        appliedLists.insert(anchor, {});
+}
 }
 
 QString LinuxFirewall::kRtableName = QStringLiteral("%1rt").arg(kAnchorName);
@@ -60,12 +93,25 @@ QString LinuxFirewall::kFilterTable = QStringLiteral("filter");
 QString LinuxFirewall::kNatTable = QStringLiteral("nat");
 QString LinuxFirewall::kRawTable = QStringLiteral("raw");
 QString LinuxFirewall::kMangleTable = QStringLiteral("mangle");
+QString LinuxFirewall::kKillSwitchAnchor = QStringLiteral("killSwitch");
 
 static QString getCommand(LinuxFirewall::IPVersion ip)
 {
     return ip == LinuxFirewall::IPv6 ? QStringLiteral("ip6tables") : QStringLiteral("iptables");
 }
 
+static QString getRestoreCommand(LinuxFirewall::IPVersion ip)
+{
+    return ip == LinuxFirewall::IPv6 ? QStringLiteral("ip6tables-restore") : QStringLiteral("iptables-restore");
+}
+
+static QString getSaveCommand(LinuxFirewall::IPVersion ip)
+{
+    return ip == LinuxFirewall::IPv6 ? QStringLiteral("ip6tables-save") : QStringLiteral("iptables-save");
+}
+
+int waitForExitCode(QProcess& process);
+
 int LinuxFirewall::createChain(LinuxFirewall::IPVersion ip, const QString& chain, const QString& tableName)
 {
     if (ip == Both)
@@ -128,28 +174,36 @@ int LinuxFirewall::unlinkChain(LinuxFirewall::IPVersion ip, const QString& chain
 
 void LinuxFirewall::ensureRootAnchorPriority(LinuxFirewall::IPVersion ip)
 {
+    // nftables base chains are ordered by hook priority, nothing to restore
+    if (useNftables())
+        return;
     linkChain(ip, kRootChain, kOutputChain, true);
 }
 
-void LinuxFirewall::installAnchor(LinuxFirewall::IPVersion ip, const QString& anchor, const QStringList& rules, const QString& tableName,
+void LinuxFirewall::installAnchor(Ruleset& ruleset, LinuxFirewall::IPVersion ip, const QString& anchor, const QStringList& rules, const QString& tableName,
                                      const FilterCallbackFunc& enableFunc, const FilterCallbackFunc& disableFunc)
 {
     if (ip == Both)
     {
-        installAnchor(IPv4, anchor, rules, tableName, enableFunc, disableFunc);
-        installAnchor(IPv6, anchor, rules, tableName, enableFunc, disableFunc);
+        installAnchor(ruleset, IPv4, anchor, rules, tableName, enableFunc, disableFunc);
+        installAnchor(ruleset, IPv6, anchor, rules, tableName, enableFunc, disableFunc);
         return;
     }
 
-    const QString cmd = getCommand(ip);
     const QString anchorChain = QStringLiteral("%1.a.%2").arg(kAnchorName, anchor);
     const QString actualChain = QStringLiteral("%1.%2").arg(kAnchorName, anchor);
 
+    // Filter anchors hang off the kill switch gate rather than the root
+    // chain, so they can be staged ahead of time and take effect together.
+    const QString parentChain = tableName == kFilterTable && anchor != kKillSwitchAnchor
+                                    ? QStringLiteral("%1.%2").arg(kAnchorName, kKillSwitchAnchor)
+                                    : kRootChain;
+
     // Start by defining a placeholder chain, which stays locked into place
-    // in the root chain without being removed or recreated, ensuring the
+    // in the parent chain without being removed or recreated, ensuring the
     // intended precedence order.
-    createChain(ip, anchorChain, tableName);
-    linkChain(ip, anchorChain, kRootChain, false, tableName);
+    stageChain(ruleset, ip, anchorChain, tableName);
+    stageRule(ruleset, ip, QStringLiteral("-A %1 -j %2").arg(parentChain, anchorChain), tableName);
 
     if(enableFunc)
     {
@@ -164,9 +218,9 @@ void LinuxFirewall::installAnchor(LinuxFirewall::IPVersion ip, const QString& an
 
     // Create the actual rule chain, which we'll insert or remove from the
     // placeholder anchor when needed.
-    createChain(ip, actualChain, tableName);
+    stageChain(ruleset, ip, actualChain, tableName);
     for (const QString& rule : rules)
-        execute(QStringLiteral("%1 -A %2 %3 -t %4").arg(cmd, actualChain, rule, tableName));
+        stageRule(ruleset, ip, QStringLiteral("-A %1 %2").arg(actualChain, rule), tableName);
 }
 
 void LinuxFirewall::uninstallAnchor(LinuxFirewall::IPVersion ip, const QString& anchor, const QString& tableName)
@@ -223,33 +277,56 @@ QStringList LinuxFirewall::getBlockRule(const QStringList& servers)
 
 void LinuxFirewall::install()
 {
+    if (useNftables())
+    {
+        // The nftables ruleset replaces any previous table atomically, so no
+        // uninstall is needed first.
+        LinuxNftables::install();
+        resetAppliedLists();
+        refreshState();
+
+        anchorCallbacks[enabledKeyTemplate.arg(kMangleTable, QStringLiteral("100.tagPkts"))] = setupTrafficSplitting;
+        anchorCallbacks[disabledKeyTemplate.arg(kMangleTable, QStringLiteral("100.tagPkts"))] = teardownTrafficSplitting;
+
+        setupTrafficSplitting();
+        return;
+    }
+
     // Clean up any existing rules if they exist.
     uninstall();
 
+    // The whole anchor set is staged in memory and committed with a single
+    // iptables-restore call per table and address family.
+    Ruleset ruleset;
+
     // Create a root filter chain to hold all our other anchors in order.
-    createChain(Both, kRootChain, kFilterTable);
+    stageChain(ruleset, Both, kRootChain, kFilterTable);
 
     // Create a root raw chain
-    createChain(Both, kRootChain, kRawTable);
+    stageChain(ruleset, Both, kRootChain, kRawTable);
 
     // Create a root NAT chain
-    createChain(Both, kRootChain, kNatTable);
+    stageChain(ruleset, Both, kRootChain, kNatTable);
 
     // Create a root Mangle chain
-    createChain(Both, kRootChain, kMangleTable);
+    stageChain(ruleset, Both, kRootChain, kMangleTable);
+
+    // The kill switch gate is the only anchor in the root filter chain; all
+    // other filter anchors are linked below it.
+    installAnchor(ruleset, Both, kKillSwitchAnchor, {});
 
     // Install our filter rulesets in each corresponding anchor chain.
-    installAnchor(Both, QStringLiteral("000.allowLoopback"), {
+    installAnchor(ruleset, Both, QStringLiteral("000.allowLoopback"), {
                                                                  QStringLiteral("-o lo+ -j ACCEPT"),
                                                              });
 
-    installAnchor(IPv4, QStringLiteral("320.allowDNS"), {});
+    installAnchor(ruleset, IPv4, QStringLiteral("320.allowDNS"), {});
 
-    installAnchor(Both, QStringLiteral("310.blockDNS"), {
+    installAnchor(ruleset, Both, QStringLiteral("310.blockDNS"), {
                                                             QStringLiteral("-p udp --dport 53 -j REJECT"),
                                                             QStringLiteral("-p tcp --dport 53 -j REJECT"),
                                                         });
-    installAnchor(IPv4, QStringLiteral("300.allowLAN"), {
+    installAnchor(ruleset, IPv4, QStringLiteral("300.allowLAN"), {
                                                             QStringLiteral("-d 10.0.0.0/8 -j ACCEPT"),
                                                             QStringLiteral("-d 169.254.0.0/16 -j ACCEPT"),
                                                             QStringLiteral("-d 172.16.0.0/12 -j ACCEPT"),
@@ -257,37 +334,37 @@ void LinuxFirewall::install()
                                                             QStringLiteral("-d 224.0.0.0/4 -j ACCEPT"),
                                                             QStringLiteral("-d 255.255.255.255/32 -j ACCEPT"),
                                                         });
-    installAnchor(IPv6, QStringLiteral("300.allowLAN"), {
+    installAnchor(ruleset, IPv6, QStringLiteral("300.allowLAN"), {
                                                             QStringLiteral("-d fc00::/7 -j ACCEPT"),
                                                             QStringLiteral("-d fe80::/10 -j ACCEPT"),
                                                             QStringLiteral("-d ff00::/8 -j ACCEPT"),
                                                         });
 
 
-    installAnchor(IPv4, QStringLiteral("290.allowDHCP"), {
+    installAnchor(ruleset, IPv4, QStringLiteral("290.allowDHCP"), {
                                                              QStringLiteral("-p udp -d 255.255.255.255 --sport 68 --dport 67 -j ACCEPT"),
                                                          });
-    installAnchor(IPv6, QStringLiteral("290.allowDHCP"), {
+    installAnchor(ruleset, IPv6, QStringLiteral("290.allowDHCP"), {
                                                              QStringLiteral("-p udp -d ff00::/8 --sport 546 --dport 547 -j ACCEPT"),
                                                          });
-    installAnchor(IPv6, QStringLiteral("250.blockIPv6"), {
+    installAnchor(ruleset, IPv6, QStringLiteral("250.blockIPv6"), {
                                                              QStringLiteral("! -o lo+ -j REJECT"),
                                                          });
 
-    installAnchor(Both, QStringLiteral("200.allowVPN"), {
+    installAnchor(ruleset, Both, QStringLiteral("200.allowVPN"), {
                                                             QStringLiteral("-o amn0+ -j ACCEPT"),
                                                             QStringLiteral("-o tun0+ -j ACCEPT"),
                                                         });
 
-    installAnchor(IPv4, QStringLiteral("120.blockNets"), {});
+    installAnchor(ruleset, IPv4, QStringLiteral("120.blockNets"), {});
 
-    installAnchor(IPv4, QStringLiteral("110.allowNets"), {});
+    installAnchor(ruleset, IPv4, QStringLiteral("110.allowNets"), {});
 
-    installAnchor(Both, QStringLiteral("100.blockAll"), {
+    installAnchor(ruleset, Both, QStringLiteral("100.blockAll"), {
                                                             QStringLiteral("-j REJECT"),
                                                         });
     // NAT rules
-    installAnchor(Both, QStringLiteral("100.transIp"), {
+    installAnchor(ruleset, Both, QStringLiteral("100.transIp"), {
 
                                                            // Only need the original interface, not the IP.
                                                            // The interface should remain much more stable/unchangeable than the IP
@@ -299,36 +376,50 @@ void LinuxFirewall::install()
                                                        }, kNatTable);
 
     // Mangle rules
-    installAnchor(Both, QStringLiteral("100.tagPkts"), {
+    installAnchor(ruleset, Both, QStringLiteral("100.tagPkts"), {
                                                            QStringLiteral("-m cgroup --cgroup %1 -j MARK --set-mark %2").arg(kCGroupId, kPacketTag)
                                                        }, kMangleTable, setupTrafficSplitting, teardownTrafficSplitting);
 
     // A rule to mitigate CVE-2019-14899 - drop packets addressed to the local
     // VPN IP but that are not actually received on the VPN interface.
     // See here: https://seclists.org/oss-sec/2019/q4/122
-    installAnchor(Both, QStringLiteral("100.vpnTunOnly"), {
+    installAnchor(ruleset, Both, QStringLiteral("100.vpnTunOnly"), {
                                                               // To be replaced at runtime
                                                               QStringLiteral("-j ACCEPT")
                                                           }, kRawTable);
 
 
     // Insert our fitler root chain at the top of the OUTPUT chain.
-    linkChain(Both, kRootChain, kOutputChain, true, kFilterTable);
+    stageRule(ruleset, Both, QStringLiteral("-I %1 1 -j %2").arg(kOutputChain, kRootChain), kFilterTable);
 
     // Insert our NAT root chain at the top of the POSTROUTING chain.
-    linkChain(Both, kRootChain, kPostRoutingChain, true, kNatTable);
+    stageRule(ruleset, Both, QStringLiteral("-I %1 1 -j %2").arg(kPostRoutingChain, kRootChain), kNatTable);
 
     // Insert our Mangle root chain at the top of the OUTPUT chain.
-    linkChain(Both, kRootChain, kOutputChain, true, kMangleTable);
+    stageRule(ruleset, Both, QStringLiteral("-I %1 1 -j %2").arg(kOutputChain, kRootChain), kMangleTable);
 
     // Insert our Raw root chain at the top of the PREROUTING chain.
-    linkChain(Both, kRootChain, kPreRoutingChain, true, kRawTable);
+    stageRule(ruleset, Both, QStringLiteral("-I %1 1 -j %2").arg(kPreRoutingChain, kRootChain), kRawTable);
+
+    commit(ruleset);
+    resetAppliedLists();
+    refreshState();
 
     setupTrafficSplitting();
 }
 
 void LinuxFirewall::uninstall()
 {
+    appliedLists.clear();
+
+    if (useNftables())
+    {
+        LinuxNftables::uninstall();
+        teardownTrafficSplitting();
+        state.known = false;
+        return;
+    }
+
     // Filter chain
     unlinkChain(Both, kRootChain, kOutputChain, kFilterTable);
     deleteChain(Both, kRootChain, kFilterTable);
@@ -345,7 +436,8 @@ void LinuxFirewall::uninstall()
     unlinkChain(Both, kRootChain, kOutputChain, kMangleTable);
     deleteChain(Both, kRootChain, kMangleTable);
 
-    // Remove filter anchors
+    // Remove filter anchors, starting with the gate that links the others
+    uninstallAnchor(Both, kKillSwitchAnchor);
     uninstallAnchor(Both, QStringLiteral("000.allowLoopback"));
     uninstallAnchor(Both, QStringLiteral("400.allowPIA"));
     uninstallAnchor(IPv4, QStringLiteral("320.allowDNS"));
@@ -368,27 +460,109 @@ void LinuxFirewall::uninstall()
     uninstallAnchor(Both, QStringLiteral("100.vpnTunOnly"), kRawTable);
 
     teardownTrafficSplitting();
+    state.known = false;
 
     logger.debug() << "LinuxFirewall::uninstall() complete";
 }
 
 bool LinuxFirewall::isInstalled()
 {
-    return execute(QStringLiteral("iptables -C %1 -j %2 2> /dev/null").arg(kOutputChain, kRootChain)) == 0;
+    if (!state.known)
+        refreshState();
+    return state.installed;
 }
 
-void LinuxFirewall::enableAnchor(LinuxFirewall::IPVersion ip, const QString &anchor, const QString& tableName)
+void LinuxFirewall::refreshState()
+{
+    QElapsedTimer timer;
+    timer.start();
+    for (IPVersion ip : {IPv4, IPv6})
+    {
+        QStringList anchors, enabled;
+        const bool installed = useNftables() ? LinuxNftables::readState(ip, anchors, enabled)
+                                             : readState(ip, anchors, enabled);
+        if (ip == IPv4)
+            state.installed = installed;
+        state.anchors[ip] = QSet<QString>(anchors.begin(), anchors.end());
+        state.enabled[ip] = QSet<QString>(enabled.begin(), enabled.end());
+    }
+    state.known = true;
+    logger.debug() << "Refreshed firewall state in" << timer.elapsed() << "ms, installed:" << state.installed;
+}
+
+bool LinuxFirewall::readState(LinuxFirewall::IPVersion ip, QStringList& anchors, QStringList& enabled)
+{
+    QProcess p;
+    p.start(getSaveCommand(ip), QStringList());
+    p.closeWriteChannel();
+    if (waitForExitCode(p) != 0)
+    {
+        logger.warning() << getSaveCommand(ip) << "failed:" << p.readAllStandardError().trimmed();
+        return false;
+    }
+
+    // Placeholder chains are declared as ":amnvpn.a.<anchor> - [0:0]" and
+    // hold "-A amnvpn.a.<anchor> -j amnvpn.<anchor>" while enabled.
+    const QString placeholderPrefix = QStringLiteral("%1.a.").arg(kAnchorName);
+    const QString rootLink = QStringLiteral("-A %1 -j %2").arg(kOutputChain, kRootChain);
+    QString table;
+    bool installed = false;
+    const QList<QByteArray> lines = p.readAllStandardOutput().split('\n');
+    for (const QByteArray& rawLine : lines)
+    {
+        const QString line = QString::fromUtf8(rawLine).trimmed();
+        if (line.startsWith('*'))
+        {
+            table = line.mid(1);
+        }
+        else if (line.startsWith(':' + placeholderPrefix))
+        {
+            anchors.append(line.mid(1 + placeholderPrefix.size()).section(' ', 0, 0));
+        }
+        else if (line.startsWith(QStringLiteral("-A ") + placeholderPrefix))
+        {
+            const QString anchor = line.mid(3 + placeholderPrefix.size()).section(' ', 0, 0);
+            if (line == QStringLiteral("-A %1%2 -j %3.%2").arg(placeholderPrefix, anchor, kAnchorName))
+                enabled.append(anchor);
+        }
+        else if (table == kFilterTable && line == rootLink)
+        {
+            installed = true;
+        }
+    }
+    return installed;
+}
+
+bool LinuxFirewall::enableAnchor(LinuxFirewall::IPVersion ip, const QString &anchor, const QString& tableName)
 {
     if (ip == Both)
     {
-        enableAnchor(IPv4, anchor, tableName);
-        enableAnchor(IPv6, anchor, tableName);
-        return;
+        bool changed4 = enableAnchor(IPv4, anchor, tableName);
+        bool changed6 = enableAnchor(IPv6, anchor, tableName);
+        return changed4 || changed6;
     }
-    const QString cmd = getCommand(ip);
+    if (!state.known)
+        refreshState();
+
     const QString ipStr = ip == IPv6 ? QStringLiteral("(IPv6)") : QStringLiteral("(IPv4)");
+    if (!state.anchors[ip].contains(anchor))
+    {
+        logger.debug() << anchor + ipStr + ": not installed";
+        return false;
+    }
+    if (state.enabled[ip].contains(anchor))
+        return false;
 
-    execute(QStringLiteral("if %1 -C %5.a.%2 -j %5.%2 -t %4 2> /dev/null ; then echo '%2%3: ON' ; else echo '%2%3: OFF -> ON' ; %1 -A %5.a.%2 -j %5.%2 -t %4; fi").arg(cmd, anchor, ipStr, tableName, kAnchorName));
+    logger.info() << anchor + ipStr + ": OFF -> ON";
+    const int result = useNftables() ? LinuxNftables::enableAnchor(ip, anchor)
+                                     : execute(QStringLiteral("%1 -A %4.a.%2 -j %4.%2 -t %3").arg(getCommand(ip), anchor, tableName, kAnchorName));
+    if (result != 0)
+    {
+        state.known = false;
+        return false;
+    }
+    state.enabled[ip].insert(anchor);
+    return true;
 }
 
 void LinuxFirewall::replaceAnchor(LinuxFirewall::IPVersion ip, const QString &anchor, const QString &newRule, const QString& tableName)
@@ -399,42 +573,67 @@ void LinuxFirewall::replaceAnchor(LinuxFirewall::IPVersion ip, const QString &an
         replaceAnchor(IPv6, anchor, newRule, tableName);
         return;
     }
+    if (useNftables())
+    {
+        logger.warning() << "replaceAnchor is not supported by the nftables backend:" << anchor;
+        return;
+    }
     const QString cmd = getCommand(ip);
     const QString ipStr = ip == IPv6 ? QStringLiteral("(IPv6)") : QStringLiteral("(IPv4)");
 
     execute(QStringLiteral("%1 -R %7.%2 1 %3 -t %4 ; echo 'Replaced rule %7.%2 %5 with %6'").arg(cmd, anchor, newRule, tableName, ipStr, newRule, kAnchorName));
 }
 
-void LinuxFirewall::disableAnchor(LinuxFirewall::IPVersion ip, const QString &anchor, const QString& tableName)
+bool LinuxFirewall::disableAnchor(LinuxFirewall::IPVersion ip, const QString &anchor, const QString& tableName)
 {
     if (ip == Both)
     {
-        disableAnchor(IPv4, anchor, tableName);
-        disableAnchor(IPv6, anchor, tableName);
-        return;
+        bool changed4 = disableAnchor(IPv4, anchor, tableName);
+        bool changed6 = disableAnchor(IPv6, anchor, tableName);
+        return changed4 || changed6;
     }
-    const QString cmd = getCommand(ip);
+    if (!state.known)
+        refreshState();
+
+    if (!state.enabled[ip].contains(anchor))
+        return false;
+
     const QString ipStr = ip == IPv6 ? QStringLiteral("(IPv6)") : QStringLiteral("(IPv4)");
-    execute(QStringLiteral("if ! %1 -C %5.a.%2 -j %5.%2 -t %4 2> /dev/null ; then echo '%2%3: OFF' ; else echo '%2%3: ON -> OFF' ; %1 -F %5.a.%2 -t %4; fi").arg(cmd, anchor, ipStr, tableName, kAnchorName));
+    logger.info() << anchor + ipStr + ": ON -> OFF";
+    const int result = useNftables() ? LinuxNftables::disableAnchor(ip, anchor)
+                                     : execute(QStringLiteral("%1 -F %4.a.%2 -t %3").arg(getCommand(ip), anchor, tableName, kAnchorName));
+    if (result != 0)
+    {
+        state.known = false;
+        return false;
+    }
+    state.enabled[ip].remove(anchor);
+    return true;
 }
 
 bool LinuxFirewall::isAnchorEnabled(LinuxFirewall::IPVersion ip, const QString &anchor, const QString& tableName)
 {
-    const QString cmd = getCommand(ip);
-    return execute(QStringLiteral("%1 -C %4.a.%2 -j %4.%2 -t %3 2> /dev/null").arg(cmd, anchor, tableName, kAnchorName)) == 0;
+    if (ip == Both)
+        return isAnchorEnabled(IPv4, anchor, tableName) && isAnchorEnabled(IPv6, anchor, tableName);
+    if (!state.known)
+        refreshState();
+    return state.enabled[ip].contains(anchor);
 }
 
 void LinuxFirewall::setAnchorEnabled(LinuxFirewall::IPVersion ip, const QString &anchor, bool enabled, const QString &tableName)
 {
+    // Callbacks only run when the anchor actually changes state
     if (enabled)
     {
-        enableAnchor(ip, anchor, tableName);
+        if (!enableAnchor(ip, anchor, tableName))
+            return;
         const QString key = enabledKeyTemplate.arg(tableName, anchor);
         if(anchorCallbacks.contains(key)) anchorCallbacks[key]();
     }
     else
     {
-        disableAnchor(ip, anchor, tableName);
+        if (!disableAnchor(ip, anchor, tableName))
+            return;
         const QString key = disabledKeyTemplate.arg(tableName, anchor);
         if(anchorCallbacks.contains(key)) anchorCallbacks[key]();
     }
@@ -442,32 +641,200 @@ void LinuxFirewall::setAnchorEnabled(LinuxFirewall::IPVersion ip, const QString
 
 void LinuxFirewall::updateDNSServers(const QStringList& servers)
 {
-    static QStringList existingServers {};
-
-    existingServers = servers;
-    execute(QStringLiteral("iptables -F %1.320.allowDNS").arg(kAnchorName));
-    for (const QString& rule : getDNSRules(servers))
-        execute(QStringLiteral("iptables -A %1.320.allowDNS %2").arg(kAnchorName, rule));
+    if (useNftables())
+        updateSetList(QStringLiteral("320.allowDNS"), LinuxNftables::kDnsServersSet, servers);
+    else
+        updateChainList(QStringLiteral("320.allowDNS"), getDNSRules(servers));
 }
 
 void LinuxFirewall::updateAllowNets(const QStringList& servers)
 {
-    static QStringList existingServers {};
-
-    existingServers = servers;
-    execute(QStringLiteral("iptables -F %1.110.allowNets").arg(kAnchorName));
-    for (const QString& rule : getAllowRule(servers))
-        execute(QStringLiteral("iptables -A %1.110.allowNets %2").arg(kAnchorName, rule));
+    if (useNftables())
+        updateSetList(QStringLiteral("110.allowNets"), LinuxNftables::kAllowNetsSet, servers);
+    else
+        updateChainList(QStringLiteral("110.allowNets"), getAllowRule(servers));
 }
 
 void LinuxFirewall::updateBlockNets(const QStringList& servers)
 {
-    static QStringList existingServers {};
+    if (useNftables())
+        updateSetList(QStringLiteral("120.blockNets"), LinuxNftables::kBlockNetsSet, servers);
+    else
+        updateChainList(QStringLiteral("120.blockNets"), getBlockRule(servers));
+}
+
+void LinuxFirewall::addAllowNets(const QStringList& servers)
+{
+    const QString anchor = QStringLiteral("110.allowNets");
+    if (useNftables())
+        appendSetList(anchor, LinuxNftables::kAllowNetsSet, servers);
+    else
+        appendChainList(anchor, getAllowRule(servers));
+}
+
+void LinuxFirewall::addBlockNets(const QStringList& servers)
+{
+    const QString anchor = QStringLiteral("120.blockNets");
+    if (useNftables())
+        appendSetList(anchor, LinuxNftables::kBlockNetsSet, servers);
+    else
+        appendChainList(anchor, getBlockRule(servers));
+}
+
+void LinuxFirewall::prepareKillSwitch()
+{
+    if (!isInstalled())
+        install();
+    else
+        setupTrafficSplitting();
+
+    // Anchors that every kill switch configuration uses are enabled up front;
+    // they stay inert until the gate is opened by setKillSwitchActive().
+    setAnchorEnabled(Both, QStringLiteral("000.allowLoopback"), true);
+    setAnchorEnabled(Both, QStringLiteral("200.allowVPN"), true);
+    setAnchorEnabled(IPv6, QStringLiteral("250.blockIPv6"), true);
+    setAnchorEnabled(Both, QStringLiteral("290.allowDHCP"), true);
+    setAnchorEnabled(Both, QStringLiteral("300.allowLAN"), true);
+    setAnchorEnabled(IPv4, QStringLiteral("310.blockDNS"), true);
+    setAnchorEnabled(IPv4, QStringLiteral("320.allowDNS"), true);
+}
+
+void LinuxFirewall::setKillSwitchActive(bool active)
+{
+    setAnchorEnabled(Both, kKillSwitchAnchor, active);
+}
+
+void LinuxFirewall::deactivateKillSwitch()
+{
+    setKillSwitchActive(false);
+
+    // Anchors outside the filter table don't hang off the gate
+    setAnchorEnabled(Both, QStringLiteral("100.transIp"), false, kNatTable);
+    setAnchorEnabled(Both, QStringLiteral("100.tagPkts"), false, kMangleTable);
+    setAnchorEnabled(Both, QStringLiteral("100.vpnTunOnly"), false, kRawTable);
+    teardownTrafficSplitting();
+}
+
+// Computes the entries to add and remove to get from the last list applied
+// to the anchor to the wanted one. Returns false when nothing is known about
+// the anchor yet and the list has to be applied in full. The caller records
+// the wanted list with setAppliedList() once it is in.
+bool LinuxFirewall::diffList(const QString& anchor, const QStringList& wanted, QStringList& added, QStringList& removed)
+{
+    const auto it = appliedLists.constFind(anchor);
+    if (it == appliedLists.constEnd())
+    {
+        added = wanted;
+        return false;
+    }
+    const QStringList& applied = *it;
+
+    const QSet<QString> appliedSet(applied.begin(), applied.end());
+    const QSet<QString> wantedSet(wanted.begin(), wanted.end());
+    for (const QString& entry : wanted)
+        if (!appliedSet.contains(entry))
+            added << entry;
+    for (const QString& entry : applied)
+        if (!wantedSet.contains(entry))
+            removed << entry;
+
+    // A full refresh costs one flush plus one add per entry
+    const int fullOps = 1 + wanted.size();
+    const int diffOps = added.size() + removed.size();
+    if (fullOps > diffOps)
+        savedOps += fullOps - diffOps;
+    logger.debug() << anchor << ": +" << added.size() << "-" << removed.size() << "," << savedOps << "operations saved so far";
+    return true;
+}
+
+void LinuxFirewall::setAppliedList(const QString& anchor, const QStringList& list, bool applied)
+{
+    // A list that didn't go in cleanly is unknown, the next update rewrites it
+    if (applied)
+        appliedLists.insert(anchor, list);
+    else
+        appliedLists.remove(anchor);
+}
+
+void LinuxFirewall::updateChainList(const QString& anchor, QStringList rules)
+{
+    const QString chain = QStringLiteral("%1.%2").arg(kAnchorName, anchor);
+    rules.removeDuplicates();
+    QStringList added, removed;
+    if (!diffList(anchor, rules, added, removed))
+    {
+        setAppliedList(anchor, rules, replaceChainRules(IPv4, chain, rules));
+        return;
+    }
+    if (added.isEmpty() && removed.isEmpty())
+        return;
+
+    // All rules of a list anchor share the same verdict, so their order in
+    // the chain doesn't matter and new ones can simply be appended.
+    Ruleset ruleset;
+    for (const QString& rule : removed)
+        stageRule(ruleset, IPv4, QStringLiteral("-D %1 %2").arg(chain, rule));
+    for (const QString& rule : added)
+        stageRule(ruleset, IPv4, QStringLiteral("-A %1 %2").arg(chain, rule));
+    if (commit(ruleset, false))
+    {
+        setAppliedList(anchor, rules, true);
+        return;
+    }
+
+    // The chain was changed behind our back, resync it in full rather than
+    // replaying the diff rule by rule first
+    logger.warning() << "Incremental update of" << chain << "failed, rewriting it";
+    setAppliedList(anchor, rules, replaceChainRules(IPv4, chain, rules));
+}
+
+void LinuxFirewall::updateSetList(const QString& anchor, const QString& set, const QStringList& servers)
+{
+    QStringList elements = LinuxNftables::setElements(IPv4, LinuxNftables::resolveHostNames(servers));
+    elements.removeDuplicates();
+    QStringList added, removed;
+    if (!diffList(anchor, elements, added, removed))
+    {
+        setAppliedList(anchor, elements, LinuxNftables::updateSet(IPv4, set, elements));
+        return;
+    }
+    if (LinuxNftables::updateSetElements(IPv4, set, added, removed))
+    {
+        setAppliedList(anchor, elements, true);
+        return;
+    }
+    setAppliedList(anchor, elements, LinuxNftables::updateSet(IPv4, set, elements));
+}
+
+// Adds entries to a list anchor. When the list in the kernel is unknown only
+// the additions are staged, so whatever it holds stays, and it stays unknown.
+void LinuxFirewall::appendChainList(const QString& anchor, const QStringList& rules)
+{
+    const auto it = appliedLists.constFind(anchor);
+    if (it != appliedLists.constEnd())
+    {
+        updateChainList(anchor, *it + rules);
+        return;
+    }
+
+    const QString chain = QStringLiteral("%1.%2").arg(kAnchorName, anchor);
+    Ruleset ruleset;
+    for (const QString& rule : rules)
+        stageRule(ruleset, IPv4, QStringLiteral("-A %1 %2").arg(chain, rule));
+    commit(ruleset);
+}
+
+void LinuxFirewall::appendSetList(const QString& anchor, const QString& set, const QStringList& servers)
+{
+    const auto it = appliedLists.constFind(anchor);
+    if (it != appliedLists.constEnd())
+    {
+        updateSetList(anchor, set, *it + servers);
+        return;
+    }
 
-    existingServers = servers;
-    execute(QStringLiteral("iptables -F %1.120.blockNets").arg(kAnchorName));
-    for (const QString& rule : getBlockRule(servers))
-        execute(QStringLiteral("iptables -A %1.120.blockNets %2").arg(kAnchorName, rule));
+    // Adding an element that is already in the set is not an error
+    LinuxNftables::updateSetElements(IPv4, set, LinuxNftables::setElements(IPv4, LinuxNftables::resolveHostNames(servers)), {});
 }
 
 int waitForExitCode(QProcess& process)
@@ -500,6 +867,194 @@ int LinuxFirewall::execute(const QString &command, bool ignoreErrors)
     return exitCode;
 }
 
+void LinuxFirewall::setRestoreEnabled(bool enabled)
+{
+    restoreEnabled() = enabled;
+}
+
+bool LinuxFirewall::useNftables()
+{
+    // iptables stays the default, since other software on the host may
+    // manage the same tables through it. AMNEZIA_FIREWALL_BACKEND=nftables
+    // opts into native nftables, which keeps the address lists in sets and
+    // applies every change as one transaction.
+    static const bool useNft = [] {
+        const bool requested = qEnvironmentVariable("AMNEZIA_FIREWALL_BACKEND") == QLatin1String("nftables");
+        const bool available = requested && LinuxNftables::isAvailable();
+        if (requested && !available)
+            logger.warning() << "nftables backend requested, but nft is not available";
+        logger.info() << "Using" << (available ? "nftables" : "iptables") << "firewall backend";
+        return available;
+    }();
+    return useNft;
+}
+
+int LinuxFirewall::RuleBatch::size(const QString& table) const
+{
+    return chains.value(table).size() + rules.value(table).size();
+}
+
+int LinuxFirewall::RuleBatch::size() const
+{
+    int total = 0;
+    for (const QString& table : tables)
+        total += size(table);
+    return total;
+}
+
+void LinuxFirewall::stageChain(Ruleset& ruleset, LinuxFirewall::IPVersion ip, const QString& chain, const QString& tableName)
+{
+    if (ip == Both)
+    {
+        stageChain(ruleset, IPv4, chain, tableName);
+        stageChain(ruleset, IPv6, chain, tableName);
+        return;
+    }
+    RuleBatch& batch = ruleset.batch[ip];
+    if (!batch.tables.contains(tableName))
+        batch.tables.append(tableName);
+    batch.chains[tableName].append(chain);
+}
+
+void LinuxFirewall::stageRule(Ruleset& ruleset, LinuxFirewall::IPVersion ip, const QString& rule, const QString& tableName)
+{
+    if (ip == Both)
+    {
+        stageRule(ruleset, IPv4, rule, tableName);
+        stageRule(ruleset, IPv6, rule, tableName);
+        return;
+    }
+    RuleBatch& batch = ruleset.batch[ip];
+    if (!batch.tables.contains(tableName))
+        batch.tables.append(tableName);
+    batch.rules[tableName].append(rule);
+}
+
+bool LinuxFirewall::replaceChainRules(LinuxFirewall::IPVersion ip, const QString& chain, const QStringList& rules, const QString& tableName)
+{
+    // Declaring the chain in a --noflush restore flushes it in the same
+    // transaction, so the list is never observed half-applied.
+    Ruleset ruleset;
+    stageChain(ruleset, ip, chain, tableName);
+    for (const QString& rule : rules)
+        stageRule(ruleset, ip, QStringLiteral("-A %1 %2").arg(chain, rule), tableName);
+    return commit(ruleset);
+}
+
+bool LinuxFirewall::commit(const Ruleset& ruleset, bool fallback)
+{
+    bool result = true;
+    for (IPVersion ip : {IPv4, IPv6})
+    {
+        const RuleBatch& batch = ruleset.batch[ip];
+        if (batch.isEmpty())
+            continue;
+
+        QElapsedTimer timer;
+        timer.start();
+        if (restoreEnabled())
+        {
+            if (restoreBatch(ip, batch))
+            {
+                logger.debug() << "Committed" << batch.size() << "entries in" << batch.tables.size() << "tables via" << getRestoreCommand(ip) << "in" << timer.elapsed() << "ms";
+                continue;
+            }
+            result = false;
+            if (!fallback)
+                continue;
+
+            // iptables-restore is missing or rejected a table (e.g. no IPv6
+            // NAT support); nothing of the batch is in, so replay it rule by
+            // rule and let the rest still apply.
+            logger.warning() << getRestoreCommand(ip) << "failed, falling back to per-rule updates";
+            timer.restart();
+        }
+        for (const QString& table : batch.tables)
+            applyPerRule(ip, batch, table);
+        logger.debug() << "Applied" << batch.size() << "entries via" << getCommand(ip) << "in" << timer.elapsed() << "ms";
+    }
+    return result;
+}
+
+// Legacy iptables-restore commits every table block on its own, so the tables
+// are restored one per call. When a later table fails, the tables already in
+// are put back from snapshots taken just before, so a batch spanning tables
+// is never left half-applied.
+bool LinuxFirewall::restoreBatch(LinuxFirewall::IPVersion ip, const RuleBatch& batch)
+{
+    const bool spansTables = batch.tables.size() > 1;
+    QList<QPair<QString, QByteArray>> committed;
+    for (const QString& table : batch.tables)
+    {
+        QByteArray snapshot;
+        const bool saved = !spansTables || saveTable(ip, table, snapshot);
+        if (!saved || restore(ip, batch, table) != 0)
+        {
+            logger.warning() << getRestoreCommand(ip) << "failed for" << table << ", rolling back" << committed.size() << "tables";
+            for (auto it = committed.crbegin(); it != committed.crend(); ++it)
+            {
+                if (runRestore(ip, it->second, false) != 0)
+                    logger.warning() << "Cannot roll back the" << it->first << "table";
+            }
+            return false;
+        }
+        committed.append({table, snapshot});
+    }
+    return true;
+}
+
+int LinuxFirewall::restore(LinuxFirewall::IPVersion ip, const RuleBatch& batch, const QString& table)
+{
+    QByteArray payload = "*" + table.toUtf8() + "\n";
+    for (const QString& chain : batch.chains.value(table))
+        payload += ":" + chain.toUtf8() + " - [0:0]\n";
+    for (const QString& rule : batch.rules.value(table))
+        payload += rule.toUtf8() + "\n";
+    payload += "COMMIT\n";
+    return runRestore(ip, payload, true);
+}
+
+// Without noflush, every table in the payload is replaced as a whole
+int LinuxFirewall::runRestore(LinuxFirewall::IPVersion ip, const QByteArray& payload, bool noflush)
+{
+    QProcess p;
+    p.start(getRestoreCommand(ip), noflush ? QStringList{QStringLiteral("--noflush")} : QStringList{});
+    p.write(payload);
+    p.closeWriteChannel();
+
+    int exitCode = waitForExitCode(p);
+    auto err = p.readAllStandardError().trimmed();
+    if (exitCode != 0)
+        logger.warning() << "(" << exitCode << ") $ " << getRestoreCommand(ip) << (noflush ? "--noflush" : "");
+    if (!err.isEmpty())
+        logger.warning() << err;
+    return exitCode;
+}
+
+// Dumps a table in iptables-restore syntax, so it can be put back as it was
+bool LinuxFirewall::saveTable(LinuxFirewall::IPVersion ip, const QString& table, QByteArray& snapshot)
+{
+    QProcess p;
+    p.start(getSaveCommand(ip), {QStringLiteral("-t"), table});
+    p.closeWriteChannel();
+    if (waitForExitCode(p) != 0)
+    {
+        logger.warning() << getSaveCommand(ip) << "failed for" << table;
+        return false;
+    }
+    snapshot = p.readAllStandardOutput();
+    return !snapshot.isEmpty();
+}
+
+void LinuxFirewall::applyPerRule(LinuxFirewall::IPVersion ip, const RuleBatch& batch, const QString& table)
+{
+    const QString cmd = getCommand(ip);
+    for (const QString& chain : batch.chains.value(table))
+        createChain(ip, chain, table);
+    for (const QString& rule : batch.rules.value(table))
+        execute(QStringLiteral("%1 %2 -t %3").arg(cmd, rule, table));
+}
+
 void LinuxFirewall::setupTrafficSplitting()
 {
     auto cGroupDir = "/sys/fs/cgroup/net_cls/" BRAND_CODE "vpnexclusions/";
@@ -34,6 +34,7 @@
 #define LINUXFIREWALL_H
 
 
+#include <QHash>
 #include <QString>
 #include <QStringList>
 
@@ -70,14 +71,32 @@ public:
     enum IPVersion { IPv4, IPv6, Both };
     // Table names
     static QString kFilterTable, kNatTable, kMangleTable, kRtableName, kRawTable;
+    // Filter anchor gating all other filter anchors
+    static QString kKillSwitchAnchor;
 public:
     using FilterCallbackFunc = std::function<void()>;
 private:
+    // Chains and rules staged in iptables-restore syntax for a single address
+    // family, grouped by table in the order the tables were first touched.
+    struct RuleBatch
+    {
+        QStringList tables;
+        QHash<QString, QStringList> chains;
+        QHash<QString, QStringList> rules;
+        bool isEmpty() const { return tables.isEmpty(); }
+        int size(const QString& table) const;
+        int size() const;
+    };
+    struct Ruleset
+    {
+        RuleBatch batch[2]; // indexed by IPv4 / IPv6
+    };
+
     static int createChain(IPVersion ip, const QString& chain, const QString& tableName = kFilterTable);
     static int deleteChain(IPVersion ip, const QString& chain, const QString& tableName = kFilterTable);
     static int linkChain(IPVersion ip, const QString& chain, const QString& parent, bool mustBeFirst = false, const QString& tableName = kFilterTable);
     static int unlinkChain(IPVersion ip, const QString& chain, const QString& parent, const QString& tableName = kFilterTable);
-    static void installAnchor(IPVersion ip, const QString& anchor, const QStringList& rules, const QString& tableName = kFilterTable, const FilterCallbackFunc& enableFunc = {}, const FilterCallbackFunc& disableFunc = {});
+    static void installAnchor(Ruleset& ruleset, IPVersion ip, const QString& anchor, const QStringList& rules, const QString& tableName = kFilterTable, const FilterCallbackFunc& enableFunc = {}, const FilterCallbackFunc& disableFunc = {});
     static void uninstallAnchor(IPVersion ip, const QString& anchor, const QString& tableName = kFilterTable);
     static QStringList getDNSRules(const QStringList& servers);
     static QStringList getAllowRule(const QStringList& servers);
@@ -85,23 +104,57 @@ private:
     static void setupTrafficSplitting();
     static void teardownTrafficSplitting();
     static int execute(const QString& command, bool ignoreErrors = false);
+    static void stageChain(Ruleset& ruleset, IPVersion ip, const QString& chain, const QString& tableName = kFilterTable);
+    static void stageRule(Ruleset& ruleset, IPVersion ip, const QString& rule, const QString& tableName = kFilterTable);
+    static bool replaceChainRules(IPVersion ip, const QString& chain, const QStringList& rules, const QString& tableName = kFilterTable);
+    // Returns false if any address family had to be (or, without fallback,
+    // wasn't) applied rule by rule; callers that resync on failure pass no
+    // fallback.
+    static bool commit(const Ruleset& ruleset, bool fallback = true);
+    static bool restoreBatch(IPVersion ip, const RuleBatch& batch);
+    static int restore(IPVersion ip, const RuleBatch& batch, const QString& table);
+    static int runRestore(IPVersion ip, const QByteArray& payload, bool noflush);
+    static bool saveTable(IPVersion ip, const QString& table, QByteArray& snapshot);
+    static void applyPerRule(IPVersion ip, const RuleBatch& batch, const QString& table);
+    static bool readState(IPVersion ip, QStringList& anchors, QStringList& enabled);
+    static bool diffList(const QString& anchor, const QStringList& wanted, QStringList& added, QStringList& removed);
+    static void setAppliedList(const QString& anchor, const QStringList& list, bool applied);
+    static void updateChainList(const QString& anchor, QStringList rules);
+    static void updateSetList(const QString& anchor, const QString& set, const QStringList& servers);
+    static void appendChainList(const QString& anchor, const QStringList& rules);
+    static void appendSetList(const QString& anchor, const QString& set, const QStringList& servers);
 private:
     // Chain names
     static QString kOutputChain, kRootChain, kPostRoutingChain, kPreRoutingChain;
 
 public:
+    static bool useNftables();
+    // Overrides AMNEZIA_FIREWALL_RESTORE, for benchmarks comparing both paths
+    static void setRestoreEnabled(bool enabled);
     static void install();
     static void uninstall();
     static bool isInstalled();
     static void ensureRootAnchorPriority(IPVersion ip = Both);
-    static void enableAnchor(IPVersion ip, const QString& anchor, const QString& tableName = kFilterTable);
-    static void disableAnchor(IPVersion ip, const QString& anchor, const QString& tableName = kFilterTable);
+    // Re-reads our chains from the kernel into the cached state
+    static void refreshState();
+    static bool enableAnchor(IPVersion ip, const QString& anchor, const QString& tableName = kFilterTable);
+    static bool disableAnchor(IPVersion ip, const QString& anchor, const QString& tableName = kFilterTable);
     static bool isAnchorEnabled(IPVersion ip, const QString& anchor, const QString& tableName = kFilterTable);
     static void setAnchorEnabled(IPVersion ip, const QString& anchor, bool enabled, const QString& tableName = kFilterTable);
     static void replaceAnchor(LinuxFirewall::IPVersion ip, const QString &anchor, const QString &newRule, const QString& tableName);
     static void updateDNSServers(const QStringList& servers);
     static void updateAllowNets(const QStringList& servers);
     static void updateBlockNets(const QStringList& servers);
+    // Extend the lists, leaving the entries already there in place
+    static void addAllowNets(const QStringList& servers);
+    static void addBlockNets(const QStringList& servers);
+    // Installs the firewall if needed and enables the fixed kill switch anchors
+    // behind the (closed) gate, so activation later is a single jump rule.
+    static void prepareKillSwitch();
+    static void setKillSwitchActive(bool active);
+    // Closes the gate and drops everything that acts on traffic outside it,
+    // leaving only the inert filter chains staged for the next connection
+    static void deactivateKillSwitch();
 };
 
 #endif // LINUXFIREWALL_H
@@ -0,0 +1,290 @@
+#include "linuxgatewaytracker.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <net/if.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "logger.h"
+
+namespace {
+Logger logger("LinuxGatewayTracker");
+
+// Bounds the synchronous initial dump, the kernel answers at once
+constexpr int kDumpTimeoutSec = 2;
+constexpr int kDumpAttempts = 3;
+
+int familyIndex(QAbstractSocket::NetworkLayerProtocol family) {
+  return family == QAbstractSocket::IPv6Protocol ? 1 : 0;
+}
+}  // namespace
+
+LinuxGatewayTracker* LinuxGatewayTracker::instance() {
+  static LinuxGatewayTracker s_instance;
+  return &s_instance;
+}
+
+LinuxGatewayTracker::LinuxGatewayTracker(QObject* parent) : QObject(parent) {
+  m_nlsock = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+  if (m_nlsock < 0) {
+    logger.warning() << "Failed to create netlink socket:" << strerror(errno);
+    return;
+  }
+
+  struct timeval timeout = {kDumpTimeoutSec, 0};
+  setsockopt(m_nlsock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  struct sockaddr_nl nladdr;
+  memset(&nladdr, 0, sizeof(nladdr));
+  nladdr.nl_family = AF_NETLINK;
+  nladdr.nl_groups = RTMGRP_IPV4_ROUTE | RTMGRP_IPV6_ROUTE;
+  if (bind(m_nlsock, (struct sockaddr*)&nladdr, sizeof(nladdr)) != 0) {
+    logger.warning() << "Failed to bind netlink socket:" << strerror(errno);
+    close(m_nlsock);
+    m_nlsock = -1;
+    return;
+  }
+
+  m_notifier = new QSocketNotifier(m_nlsock, QSocketNotifier::Read, this);
+  connect(m_notifier, &QSocketNotifier::activated, this,
+          &LinuxGatewayTracker::nlsockReady);
+
+  resync();
+}
+
+LinuxGatewayTracker::~LinuxGatewayTracker() {
+  // Unregister the socket before it is closed
+  delete m_notifier;
+  if (m_nlsock >= 0) {
+    close(m_nlsock);
+  }
+}
+
+QHostAddress LinuxGatewayTracker::gateway(
+    QAbstractSocket::NetworkLayerProtocol family) const {
+  return m_best[familyIndex(family)].gateway;
+}
+
+int LinuxGatewayTracker::ifindex(
+    QAbstractSocket::NetworkLayerProtocol family) const {
+  return m_best[familyIndex(family)].ifindex;
+}
+
+QString LinuxGatewayTracker::ifname(
+    QAbstractSocket::NetworkLayerProtocol family) const {
+  char name[IF_NAMESIZE] = {};
+  const int index = ifindex(family);
+  if (index <= 0 || !if_indextoname(index, name)) {
+    return QString();
+  }
+  return QString::fromLocal8Bit(name);
+}
+
+// Reads all routes before returning, so that the first lookups already find
+// the gateway. Only used at start, later dumps are read by nlsockReady().
+void LinuxGatewayTracker::resync() {
+  // A dump that overflowed the socket buffer or raced with a route change is
+  // incomplete, read it again
+  for (m_dumpAttempt = 1; m_dumpAttempt <= kDumpAttempts; ++m_dumpAttempt) {
+    if (!requestDump()) {
+      break;
+    }
+    while (m_dumping && readMessages(true)) {
+    }
+    m_dumping = false;
+    if (!m_overflow && !m_interrupted) {
+      break;
+    }
+    logger.debug() << "Route dump incomplete, attempt" << m_dumpAttempt;
+  }
+  finishDump();
+}
+
+// Asks the kernel for all routes, the replies are read by readMessages()
+bool LinuxGatewayTracker::requestDump() {
+  struct {
+    struct nlmsghdr nlmsg;
+    struct rtmsg rtm;
+  } req;
+  memset(&req, 0, sizeof(req));
+  req.nlmsg.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+  req.nlmsg.nlmsg_type = RTM_GETROUTE;
+  req.nlmsg.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+  req.nlmsg.nlmsg_seq = ++m_nlseq;
+  req.rtm.rtm_family = AF_UNSPEC;
+
+  struct sockaddr_nl nladdr;
+  memset(&nladdr, 0, sizeof(nladdr));
+  nladdr.nl_family = AF_NETLINK;
+  if (sendto(m_nlsock, &req, req.nlmsg.nlmsg_len, 0,
+             (struct sockaddr*)&nladdr, sizeof(nladdr)) < 0) {
+    logger.warning() << "Failed to request routes:" << strerror(errno);
+    return false;
+  }
+
+  m_routes[0].clear();
+  m_routes[1].clear();
+  m_overflow = false;
+  m_interrupted = false;
+  m_dumpSeq = req.nlmsg.nlmsg_seq;
+  m_dumping = true;
+  return true;
+}
+
+void LinuxGatewayTracker::finishDump() {
+  m_dumping = false;
+  m_overflow = false;
+  m_interrupted = false;
+  m_dumpAttempt = 0;
+
+  updateBest(AF_INET);
+  updateBest(AF_INET6);
+  logger.debug() << "Default gateway" << m_best[0].gateway.toString() << "on"
+                 << ifname(QAbstractSocket::IPv4Protocol);
+}
+
+void LinuxGatewayTracker::nlsockReady() {
+  const bool wasDumping = m_dumping;
+  while (readMessages(false)) {
+  }
+
+  if (m_overflow || m_interrupted) {
+    // The dump in progress is incomplete as well, so start over
+    if (m_dumpAttempt < kDumpAttempts) {
+      ++m_dumpAttempt;
+      logger.debug() << "Routes out of sync, re-reading them, attempt"
+                     << m_dumpAttempt;
+      if (requestDump()) {
+        return;
+      }
+    }
+    logger.warning() << "Route dump incomplete, keeping what was read";
+    finishDump();
+    return;
+  }
+
+  if (wasDumping && !m_dumping) {
+    finishDump();
+  }
+}
+
+bool LinuxGatewayTracker::readMessages(bool blocking) {
+  char buf[32 * 1024];
+  ssize_t len = recv(m_nlsock, buf, sizeof(buf), blocking ? 0 : MSG_DONTWAIT);
+  if (len <= 0) {
+    // The socket buffer overflowed and notifications were dropped
+    if (len < 0 && errno == ENOBUFS) {
+      m_overflow = true;
+    }
+    return false;
+  }
+
+  int remaining = static_cast<int>(len);
+  for (struct nlmsghdr* nlmsg = (struct nlmsghdr*)buf;
+       NLMSG_OK(nlmsg, remaining); nlmsg = NLMSG_NEXT(nlmsg, remaining)) {
+    // Set on the dump replies that follow a route change made mid-dump
+    if (m_dumping && nlmsg->nlmsg_seq == m_dumpSeq &&
+        (nlmsg->nlmsg_flags & NLM_F_DUMP_INTR)) {
+      m_interrupted = true;
+    }
+    switch (nlmsg->nlmsg_type) {
+      case NLMSG_DONE:
+      case NLMSG_ERROR:
+        if (nlmsg->nlmsg_seq == m_dumpSeq) {
+          m_dumping = false;
+        }
+        break;
+      case RTM_NEWROUTE:
+      case RTM_DELROUTE:
+        handleRoute(nlmsg);
+        break;
+      default:
+        break;
+    }
+  }
+  return true;
+}
+
+void LinuxGatewayTracker::handleRoute(const struct nlmsghdr* nlmsg) {
+  const struct rtmsg* rtm =
+      static_cast<const struct rtmsg*>(NLMSG_DATA(nlmsg));
+  if (rtm->rtm_dst_len != 0 || rtm->rtm_type != RTN_UNICAST ||
+      (rtm->rtm_family != AF_INET && rtm->rtm_family != AF_INET6)) {
+    return;
+  }
+
+  quint32 table = rtm->rtm_table;
+  DefaultRoute route;
+  int attrlen = RTM_PAYLOAD(nlmsg);
+  for (const struct rtattr* attr = RTM_RTA(rtm); RTA_OK(attr, attrlen);
+       attr = RTA_NEXT(attr, attrlen)) {
+    switch (attr->rta_type) {
+      case RTA_GATEWAY:
+        if (rtm->rtm_family == AF_INET &&
+            RTA_PAYLOAD(attr) >= sizeof(struct in_addr)) {
+          route.gateway =
+              QHostAddress(ntohl(*static_cast<const quint32*>(RTA_DATA(attr))));
+        } else if (RTA_PAYLOAD(attr) >= sizeof(struct in6_addr)) {
+          route.gateway =
+              QHostAddress(static_cast<const quint8*>(RTA_DATA(attr)));
+        }
+        break;
+      case RTA_OIF:
+        route.ifindex = *static_cast<const int*>(RTA_DATA(attr));
+        break;
+      case RTA_PRIORITY:
+        route.metric = *static_cast<const quint32*>(RTA_DATA(attr));
+        break;
+      case RTA_TABLE:
+        table = *static_cast<const quint32*>(RTA_DATA(attr));
+        break;
+      default:
+        break;
+    }
+  }
+
+  // Device-only default routes (e.g. the tunnel itself) have no gateway
+  if (table != RT_TABLE_MAIN || route.gateway.isNull()) {
+    return;
+  }
+
+  // A route is the same one whatever its metric, so a replace that changes
+  // the metric updates the entry instead of leaving the old one behind
+  QList<DefaultRoute>& routes = m_routes[rtm->rtm_family == AF_INET6 ? 1 : 0];
+  routes.removeAll(route);
+  if (nlmsg->nlmsg_type == RTM_NEWROUTE) {
+    routes.append(route);
+  }
+
+  if (!m_dumping) {
+    updateBest(rtm->rtm_family);
+  }
+}
+
+void LinuxGatewayTracker::updateBest(int family) {
+  const int index = family == AF_INET6 ? 1 : 0;
+  DefaultRoute best;
+  for (const DefaultRoute& route : m_routes[index]) {
+    if (best.gateway.isNull() || route.metric < best.metric) {
+      best = route;
+    }
+  }
+
+  if (best.gateway == m_best[index].gateway &&
+      best.ifindex == m_best[index].ifindex) {
+    m_best[index].metric = best.metric;
+    return;
+  }
+
+  m_best[index] = best;
+  const auto protocol = family == AF_INET6 ? QAbstractSocket::IPv6Protocol
+                                           : QAbstractSocket::IPv4Protocol;
+  logger.info() << "Default gateway changed to" << best.gateway.toString()
+                << "on" << ifname(protocol);
+  emit gatewayChanged(protocol, best.gateway, best.ifindex);
+}
@@ -0,0 +1,74 @@
+#ifndef LINUXGATEWAYTRACKER_H
+#define LINUXGATEWAYTRACKER_H
+
+#include <QAbstractSocket>
+#include <QHostAddress>
+#include <QList>
+#include <QObject>
+#include <QSocketNotifier>
+
+struct nlmsghdr;
+
+// Keeps track of the default gateway of the main routing table. The routes
+// are dumped once when the tracker is created and then kept up to date from
+// rtnetlink route notifications, so lookups never touch the kernel. When
+// notifications are lost the routes are dumped again in the background.
+class LinuxGatewayTracker final : public QObject {
+  Q_OBJECT
+
+ public:
+  static LinuxGatewayTracker* instance();
+
+  QHostAddress gateway(QAbstractSocket::NetworkLayerProtocol family =
+                           QAbstractSocket::IPv4Protocol) const;
+  int ifindex(QAbstractSocket::NetworkLayerProtocol family =
+                  QAbstractSocket::IPv4Protocol) const;
+  QString ifname(QAbstractSocket::NetworkLayerProtocol family =
+                     QAbstractSocket::IPv4Protocol) const;
+
+ signals:
+  void gatewayChanged(QAbstractSocket::NetworkLayerProtocol family,
+                      const QHostAddress& gateway, int ifindex);
+
+ private:
+  struct DefaultRoute {
+    QHostAddress gateway;
+    int ifindex = 0;
+    quint32 metric = 0;
+
+    // Default routes are told apart by gateway and interface only
+    bool operator==(const DefaultRoute& other) const {
+      return gateway == other.gateway && ifindex == other.ifindex;
+    }
+  };
+
+  explicit LinuxGatewayTracker(QObject* parent = nullptr);
+  ~LinuxGatewayTracker();
+
+  void resync();
+  bool requestDump();
+  void finishDump();
+  bool readMessages(bool blocking);
+  void handleRoute(const struct nlmsghdr* nlmsg);
+  void updateBest(int family);
+
+  int m_nlsock = -1;
+  quint32 m_nlseq = 0;
+  quint32 m_dumpSeq = 0;
+  bool m_dumping = false;
+  int m_dumpAttempt = 0;
+  // Notifications or dump replies were dropped
+  bool m_overflow = false;
+  // The routes changed while they were being dumped
+  bool m_interrupted = false;
+  QSocketNotifier* m_notifier = nullptr;
+
+  // Indexed by 0 = IPv4, 1 = IPv6
+  QList<DefaultRoute> m_routes[2];
+  DefaultRoute m_best[2];
+
+ private slots:
+  void nlsockReady();
+};
+
+#endif  // LINUXGATEWAYTRACKER_H
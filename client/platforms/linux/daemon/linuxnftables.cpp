@@ -0,0 +1,352 @@
+#include "linuxnftables.h"
+
+#include <QElapsedTimer>
+#include <QHostAddress>
+#include <QHostInfo>
+#include <QProcess>
+#include <QTextStream>
+
+#include "logger.h"
+
+namespace
+{
+Logger logger("LinuxNftables");
+
+const QString kTableName = QStringLiteral("amnvpn");
+const QString kRootChain = QStringLiteral("amnvpn.anchors");
+const QString kNatRootChain = QStringLiteral("amnvpn.nat.anchors");
+const QString kMangleRootChain = QStringLiteral("amnvpn.mangle.anchors");
+const QString kRawRootChain = QStringLiteral("amnvpn.raw.anchors");
+
+struct Anchor
+{
+    QString rootChain;
+    QString name;
+    QStringList rules;
+};
+
+QString family(LinuxFirewall::IPVersion ip)
+{
+    return ip == LinuxFirewall::IPv6 ? QStringLiteral("ip6") : QStringLiteral("ip");
+}
+
+QString placeholderChain(const QString& anchor)
+{
+    return QStringLiteral("amnvpn.a.%1").arg(anchor);
+}
+
+QString anchorChain(const QString& anchor)
+{
+    return QStringLiteral("amnvpn.%1").arg(anchor);
+}
+
+// Anchors in evaluation order, mirroring LinuxFirewall::install().
+QList<Anchor> anchors(LinuxFirewall::IPVersion ip)
+{
+    const bool v4 = ip == LinuxFirewall::IPv4;
+    QList<Anchor> result;
+
+    result.append({kRootChain, QStringLiteral("000.allowLoopback"), {QStringLiteral("oifname \"lo*\" accept")}});
+    if (v4) {
+        QStringList dnsRules;
+        for (const QString& iface : {QStringLiteral("amn0*"), QStringLiteral("tun0*")}) {
+            for (const QString& proto : {QStringLiteral("udp"), QStringLiteral("tcp")}) {
+                dnsRules << QStringLiteral("oifname \"%1\" ip daddr @%2 %3 dport 53 accept")
+                                .arg(iface, LinuxNftables::kDnsServersSet, proto);
+            }
+        }
+        result.append({kRootChain, QStringLiteral("320.allowDNS"), dnsRules});
+    }
+    result.append({kRootChain, QStringLiteral("310.blockDNS"), {
+                                                                    QStringLiteral("udp dport 53 reject"),
+                                                                    QStringLiteral("tcp dport 53 reject"),
+                                                                }});
+    if (v4) {
+        result.append({kRootChain, QStringLiteral("300.allowLAN"), {
+                                                                        QStringLiteral("ip daddr { 10.0.0.0/8, 169.254.0.0/16, 172.16.0.0/12, 192.168.0.0/16, 224.0.0.0/4, 255.255.255.255 } accept"),
+                                                                    }});
+        result.append({kRootChain, QStringLiteral("290.allowDHCP"), {
+                                                                         QStringLiteral("ip daddr 255.255.255.255 udp sport 68 udp dport 67 accept"),
+                                                                     }});
+    } else {
+        result.append({kRootChain, QStringLiteral("300.allowLAN"), {
+                                                                        QStringLiteral("ip6 daddr { fc00::/7, fe80::/10, ff00::/8 } accept"),
+                                                                    }});
+        result.append({kRootChain, QStringLiteral("290.allowDHCP"), {
+                                                                         QStringLiteral("ip6 daddr ff00::/8 udp sport 546 udp dport 547 accept"),
+                                                                     }});
+        result.append({kRootChain, QStringLiteral("250.blockIPv6"), {QStringLiteral("oifname != \"lo*\" reject")}});
+    }
+    result.append({kRootChain, QStringLiteral("200.allowVPN"), {
+                                                                    QStringLiteral("oifname \"amn0*\" accept"),
+                                                                    QStringLiteral("oifname \"tun0*\" accept"),
+                                                                }});
+    if (v4) {
+        result.append({kRootChain, QStringLiteral("120.blockNets"),
+                       {QStringLiteral("ip daddr @%1 reject").arg(LinuxNftables::kBlockNetsSet)}});
+        result.append({kRootChain, QStringLiteral("110.allowNets"),
+                       {QStringLiteral("ip daddr @%1 accept").arg(LinuxNftables::kAllowNetsSet)}});
+    }
+    result.append({kRootChain, QStringLiteral("100.blockAll"), {QStringLiteral("reject")}});
+
+    // Link the filter anchors below the kill switch gate, which becomes the
+    // only anchor in the root filter chain.
+    Anchor gate{kRootChain, LinuxFirewall::kKillSwitchAnchor, {}};
+    for (Anchor& anchor : result) {
+        gate.rules << QStringLiteral("jump %1").arg(placeholderChain(anchor.name));
+        anchor.rootChain = anchorChain(gate.name);
+    }
+    result.prepend(gate);
+
+    // NAT, mangle and raw anchors, see LinuxFirewall::install() for details
+    result.append({kNatRootChain, QStringLiteral("100.transIp"), {QStringLiteral("masquerade")}});
+    result.append({kMangleRootChain, QStringLiteral("100.tagPkts"), {QStringLiteral("meta cgroup 0x567 meta mark set 0x3211")}});
+    result.append({kRawRootChain, QStringLiteral("100.vpnTunOnly"), {QStringLiteral("accept")}});
+
+    return result;
+}
+}
+
+QString LinuxNftables::kAllowNetsSet = QStringLiteral("allownets");
+QString LinuxNftables::kBlockNetsSet = QStringLiteral("blocknets");
+QString LinuxNftables::kDnsServersSet = QStringLiteral("dnsservers");
+
+bool LinuxNftables::isAvailable()
+{
+    return run({QStringLiteral("list"), QStringLiteral("tables")}) == 0;
+}
+
+QString LinuxNftables::ruleset(LinuxFirewall::IPVersion ip)
+{
+    const QString fam = family(ip);
+    const QList<Anchor> all = anchors(ip);
+
+    QString script;
+    QTextStream out(&script);
+
+    // Adding and deleting the table first makes the whole definition below a
+    // replacement of any previous state within the same transaction.
+    out << "add table " << fam << " " << kTableName << "\n";
+    out << "delete table " << fam << " " << kTableName << "\n";
+    out << "table " << fam << " " << kTableName << " {\n";
+
+    if (ip == LinuxFirewall::IPv4) {
+        for (const QString& set : {kAllowNetsSet, kBlockNetsSet, kDnsServersSet}) {
+            out << "  set " << set << " { type ipv4_addr; flags interval; auto-merge; }\n";
+        }
+    }
+
+    // Chains are declared before anything jumps to them: placeholders first,
+    // then anchors (including the gate), roots and finally the base chains.
+    for (const Anchor& anchor : all) {
+        out << "  chain " << placeholderChain(anchor.name) << " {\n  }\n";
+    }
+    for (const Anchor& anchor : all) {
+        out << "  chain " << anchorChain(anchor.name) << " {\n";
+        for (const QString& rule : anchor.rules) {
+            out << "    " << rule << "\n";
+        }
+        out << "  }\n";
+    }
+
+    for (const QString& root : {kRootChain, kNatRootChain, kMangleRootChain, kRawRootChain}) {
+        out << "  chain " << root << " {\n";
+        for (const Anchor& anchor : all) {
+            if (anchor.rootChain == root) {
+                out << "    jump " << placeholderChain(anchor.name) << "\n";
+            }
+        }
+        out << "  }\n";
+    }
+
+    // Base chains are registered just ahead of the corresponding iptables
+    // priorities so our anchors are evaluated first.
+    out << "  chain output { type filter hook output priority -1; policy accept; jump " << kRootChain << "; }\n";
+    out << "  chain postrouting { type nat hook postrouting priority 99; policy accept; jump " << kNatRootChain << "; }\n";
+    out << "  chain mangle { type route hook output priority -151; policy accept; jump " << kMangleRootChain << "; }\n";
+    out << "  chain prerouting { type filter hook prerouting priority -301; policy accept; jump " << kRawRootChain << "; }\n";
+
+    out << "}\n";
+    out.flush();
+    return script;
+}
+
+void LinuxNftables::install()
+{
+    QElapsedTimer timer;
+    timer.start();
+    apply(ruleset(LinuxFirewall::IPv4) + ruleset(LinuxFirewall::IPv6));
+    logger.debug() << "Installed nftables ruleset in" << timer.elapsed() << "ms";
+}
+
+void LinuxNftables::uninstall()
+{
+    QString script;
+    for (LinuxFirewall::IPVersion ip : {LinuxFirewall::IPv4, LinuxFirewall::IPv6}) {
+        script += QStringLiteral("add table %1 %2\ndelete table %1 %2\n").arg(family(ip), kTableName);
+    }
+    apply(script);
+    logger.debug() << "LinuxNftables::uninstall() complete";
+}
+
+int LinuxNftables::enableAnchor(LinuxFirewall::IPVersion ip, const QString& anchor)
+{
+    return apply(QStringLiteral("flush chain %1 %2 %3\nadd rule %1 %2 %3 jump %4\n")
+                     .arg(family(ip), kTableName, placeholderChain(anchor), anchorChain(anchor)));
+}
+
+int LinuxNftables::disableAnchor(LinuxFirewall::IPVersion ip, const QString& anchor)
+{
+    return apply(QStringLiteral("flush chain %1 %2 %3\n").arg(family(ip), kTableName, placeholderChain(anchor)));
+}
+
+bool LinuxNftables::readState(LinuxFirewall::IPVersion ip, QStringList& anchors, QStringList& enabled)
+{
+    QByteArray output;
+    if (run({QStringLiteral("list"), QStringLiteral("table"), family(ip), kTableName}, QByteArray(), &output) != 0) {
+        return false;
+    }
+
+    const QString placeholderPrefix = placeholderChain(QString());
+    QString anchor;
+    for (const QByteArray& rawLine : output.split('\n')) {
+        const QString line = QString::fromUtf8(rawLine).trimmed();
+        if (line.startsWith(QLatin1String("chain "))) {
+            const QString chain = line.mid(6).section(' ', 0, 0);
+            anchor = chain.startsWith(placeholderPrefix) ? chain.mid(placeholderPrefix.size()) : QString();
+            if (!anchor.isEmpty()) {
+                anchors.append(anchor);
+            }
+        } else if (!anchor.isEmpty() && line == QStringLiteral("jump ") + anchorChain(anchor)) {
+            enabled.append(anchor);
+        }
+    }
+    return true;
+}
+
+bool LinuxNftables::updateSet(LinuxFirewall::IPVersion ip, const QString& set, const QStringList& elements)
+{
+    // Flushing and refilling in one script keeps the update atomic
+    QString script = QStringLiteral("flush set %1 %2 %3\n").arg(family(ip), kTableName, set);
+    if (!elements.isEmpty()) {
+        script += QStringLiteral("add element %1 %2 %3 { %4 }\n").arg(family(ip), kTableName, set, elements.join(", "));
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    const bool ok = apply(script) == 0;
+    logger.debug() << "Updated set" << set << "with" << elements.size() << "elements in" << timer.elapsed() << "ms";
+    return ok;
+}
+
+bool LinuxNftables::updateSetElements(LinuxFirewall::IPVersion ip, const QString& set, const QStringList& added, const QStringList& removed)
+{
+    QString script;
+    if (!removed.isEmpty()) {
+        script += QStringLiteral("delete element %1 %2 %3 { %4 }\n").arg(family(ip), kTableName, set, removed.join(", "));
+    }
+    if (!added.isEmpty()) {
+        script += QStringLiteral("add element %1 %2 %3 { %4 }\n").arg(family(ip), kTableName, set, added.join(", "));
+    }
+    if (script.isEmpty()) {
+        return true;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    // Deleting a range that auto-merge has folded into a larger interval is
+    // rejected; the caller falls back to a full refill in that case.
+    const bool ok = apply(script) == 0;
+    logger.debug() << "Updated set" << set << "+" << added.size() << "-" << removed.size() << "in" << timer.elapsed() << "ms";
+    return ok;
+}
+
+QStringList LinuxNftables::resolveHostNames(const QStringList& addrs)
+{
+    QStringList result;
+    for (const QString& addr : addrs) {
+        if (addr.isEmpty() || !QHostAddress(addr.section('/', 0, 0)).isNull()) {
+            result.append(addr);
+            continue;
+        }
+        const QHostInfo info = QHostInfo::fromName(addr);
+        if (info.error() != QHostInfo::NoError) {
+            logger.warning() << "Cannot resolve" << addr << ":" << info.errorString();
+            continue;
+        }
+        for (const QHostAddress& resolved : info.addresses()) {
+            result.append(resolved.toString());
+        }
+    }
+    return result;
+}
+
+QStringList LinuxNftables::setElements(LinuxFirewall::IPVersion ip, const QStringList& addrs)
+{
+    const QAbstractSocket::NetworkLayerProtocol protocol =
+        ip == LinuxFirewall::IPv6 ? QAbstractSocket::IPv6Protocol : QAbstractSocket::IPv4Protocol;
+
+    QStringList elements;
+    for (const QString& addr : addrs) {
+        if (addr.isEmpty()) {
+            continue;
+        }
+
+        const QPair<QHostAddress, int> subnet = QHostAddress::parseSubnet(addr.contains('/') ? addr : addr + QStringLiteral("/%1").arg(protocol == QAbstractSocket::IPv6Protocol ? 128 : 32));
+        if (subnet.first.protocol() == protocol) {
+            // Interval sets reject prefixes with host bits set, so normalize
+            // to the network address first.
+            QHostAddress network = subnet.first;
+            if (protocol == QAbstractSocket::IPv4Protocol) {
+                const quint32 mask = subnet.second ? (0xFFFFFFFFu << (32 - subnet.second)) : 0;
+                network = QHostAddress(subnet.first.toIPv4Address() & mask);
+            } else {
+                Q_IPV6ADDR bytes = subnet.first.toIPv6Address();
+                for (int i = 0; i < 16; ++i) {
+                    const int bits = qBound(0, subnet.second - i * 8, 8);
+                    bytes[i] &= static_cast<quint8>(0xFF << (8 - bits));
+                }
+                network = QHostAddress(bytes);
+            }
+            elements.append(QStringLiteral("%1/%2").arg(network.toString()).arg(subnet.second));
+            continue;
+        }
+        // Host names are resolved by resolveHostNames() beforehand
+        if (subnet.first.protocol() == QAbstractSocket::UnknownNetworkLayerProtocol) {
+            logger.warning() << "Not an address, left out of the set:" << addr;
+        }
+    }
+    elements.removeDuplicates();
+    return elements;
+}
+
+int LinuxNftables::apply(const QString& script)
+{
+    return run({QStringLiteral("-f"), QStringLiteral("-")}, script.toUtf8());
+}
+
+int LinuxNftables::run(const QStringList& args, const QByteArray& input, QByteArray* output)
+{
+    QProcess p;
+    p.start(QStringLiteral("nft"), args);
+    if (!input.isEmpty()) {
+        p.write(input);
+    }
+    p.closeWriteChannel();
+
+    int exitCode = -2;
+    if (p.waitForFinished() && p.error() != QProcess::FailedToStart) {
+        exitCode = p.exitStatus() == QProcess::NormalExit ? p.exitCode() : -1;
+    }
+
+    const QByteArray out = p.readAllStandardOutput();
+    const QByteArray err = p.readAllStandardError().trimmed();
+    if (output) {
+        *output = out;
+    }
+    if (exitCode != 0 && !err.isEmpty()) {
+        logger.warning() << "(" << exitCode << ") $ nft" << args.join(' ');
+        logger.warning() << err;
+    }
+    return exitCode;
+}
@@ -0,0 +1,44 @@
+#ifndef LINUXNFTABLES_H
+#define LINUXNFTABLES_H
+
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+
+#include "linuxfirewall.h"
+
+// nftables implementation of the LinuxFirewall anchor model.
+//
+// Every address family gets its own table holding the same root, placeholder
+// and anchor chains as the iptables backend. The allow/block/DNS address
+// lists are kept in interval sets instead of one rule per address, so packet
+// lookups stay logarithmic and list updates are a single atomic transaction.
+class LinuxNftables
+{
+public:
+    // Set names
+    static QString kAllowNetsSet, kBlockNetsSet, kDnsServersSet;
+
+    static bool isAvailable();
+
+    static void install();
+    static void uninstall();
+    static int enableAnchor(LinuxFirewall::IPVersion ip, const QString& anchor);
+    static int disableAnchor(LinuxFirewall::IPVersion ip, const QString& anchor);
+    // Lists installed and enabled anchors; returns false if our table is missing
+    static bool readState(LinuxFirewall::IPVersion ip, QStringList& anchors, QStringList& enabled);
+    static bool updateSet(LinuxFirewall::IPVersion ip, const QString& set, const QStringList& elements);
+    static bool updateSetElements(LinuxFirewall::IPVersion ip, const QString& set, const QStringList& added, const QStringList& removed);
+    // Replaces host names with the addresses they resolve to, like iptables
+    // does for "-d". Done once before the sets are diffed or updated.
+    static QStringList resolveHostNames(const QStringList& addrs);
+    // Normalizes addresses and CIDRs to set elements, anything else is dropped
+    static QStringList setElements(LinuxFirewall::IPVersion ip, const QStringList& addrs);
+
+private:
+    static QString ruleset(LinuxFirewall::IPVersion ip);
+    static int apply(const QString& script);
+    static int run(const QStringList& args, const QByteArray& input = QByteArray(), QByteArray* output = nullptr);
+};
+
+#endif // LINUXNFTABLES_H
@@ -6,6 +6,8 @@
 
 #include <QNetworkInterface>
 #include <QCoreApplication>
+#include <QDeadlineTimer>
+#include <QElapsedTimer>
 #include <QProcess>
 #include <QScopeGuard>
 #include <QTimer>
@@ -16,6 +18,7 @@
 #include <linux/netlink.h>
 #include <linux/rtnetlink.h>
 #include <net/if.h>
+#include <poll.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 
@@ -23,9 +26,18 @@
 #include "leakdetector.h"
 #include "logger.h"
 #include "core/networkUtilities.h"
+#include "linuxgatewaytracker.h"
 
 namespace {
 Logger logger("LinuxRouteMonitor");
+
+// Error value of a request the kernel has not answered yet
+constexpr int kAckPending = -1;
+constexpr int kAckTimeoutMsec = 2000;
+// Drain ACKs every so often while a batch is being sent, so that they do not
+// pile up in the socket buffer
+constexpr int kBatchDrainInterval = 64;
+constexpr int kRecvBufferSize = 1024 * 1024;
 }  // namespace
 
 
@@ -68,9 +80,23 @@ LinuxRouteMonitor::LinuxRouteMonitor(const QString& ifname, QObject* parent)
       logger.warning() << "Failed to bind netlink socket:" << strerror(errno);
   }
 
+  int rcvbuf = kRecvBufferSize;
+  if (setsockopt(m_nlsock, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)) < 0) {
+      setsockopt(m_nlsock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+  }
+#ifdef NETLINK_CAP_ACK
+  int one = 1;
+  setsockopt(m_nlsock, SOL_NETLINK, NETLINK_CAP_ACK, &one, sizeof(one));
+#endif
+
   m_notifier = new QSocketNotifier(m_nlsock, QSocketNotifier::Read, this);
   connect(m_notifier, &QSocketNotifier::activated, this,
           &LinuxRouteMonitor::nlsockReady);
+
+  // Link changes (new DHCP lease, switching uplinks) show up as default
+  // route changes, which is when our exclusions need to follow.
+  connect(LinuxGatewayTracker::instance(), &LinuxGatewayTracker::gatewayChanged,
+          this, &LinuxRouteMonitor::gatewayChanged);
 }
 
 LinuxRouteMonitor::~LinuxRouteMonitor() {
@@ -107,6 +133,9 @@ bool LinuxRouteMonitor::deleteRoute(const IPAddress& prefix) {
 bool LinuxRouteMonitor::addExclusionRoute(const IPAddress& prefix) {
     logger.debug() << "Adding exclusion route for"
                    << prefix.toString();
+    if (!m_exclusionRoutes.contains(prefix)) {
+        m_exclusionRoutes.append(prefix);
+    }
     const int flags = NLM_F_REQUEST | NLM_F_CREATE | NLM_F_REPLACE | NLM_F_ACK;
     return rtmSendRoute(RTM_NEWROUTE, flags, RTN_THROW, prefix);
 }
@@ -114,10 +143,62 @@ bool LinuxRouteMonitor::addExclusionRoute(const IPAddress& prefix) {
 bool LinuxRouteMonitor::deleteExclusionRoute(const IPAddress& prefix) {
     logger.debug() << "Removing exclusion route for"
                    << prefix.toString();
+    m_exclusionRoutes.removeAll(prefix);
     const int flags = NLM_F_REQUEST | NLM_F_ACK;
     return rtmSendRoute(RTM_DELROUTE, flags, RTN_THROW, prefix);
 }
 
+void LinuxRouteMonitor::gatewayChanged(QAbstractSocket::NetworkLayerProtocol family,
+                                       const QHostAddress& gateway) {
+    if (gateway.isNull()) {
+        // Nothing to point at until the network comes back
+        logger.debug() << "Default gateway lost, keeping exclusion routes";
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    // Replacing the routes re-points them at the new gateway in place
+    const int flags = NLM_F_REQUEST | NLM_F_CREATE | NLM_F_REPLACE | NLM_F_ACK;
+    int repaired = 0;
+    beginBatch();
+    for (const IPAddress& prefix : std::as_const(m_exclusionRoutes)) {
+        if (prefix.type() != family) {
+            continue;
+        }
+        if (rtmSendRoute(RTM_NEWROUTE, flags, RTN_THROW, prefix)) {
+            repaired++;
+        }
+    }
+    const bool ok = commitBatch();
+
+    if (repaired > 0) {
+        logger.info() << "Repaired" << repaired << "exclusion routes via"
+                      << gateway.toString() << "in" << timer.elapsed() << "ms"
+                      << (ok ? "" : "with errors");
+    }
+}
+
+void LinuxRouteMonitor::beginBatch() {
+    m_batching = true;
+}
+
+bool LinuxRouteMonitor::commitBatch(QStringList* failed) {
+    m_batching = false;
+    const QList<quint32> batch = std::exchange(m_batch, {});
+    if (batch.isEmpty()) {
+        return true;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    const int failures = waitForAcks(batch, failed);
+    logger.debug() << "Route batch of" << batch.size() << "requests done in"
+                   << timer.elapsed() << "ms," << failures << "failed";
+    return failures == 0;
+}
+
 bool LinuxRouteMonitor::rtmSendRoute(int action, int flags, int type,
                                        const IPAddress& prefix) {
     constexpr size_t rtm_max_size = sizeof(struct rtmsg) +
@@ -125,8 +206,8 @@ bool LinuxRouteMonitor::rtmSendRoute(int action, int flags, int type,
                                     RTA_SPACE(sizeof(struct in6_addr));
     wg_allowedip ip;
     if (!buildAllowedIp(&ip, prefix)) {
-    logger.warning() << "Invalid destination prefix";
-    return false;
+        logger.warning() << "Invalid destination prefix";
+        return false;
     }
 
     char buf[NLMSG_SPACE(rtm_max_size)];
@@ -138,7 +219,8 @@ bool LinuxRouteMonitor::rtmSendRoute(int action, int flags, int type,
     nlmsg->nlmsg_type = action;
     nlmsg->nlmsg_flags = flags;
     nlmsg->nlmsg_pid = getpid();
-    nlmsg->nlmsg_seq = m_nlseq++;
+    const quint32 seq = m_nlseq++;
+    nlmsg->nlmsg_seq = seq;
     rtm->rtm_dst_len = ip.cidr;
     rtm->rtm_family = ip.family;
     rtm->rtm_type = type;
@@ -147,37 +229,102 @@ bool LinuxRouteMonitor::rtmSendRoute(int action, int flags, int type,
     rtm->rtm_scope = RT_SCOPE_UNIVERSE;
 
     if (rtm->rtm_family == AF_INET6) {
-    nlmsg_append_attr(nlmsg, sizeof(buf), RTA_DST, &ip.ip6, sizeof(ip.ip6));
+        nlmsg_append_attr(nlmsg, sizeof(buf), RTA_DST, &ip.ip6, sizeof(ip.ip6));
     } else {
-    nlmsg_append_attr(nlmsg, sizeof(buf), RTA_DST, &ip.ip4, sizeof(ip.ip4));
+        nlmsg_append_attr(nlmsg, sizeof(buf), RTA_DST, &ip.ip4, sizeof(ip.ip4));
     }
 
     if (rtm->rtm_type == RTN_UNICAST) {
-    int index = if_nametoindex(WG_INTERFACE);
-
-    if (index <= 0) {
-        logger.error() << "if_nametoindex() failed:" << strerror(errno);
-        return false;
-    }
-    nlmsg_append_attr32(nlmsg, sizeof(buf), RTA_OIF, index);
-    nlmsg_append_attr32(nlmsg, sizeof(buf), RTA_PRIORITY, 1);
+        int index = if_nametoindex(WG_INTERFACE);
+
+        if (index <= 0) {
+            logger.error() << "if_nametoindex() failed:" << strerror(errno);
+            return false;
+        }
+        nlmsg_append_attr32(nlmsg, sizeof(buf), RTA_OIF, index);
+        nlmsg_append_attr32(nlmsg, sizeof(buf), RTA_PRIORITY, 1);
     }
 
     if (rtm->rtm_type == RTN_THROW) {
-    struct in_addr ip4;
-    inet_pton(AF_INET, NetworkUtilities::getGatewayAndIface().toUtf8(), &ip4);
-    nlmsg_append_attr(nlmsg, sizeof(buf), RTA_GATEWAY, &ip4, sizeof(ip4));
-    nlmsg_append_attr32(nlmsg, sizeof(buf), RTA_PRIORITY, 0);
-    rtm->rtm_type = RTN_UNICAST;
+        // Exclusions go via the current default gateway of the same family,
+        // served from memory by the gateway tracker.
+        const QHostAddress gateway = LinuxGatewayTracker::instance()->gateway(prefix.type());
+        if (gateway.isNull()) {
+            logger.warning() << "No default gateway for exclusion route" << prefix.toString();
+            return false;
+        }
+        if (rtm->rtm_family == AF_INET6) {
+            const Q_IPV6ADDR gw6 = gateway.toIPv6Address();
+            nlmsg_append_attr(nlmsg, sizeof(buf), RTA_GATEWAY, &gw6, sizeof(gw6));
+        } else {
+            const quint32 gw4 = htonl(gateway.toIPv4Address());
+            nlmsg_append_attr(nlmsg, sizeof(buf), RTA_GATEWAY, &gw4, sizeof(gw4));
+        }
+        nlmsg_append_attr32(nlmsg, sizeof(buf), RTA_PRIORITY, 0);
+        rtm->rtm_type = RTN_UNICAST;
     }
 
     struct sockaddr_nl nladdr;
     memset(&nladdr, 0, sizeof(nladdr));
     nladdr.nl_family = AF_NETLINK;
-    size_t result = sendto(m_nlsock, buf, nlmsg->nlmsg_len, 0,
-                           (struct sockaddr*)&nladdr, sizeof(nladdr));
+    ssize_t result = sendto(m_nlsock, buf, nlmsg->nlmsg_len, 0,
+                            (struct sockaddr*)&nladdr, sizeof(nladdr));
+    if (result != static_cast<ssize_t>(nlmsg->nlmsg_len)) {
+        logger.warning() << "Failed to send route request:" << strerror(errno);
+        return false;
+    }
+
+    m_inflight.insert(seq, {prefix.toString(), kAckPending});
+    if (!m_batching) {
+        return waitForAcks({seq}) == 0;
+    }
 
-    return (result == nlmsg->nlmsg_len);
+    m_batch.append(seq);
+    if (m_batch.size() % kBatchDrainInterval == 0) {
+        readAcks();
+    }
+    return true;
+}
+
+// Waits until every request in seqs is answered or the timeout expires,
+// then drops them from the in-flight table. Returns the number of requests
+// that failed or got no answer, their prefixes are appended to failed.
+int LinuxRouteMonitor::waitForAcks(const QList<quint32>& seqs, QStringList* failed) {
+    QDeadlineTimer deadline(kAckTimeoutMsec);
+    qsizetype next = 0;
+    while (next < seqs.size()) {
+        if (m_inflight.value(seqs.at(next)).error != kAckPending) {
+            next++;
+            continue;
+        }
+        struct pollfd pfd = {m_nlsock, POLLIN, 0};
+        const int ret = poll(&pfd, 1, deadline.remainingTime());
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            break;
+        }
+        readAcks();
+    }
+
+    int failures = 0;
+    for (quint32 seq : seqs) {
+        const PendingRequest request = m_inflight.take(seq);
+        if (request.error == kAckPending) {
+            logger.warning() << "No reply to route request for" << request.prefix;
+        } else if (request.error != 0) {
+            logger.debug() << "Route request for" << request.prefix
+                           << "failed:" << strerror(request.error);
+        } else {
+            continue;
+        }
+        failures++;
+        if (failed) {
+            failed->append(request.prefix);
+        }
+    }
+    return failures;
 }
 
 static void nlmsg_append_attr(struct nlmsghdr* nlmsg, size_t maxlen,
@@ -185,12 +332,12 @@ static void nlmsg_append_attr(struct nlmsghdr* nlmsg, size_t maxlen,
                               size_t attrlen) {
     size_t newlen = NLMSG_ALIGN(nlmsg->nlmsg_len) + RTA_SPACE(attrlen);
     if (newlen <= maxlen) {
-    char* buf = reinterpret_cast<char*>(nlmsg) + NLMSG_ALIGN(nlmsg->nlmsg_len);
-    struct rtattr* attr = reinterpret_cast<struct rtattr*>(buf);
-    attr->rta_type = attrtype;
-    attr->rta_len = RTA_LENGTH(attrlen);
-    memcpy(RTA_DATA(attr), attrdata, attrlen);
-    nlmsg->nlmsg_len = newlen;
+        char* buf = reinterpret_cast<char*>(nlmsg) + NLMSG_ALIGN(nlmsg->nlmsg_len);
+        struct rtattr* attr = reinterpret_cast<struct rtattr*>(buf);
+        attr->rta_type = attrtype;
+        attr->rta_len = RTA_LENGTH(attrlen);
+        memcpy(RTA_DATA(attr), attrdata, attrlen);
+        nlmsg->nlmsg_len = newlen;
     }
 }
 
@@ -200,26 +347,35 @@ static void nlmsg_append_attr32(struct nlmsghdr* nlmsg, size_t maxlen,
 }
 
 void LinuxRouteMonitor::nlsockReady() {
-    char buf[1024];
-    ssize_t len = recv(m_nlsock, buf, sizeof(buf), MSG_DONTWAIT);
-    if (len <= 0) {
-    return;
-    }
+    readAcks();
+}
 
-    struct nlmsghdr* nlmsg = (struct nlmsghdr*)buf;
-    while (NLMSG_OK(nlmsg, len)) {
-    if (nlmsg->nlmsg_type == NLMSG_DONE) {
-        return;
-    }
-    if (nlmsg->nlmsg_type != NLMSG_ERROR) {
-        nlmsg = NLMSG_NEXT(nlmsg, len);
-        continue;
-    }
-    struct nlmsgerr* err = static_cast<struct nlmsgerr*>(NLMSG_DATA(nlmsg));
-    if (err->error != 0) {
-        logger.debug() << "Netlink request failed:" << strerror(-err->error);
-    }
-    nlmsg = NLMSG_NEXT(nlmsg, len);
+// Reads everything queued on the socket and resolves the matching in-flight
+// requests. Lost ACKs (ENOBUFS) simply leave their requests pending.
+void LinuxRouteMonitor::readAcks() {
+    char buf[8192];
+    for (;;) {
+        ssize_t len = recv(m_nlsock, buf, sizeof(buf), MSG_DONTWAIT);
+        if (len <= 0) {
+            return;
+        }
+
+        int remaining = static_cast<int>(len);
+        for (struct nlmsghdr* nlmsg = (struct nlmsghdr*)buf;
+             NLMSG_OK(nlmsg, remaining); nlmsg = NLMSG_NEXT(nlmsg, remaining)) {
+            if (nlmsg->nlmsg_type != NLMSG_ERROR) {
+                continue;
+            }
+            struct nlmsgerr* err = static_cast<struct nlmsgerr*>(NLMSG_DATA(nlmsg));
+            auto it = m_inflight.find(nlmsg->nlmsg_seq);
+            if (it == m_inflight.end()) {
+                if (err->error != 0) {
+                    logger.debug() << "Netlink request failed:" << strerror(-err->error);
+                }
+                continue;
+            }
+            it->error = -err->error;
+        }
     }
 }
 
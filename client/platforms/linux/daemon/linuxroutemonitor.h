@@ -6,10 +6,12 @@
 #define LINUXROUTEMONITOR_H
 
 #include <QByteArray>
+#include <QHash>
 #include <QHostAddress>
 #include <QList>
 #include <QObject>
 #include <QSocketNotifier>
+#include <QStringList>
 
 #include "ipaddress.h"
 
@@ -26,19 +28,46 @@ class LinuxRouteMonitor final : public QObject {
 
   bool addExclusionRoute(const IPAddress& prefix);
   bool deleteExclusionRoute(const IPAddress& prefix);
+
+  // Route requests issued between beginBatch() and commitBatch() are sent
+  // without waiting for the kernel, so the calls above only report whether a
+  // request could be sent. commitBatch() then waits once for all of their
+  // ACKs, lists the prefixes of the requests that failed in failed and
+  // returns true only if every request succeeded.
+  void beginBatch();
+  bool commitBatch(QStringList* failed = nullptr);
+
  private:
+  struct PendingRequest {
+    QString prefix;
+    int error = 0;
+  };
+
   static QString addrToString(const struct sockaddr* sa);
   static QString addrToString(const QByteArray& data);
   bool rtmSendRoute(int action, int flags, int type,
                     const IPAddress& prefix);
+  int waitForAcks(const QList<quint32>& seqs, QStringList* failed = nullptr);
+  void readAcks();
+
+  // Exclusion routes we are expected to keep pointing at the default gateway
+  QList<IPAddress> m_exclusionRoutes;
   QString m_ifname;
   unsigned int m_ifindex = 0;
   int m_nlsock = -1;
-  int m_nlseq = 0;
+  quint32 m_nlseq = 0;
   QSocketNotifier* m_notifier = nullptr;
 
+  // Requests sent to the kernel, keyed by nlmsg_seq, until their ACK is
+  // collected by waitForAcks()
+  QHash<quint32, PendingRequest> m_inflight;
+  QList<quint32> m_batch;
+  bool m_batching = false;
+
  private slots:
     void nlsockReady();
+    void gatewayChanged(QAbstractSocket::NetworkLayerProtocol family,
+                        const QHostAddress& gateway);
 
 };
 
@@ -0,0 +1,295 @@
+#include "wireguarduapilinux.h"
+
+#include <errno.h>
+
+#include <QThread>
+
+#include "logger.h"
+
+namespace {
+Logger logger("WireguardUapiLinux");
+
+// How long a command may wait for its reply, reconnects included
+constexpr int WG_UAPI_COMMAND_TIMEOUT = 5000;
+constexpr int WG_UAPI_RECONNECT_INTERVAL = 100;
+constexpr int WG_UAPI_EXPIRE_INTERVAL = 500;
+};  // namespace
+
+WireguardUapiLinux::WireguardUapiLinux(QObject* parent)
+    : QObject(parent), m_socket(this) {
+    connect(&m_socket, &QLocalSocket::connected, this,
+            &WireguardUapiLinux::onConnected);
+    connect(&m_socket, &QLocalSocket::disconnected, this,
+            &WireguardUapiLinux::onDisconnected);
+    connect(&m_socket, &QLocalSocket::readyRead, this,
+            &WireguardUapiLinux::onReadyRead);
+    connect(&m_socket, &QLocalSocket::errorOccurred, this, [this]() {
+        // A connect that failed never emits disconnected()
+        if (m_socket.state() == QLocalSocket::UnconnectedState) {
+            logger.debug() << "UAPI socket error:" << m_socket.errorString();
+            onDisconnected();
+        }
+    });
+
+    m_reconnectTimer.setSingleShot(true);
+    m_reconnectTimer.setInterval(WG_UAPI_RECONNECT_INTERVAL);
+    connect(&m_reconnectTimer, &QTimer::timeout, this,
+            &WireguardUapiLinux::connectToSocket);
+
+    m_expireTimer.setInterval(WG_UAPI_EXPIRE_INTERVAL);
+    connect(&m_expireTimer, &QTimer::timeout, this,
+            &WireguardUapiLinux::expireCommands);
+}
+
+WireguardUapiLinux::~WireguardUapiLinux() { close(); }
+
+void WireguardUapiLinux::open(const QString& socketPath) {
+    if (socketPath != m_socketPath) {
+        close();
+        m_socketPath = socketPath;
+    }
+    connectToSocket();
+}
+
+void WireguardUapiLinux::close() {
+    m_socketPath.clear();
+    m_reconnectTimer.stop();
+    m_expireTimer.stop();
+
+    QList<Command> commands = m_inflight + m_pending;
+    m_inflight.clear();
+    m_pending.clear();
+    m_socket.abort();
+    m_buffer.clear();
+    m_scanned = 0;
+
+    for (Command& command : commands) {
+        fail(command);
+    }
+}
+
+void WireguardUapiLinux::send(const QString& command,
+                              const Callback& callback) {
+    enqueue(command, callback);
+}
+
+quint64 WireguardUapiLinux::enqueue(const QString& command,
+                                   const Callback& callback) {
+    Command entry;
+    entry.id = m_nextId++;
+    entry.message = command.toUtf8();
+    while (!entry.message.endsWith("\n\n")) {
+        entry.message.append('\n');
+    }
+    entry.callback = callback;
+    entry.age.start();
+    m_pending.enqueue(entry);
+
+    if (!m_expireTimer.isActive()) {
+        m_expireTimer.start();
+    }
+    if (m_socket.state() == QLocalSocket::ConnectedState) {
+        writePending();
+    } else {
+        connectToSocket();
+    }
+    return entry.id;
+}
+
+void WireguardUapiLinux::forget(quint64 id) {
+    for (Command& command : m_inflight) {
+        if (command.id == id) {
+            // The reply still has to be read past
+            command.callback = Callback();
+            return;
+        }
+    }
+    for (int i = 0; i < m_pending.size(); ++i) {
+        if (m_pending.at(i).id == id) {
+            m_pending.removeAt(i);
+            return;
+        }
+    }
+}
+
+QByteArray WireguardUapiLinux::request(const QString& command) {
+    bool answered = false;
+    QByteArray result;
+    const quint64 id = enqueue(command, [&answered, &result](const QByteArray& reply) {
+        answered = true;
+        result = reply;
+    });
+
+    // Only a connection that drops while the command is out is waited for,
+    // wireguard-go may be restarting. A socket that can't be reached at all
+    // fails the command right away.
+    bool connected = false;
+    QElapsedTimer timer;
+    timer.start();
+    while (!answered) {
+        const int remaining = WG_UAPI_COMMAND_TIMEOUT - static_cast<int>(timer.elapsed());
+        if (remaining <= 0) {
+            logger.error() << "UAPI command timed out";
+            forget(id);
+            return QByteArray();
+        }
+
+        // The socket emits its signals from these waits, so replies and
+        // reconnects are handled by the usual slots
+        switch (m_socket.state()) {
+            case QLocalSocket::ConnectedState:
+                connected = true;
+                if (m_socket.bytesToWrite() > 0) {
+                    m_socket.waitForBytesWritten(remaining);
+                }
+                m_socket.waitForReadyRead(qMin(remaining, WG_UAPI_EXPIRE_INTERVAL));
+                break;
+            case QLocalSocket::ConnectingState:
+                m_socket.waitForConnected(remaining);
+                break;
+            default:
+                if (!connected) {
+                    logger.error() << "UAPI socket is not available:"
+                                   << (m_socketPath.isEmpty()
+                                           ? QStringLiteral("no socket path")
+                                           : m_socket.errorString());
+                    forget(id);
+                    return QByteArray();
+                }
+                // wireguard-go may be restarting, try again shortly
+                m_reconnectTimer.stop();
+                connectToSocket();
+                if (m_socket.state() == QLocalSocket::UnconnectedState) {
+                    QThread::msleep(qMin(remaining, WG_UAPI_RECONNECT_INTERVAL));
+                }
+                break;
+        }
+    }
+    return result;
+}
+
+// static
+int WireguardUapiLinux::replyErrno(const QByteArray& reply) {
+    // errno is the last line of every reply
+    const int start = reply.lastIndexOf("errno=");
+    if (start < 0 || (start > 0 && reply.at(start - 1) != '\n')) {
+        return EINVAL;
+    }
+    const int end = reply.indexOf('\n', start);
+    bool ok = false;
+    const int err = reply.mid(start + 6, end < 0 ? -1 : end - start - 6).toInt(&ok);
+    return ok ? err : EINVAL;
+}
+
+void WireguardUapiLinux::connectToSocket() {
+    if (m_socketPath.isEmpty() ||
+        m_socket.state() != QLocalSocket::UnconnectedState) {
+        return;
+    }
+    m_socket.connectToServer(m_socketPath, QIODevice::ReadWrite);
+}
+
+void WireguardUapiLinux::onConnected() {
+    logger.debug() << "UAPI socket connected";
+    writePending();
+}
+
+void WireguardUapiLinux::onDisconnected() {
+    m_buffer.clear();
+    m_scanned = 0;
+
+    // Unanswered commands go out first once connected again, only once each
+    while (!m_inflight.isEmpty()) {
+        Command command = m_inflight.takeLast();
+        if (command.retried ||
+            command.age.hasExpired(WG_UAPI_COMMAND_TIMEOUT)) {
+            fail(command);
+            continue;
+        }
+        command.retried = true;
+        m_pending.prepend(command);
+    }
+
+    if (!m_pending.isEmpty() && !m_socketPath.isEmpty()) {
+        m_reconnectTimer.start();
+    }
+}
+
+void WireguardUapiLinux::onReadyRead() {
+    m_buffer.append(m_socket.readAll());
+
+    int consumed = 0;
+    for (;;) {
+        // A blank line may span the previous read and this one
+        const int from = qMax(consumed, m_scanned - 1);
+        const int end = m_buffer.indexOf("\n\n", from);
+        if (end < 0) {
+            m_scanned = m_buffer.size();
+            break;
+        }
+
+        QByteArray reply = m_buffer.mid(consumed, end - consumed);
+        if (reply.isNull()) {
+            reply = QByteArray("");
+        }
+        consumed = end + 2;
+        m_scanned = consumed;
+
+        if (m_inflight.isEmpty()) {
+            logger.warning() << "Unexpected UAPI reply";
+            continue;
+        }
+        Command command = m_inflight.dequeue();
+        if (command.callback) {
+            command.callback(reply);
+        }
+    }
+
+    // Replies are cut out of the buffer at once rather than one by one
+    m_buffer.remove(0, consumed);
+    m_scanned -= consumed;
+
+    if (m_pending.isEmpty() && m_inflight.isEmpty()) {
+        m_expireTimer.stop();
+    }
+}
+
+void WireguardUapiLinux::expireCommands() {
+    while (!m_pending.isEmpty() &&
+           m_pending.head().age.hasExpired(WG_UAPI_COMMAND_TIMEOUT)) {
+        Command command = m_pending.dequeue();
+        logger.error() << "UAPI command timed out before it was sent";
+        fail(command);
+    }
+
+    // wireguard-go answers in order, a late head means it is stuck
+    if (!m_inflight.isEmpty() &&
+        m_inflight.head().age.hasExpired(WG_UAPI_COMMAND_TIMEOUT)) {
+        logger.error() << "UAPI command timed out, reconnecting";
+        m_socket.abort();
+        onDisconnected();
+    }
+
+    if (m_pending.isEmpty() && m_inflight.isEmpty()) {
+        m_expireTimer.stop();
+    }
+}
+
+void WireguardUapiLinux::writePending() {
+    if (m_socket.state() != QLocalSocket::ConnectedState) {
+        return;
+    }
+    while (!m_pending.isEmpty()) {
+        Command command = m_pending.dequeue();
+        m_socket.write(command.message);
+        m_inflight.enqueue(command);
+    }
+}
+
+void WireguardUapiLinux::fail(Command& command) {
+    if (command.callback) {
+        Callback callback = command.callback;
+        command.callback = Callback();
+        callback(QByteArray());
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef WIREGUARDUAPILINUX_H
+#define WIREGUARDUAPILINUX_H
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QLocalSocket>
+#include <QObject>
+#include <QQueue>
+#include <QTimer>
+
+#include <functional>
+
+/**
+ * @brief The WireguardUapiLinux class - a long-lived connection to the wireguard-go UAPI socket
+ *
+ * Commands are queued and written back to back, wireguard-go answers them in
+ * order on the same connection. Replies are cut out of the receive buffer as
+ * soon as their terminating blank line arrives, without re-reading what was
+ * already scanned. When wireguard-go goes away the connection is opened
+ * again and the commands it didn't answer are sent once more.
+ */
+class WireguardUapiLinux final : public QObject {
+    Q_OBJECT
+
+public:
+    // Gets the reply without its terminating blank line, or a null
+    // QByteArray when the command failed or timed out
+    using Callback = std::function<void(const QByteArray& reply)>;
+
+    explicit WireguardUapiLinux(QObject* parent = nullptr);
+    ~WireguardUapiLinux();
+
+    void open(const QString& socketPath);
+    void close();
+
+    void send(const QString& command, const Callback& callback = Callback());
+
+    // Blocks until the reply of this command arrived, waiting on the socket
+    // rather than spinning the event loop
+    QByteArray request(const QString& command);
+
+    // The errno of a reply, EINVAL if it has none
+    static int replyErrno(const QByteArray& reply);
+
+private slots:
+    void onConnected();
+    void onDisconnected();
+    void onReadyRead();
+    void expireCommands();
+
+private:
+    struct Command {
+        quint64 id = 0;
+        QByteArray message;
+        Callback callback;
+        QElapsedTimer age;
+        bool retried = false;
+    };
+
+    quint64 enqueue(const QString& command, const Callback& callback);
+    // Drops the callback of a command that is given up on
+    void forget(quint64 id);
+    void connectToSocket();
+    void writePending();
+    void fail(Command& command);
+
+    QString m_socketPath;
+    QLocalSocket m_socket;
+    // Not written yet, and written but not answered yet
+    QQueue<Command> m_pending;
+    QQueue<Command> m_inflight;
+    QByteArray m_buffer;
+    // m_buffer before this offset holds no terminating blank line
+    int m_scanned = 0;
+    quint64 m_nextId = 1;
+    QTimer m_reconnectTimer;
+    QTimer m_expireTimer;
+};
+
+#endif  // WIREGUARDUAPILINUX_H
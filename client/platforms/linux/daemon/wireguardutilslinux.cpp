@@ -26,7 +26,7 @@ Logger logwireguard("WireguardGo");
 };  // namespace
 
 WireguardUtilsLinux::WireguardUtilsLinux(QObject* parent)
-    : WireguardUtils(parent), m_tunnel(this) {
+    : WireguardUtils(parent), m_tunnel(this), m_uapi(this) {
     MZ_COUNT_CTOR(WireguardUtilsLinux);
     logger.debug() << "WireguardUtilsLinux created.";
 
@@ -92,6 +92,7 @@ bool WireguardUtilsLinux::addInterface(const InterfaceConfig& config) {
         return false;
     }
     logger.debug() << "Created wireguard interface" << m_ifname;
+    m_uapi.open(wgRuntimeDir.filePath(m_ifname + ".sock"));
 
     // Start the routing table monitor.
     m_rtmonitor = new LinuxRouteMonitor(m_ifname, this);
@@ -132,7 +133,7 @@ bool WireguardUtilsLinux::addInterface(const InterfaceConfig& config) {
         out << "h4=" << config.m_transportPacketMagicHeader << "\n";
     }
 
-    int err = uapiErrno(uapiCommand(message));
+    int err = WireguardUapiLinux::replyErrno(uapiCommand(message));
     if (err != 0) {
         logger.error() << "Interface configuration failed:" << strerror(err);
     } else {
@@ -166,6 +167,9 @@ bool WireguardUtilsLinux::deleteInterface() {
         m_rtmonitor = nullptr;
     }
 
+    // Don't reconnect to the tunnel going away
+    m_uapi.close();
+
     if (m_tunnel.state() == QProcess::NotRunning) {
         return false;
     }
@@ -181,8 +185,9 @@ bool WireguardUtilsLinux::deleteInterface() {
     QDir wgRuntimeDir(WG_RUNTIME_DIR);
     QFile::remove(wgRuntimeDir.filePath(QString(WG_INTERFACE) + ".name"));
 
-    // double-check + ensure our firewall is installed and enabled
-    LinuxFirewall::uninstall();
+    // Close the kill switch gate but keep the filter chains staged for the
+    // next connection
+    LinuxFirewall::deactivateKillSwitch();
     return true;
 }
 
@@ -226,7 +231,7 @@ bool WireguardUtilsLinux::updatePeer(const InterfaceConfig& config) {
         m_rtmonitor->addExclusionRoute(IPAddress(config.m_serverIpv6AddrIn));
     }
 
-    int err = uapiErrno(uapiCommand(message));
+    int err = WireguardUapiLinux::replyErrno(uapiCommand(message));
     if (err != 0) {
         logger.error() << "Peer configuration failed:" << strerror(err);
     }
@@ -250,7 +255,7 @@ bool WireguardUtilsLinux::deletePeer(const InterfaceConfig& config) {
     out << "public_key=" << QString(publicKey.toHex()) << "\n";
     out << "remove=true\n";
 
-    int err = uapiErrno(uapiCommand(message));
+    int err = WireguardUapiLinux::replyErrno(uapiCommand(message));
     if (err != 0) {
         logger.error() << "Peer deletion failed:" << strerror(err);
     }
@@ -258,22 +263,22 @@ bool WireguardUtilsLinux::deletePeer(const InterfaceConfig& config) {
 }
 
 QList<WireguardUtils::PeerStatus> WireguardUtilsLinux::getPeerStatus() {
-    QString reply = uapiCommand("get=1");
+    QByteArray reply = uapiCommand("get=1");
     PeerStatus status;
     QList<PeerStatus> peerList;
-    for (const QString& line : reply.split('\n')) {
+    for (const QByteArray& line : reply.split('\n')) {
         int eq = line.indexOf('=');
         if (eq <= 0) {
             continue;
         }
-        QString name = line.left(eq);
-        QString value = line.mid(eq + 1);
+        QByteArray name = line.left(eq);
+        QByteArray value = line.mid(eq + 1);
 
         if (name == "public_key") {
             if (!status.m_pubkey.isEmpty()) {
                 peerList.append(status);
             }
-            QByteArray pubkey = QByteArray::fromHex(value.toUtf8());
+            QByteArray pubkey = QByteArray::fromHex(value);
             status = PeerStatus(pubkey.toBase64());
         }
 
@@ -300,7 +305,10 @@ QList<WireguardUtils::PeerStatus> WireguardUtilsLinux::getPeerStatus() {
 
 void WireguardUtilsLinux::applyFirewallRules(FirewallParams& params)
 {
-    // double-check + ensure our firewall is installed and enabled
+    // double-check + ensure our firewall is installed and enabled. The state is
+    // re-read once here since other software may have flushed our chains; the
+    // calls below then only touch anchors whose state differs.
+    LinuxFirewall::refreshState();
     if (!LinuxFirewall::isInstalled()) LinuxFirewall::install();
 
     // Note: rule precedence is handled inside IpTablesFirewall
@@ -320,6 +328,7 @@ void WireguardUtilsLinux::applyFirewallRules(FirewallParams& params)
     LinuxFirewall::updateDNSServers(params.dnsServers);
     LinuxFirewall::setAnchorEnabled(LinuxFirewall::IPv4, QStringLiteral("320.allowDNS"), true);
     LinuxFirewall::setAnchorEnabled(LinuxFirewall::Both, QStringLiteral("400.allowPIA"), true);
+    LinuxFirewall::setKillSwitchActive(true);
 }
 
 bool WireguardUtilsLinux::updateRoutePrefix(const IPAddress& prefix) {
@@ -377,54 +386,23 @@ bool WireguardUtilsLinux::deleteExclusionRoute(const IPAddress& prefix) {
     return m_rtmonitor->deleteExclusionRoute(prefix);
 }
 
-QString WireguardUtilsLinux::uapiCommand(const QString& command) {
-    QLocalSocket socket;
-    QTimer uapiTimeout;
-    QDir wgRuntimeDir(WG_RUNTIME_DIR);
-    QString wgSocketFile = wgRuntimeDir.filePath(m_ifname + ".sock");
-
-    uapiTimeout.setSingleShot(true);
-    uapiTimeout.start(WG_TUN_PROC_TIMEOUT);
-
-    socket.connectToServer(wgSocketFile, QIODevice::ReadWrite);
-    if (!socket.waitForConnected(WG_TUN_PROC_TIMEOUT)) {
-        logger.error() << "QLocalSocket::waitForConnected() failed:"
-                       << socket.errorString();
-        return QString();
-    }
-
-    // Send the message to the UAPI socket.
-    QByteArray message = command.toLocal8Bit();
-    while (!message.endsWith("\n\n")) {
-        message.append('\n');
+void WireguardUtilsLinux::beginRouteBatch() {
+    if (m_rtmonitor) {
+        m_rtmonitor->beginBatch();
     }
-    socket.write(message);
+}
 
-    QByteArray reply;
-    while (!reply.contains("\n\n")) {
-        if (!uapiTimeout.isActive()) {
-            logger.error() << "UAPI command timed out";
-            return QString();
-        }
-        QCoreApplication::processEvents(QEventLoop::AllEvents, 100);
-        reply.append(socket.readAll());
+bool WireguardUtilsLinux::commitRouteBatch(QStringList* failed) {
+    if (!m_rtmonitor) {
+        return false;
     }
-
-    return QString::fromUtf8(reply).trimmed();
+    return m_rtmonitor->commitBatch(failed);
 }
 
-// static
-int WireguardUtilsLinux::uapiErrno(const QString& reply) {
-    for (const QString& line : reply.split("\n")) {
-        int eq = line.indexOf('=');
-        if (eq <= 0) {
-            continue;
-        }
-        if (line.left(eq) == "errno") {
-            return line.mid(eq + 1).toInt();
-        }
-    }
-    return EINVAL;
+QByteArray WireguardUtilsLinux::uapiCommand(const QString& command) {
+    // Commands share one connection to wireguard-go instead of opening a
+    // socket each, the reply is waited for without re-entering the event loop
+    return m_uapi.request(command).trimmed();
 }
 
 QString WireguardUtilsLinux::waitForTunnelName(const QString& filename) {
@@ -12,6 +12,7 @@
 #include "daemon/wireguardutils.h"
 #include "linuxroutemonitor.h"
 #include "linuxfirewall.h"
+#include "wireguarduapilinux.h"
 
 
 class WireguardUtilsLinux final : public WireguardUtils {
@@ -37,6 +38,9 @@ public:
 
     bool addExclusionRoute(const IPAddress& prefix) override;
     bool deleteExclusionRoute(const IPAddress& prefix) override;
+
+    void beginRouteBatch() override;
+    bool commitRouteBatch(QStringList* failed = nullptr) override;
     void applyFirewallRules(FirewallParams& params);
 signals:
     void backendFailure();
@@ -46,12 +50,13 @@ private slots:
     void tunnelErrorOccurred(QProcess::ProcessError error);
 
 private:
-    QString uapiCommand(const QString& command);
-    static int uapiErrno(const QString& command);
+    QByteArray uapiCommand(const QString& command);
     QString waitForTunnelName(const QString& filename);
 
     QString m_ifname;
     QProcess m_tunnel;
+    // Kept open while the interface is up, see uapiCommand()
+    WireguardUapiLinux m_uapi;
     LinuxRouteMonitor* m_rtmonitor = nullptr;
 };
 
@@ -211,12 +211,27 @@ ErrorCode OpenVpnProtocol::start()
         return ErrorCode::AmneziaServiceConnectionFailed;
     }
 
-    m_openVpnProcess->waitForSource(5000);
-    if (!m_openVpnProcess->isInitialized()) {
-        qWarning() << "IpcProcess replica is not connected!";
-        setLastError(ErrorCode::AmneziaServiceConnectionFailed);
-        return ErrorCode::AmneziaServiceConnectionFailed;
-    }
+    // The process is started once its replica is up, errors after that are
+    // reported through the connection state
+    const QSharedPointer<PrivilegedProcess> process = m_openVpnProcess;
+    IpcClient::whenReady(process.data(), this, 5000, [this, process, mgmtPort](bool ready) {
+        if (m_openVpnProcess != process || connectionState() != Vpn::ConnectionState::Connecting) {
+            // Stopped or restarted in the meantime
+            return;
+        }
+        if (!ready) {
+            qWarning() << "IpcProcess replica is not connected!";
+            setLastError(ErrorCode::AmneziaServiceConnectionFailed);
+            return;
+        }
+        startOpenVpnProcess(mgmtPort);
+    });
+
+    return ErrorCode::NoError;
+}
+
+void OpenVpnProtocol::startOpenVpnProcess(uint mgmtPort)
+{
     m_openVpnProcess->setProgram(PermittedProcess::OpenVPN);
     QStringList arguments({
             "--config", configPath(), "--management", m_managementHost, QString::number(mgmtPort),
@@ -235,8 +250,6 @@ ErrorCode OpenVpnProtocol::start()
             [&]() { setConnectionState(Vpn::ConnectionState::Disconnected); });
 
     m_openVpnProcess->start();
-
-    return ErrorCode::NoError;
 }
 
 bool OpenVpnProtocol::sendTermSignal()
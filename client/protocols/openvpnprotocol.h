@@ -38,6 +38,7 @@ private:
     void sendByteCount();
     void sendInitialData();
     void sendManagementCommand(const QString& command);
+    void startOpenVpnProcess(uint mgmtPort);
 
     const QString m_managementHost = "127.0.0.1";
     const unsigned int m_managementPort = 57775;
@@ -8,6 +8,7 @@
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QNetworkInterface>
+#include <QRemoteObjectPendingCallWatcher>
 
 
 XrayProtocol::XrayProtocol(const QJsonObject &configuration, QObject *parent):
@@ -101,13 +102,27 @@ ErrorCode XrayProtocol::startTun2Sock()
         return ErrorCode::AmneziaServiceConnectionFailed;
     }
 
-    m_t2sProcess->waitForSource(1000);
-    if (!m_t2sProcess->isInitialized()) {
-        qWarning() << "IpcProcess replica is not connected!";
-        setLastError(ErrorCode::AmneziaServiceConnectionFailed);
-        return ErrorCode::AmneziaServiceConnectionFailed;
-    }
+    // tun2socks is started once its replica is up, errors after that are
+    // reported through the connection state
+    const QSharedPointer<PrivilegedProcess> process = m_t2sProcess;
+    IpcClient::whenReady(process.data(), this, 1000, [this, process](bool ready) {
+        if (m_t2sProcess != process || connectionState() != Vpn::ConnectionState::Connecting) {
+            // Stopped or restarted in the meantime
+            return;
+        }
+        if (!ready) {
+            qWarning() << "IpcProcess replica is not connected!";
+            setLastError(ErrorCode::AmneziaServiceConnectionFailed);
+            return;
+        }
+        startTun2SockProcess();
+    });
+
+    return ErrorCode::NoError;
+}
 
+void XrayProtocol::startTun2SockProcess()
+{
     QString XrayConStr = "socks5://127.0.0.1:" + QString::number(m_localPort);
 
     m_t2sProcess->setProgram(PermittedProcess::Tun2Socks);
@@ -141,7 +156,6 @@ ErrorCode XrayProtocol::startTun2Sock()
 #ifdef Q_OS_MACOS
             QThread::msleep(5000);
             IpcClient::Interface()->createTun("utun22", amnezia::protocols::xray::defaultLocalAddr);
-            IpcClient::Interface()->updateResolvers("utun22", dnsAddr);
 #endif
 #ifdef Q_OS_WINDOWS
             QThread::msleep(15000);
@@ -149,40 +163,73 @@ ErrorCode XrayProtocol::startTun2Sock()
 #ifdef Q_OS_LINUX
             QThread::msleep(1000);
             IpcClient::Interface()->createTun("tun2", amnezia::protocols::xray::defaultLocalAddr);
-            IpcClient::Interface()->updateResolvers("tun2", dnsAddr);
 #endif
+            const auto finishSetup = [this, dnsAddr]() {
+                IpcClient::Interface()->StopRoutingIpv6();
+#ifdef Q_OS_WIN
+                IpcClient::Interface()->updateResolvers("tun2", dnsAddr);
+                QList<QNetworkInterface> netInterfaces = QNetworkInterface::allInterfaces();
+                for (int i = 0; i < netInterfaces.size(); i++) {
+                    for (int j=0; j < netInterfaces.at(i).addressEntries().size(); j++)
+                    {
+                        // killSwitch toggle
+                        if (m_vpnLocalAddress == netInterfaces.at(i).addressEntries().at(j).ip().toString()) {
+                            if (QVariant(m_configData.value(config_key::killSwitchOption).toString()).toBool()) {
+                                IpcClient::Interface()->enableKillSwitch(QJsonObject(), netInterfaces.at(i).index());
+                            }
+                            m_configData.insert("vpnAdapterIndex", netInterfaces.at(i).index());
+                            m_configData.insert("vpnGateway", m_vpnGateway);
+                            m_configData.insert("vpnServer", m_remoteAddress);
+                            IpcClient::Interface()->enablePeerTraffic(m_configData);
+                        }
+                    }
+                }
+#else
+                Q_UNUSED(dnsAddr)
+#endif
+                setConnectionState(Vpn::ConnectionState::Connected);
+            };
+
 #if defined(Q_OS_LINUX) || defined(Q_OS_MACOS)
+            // Resolvers, kill switch and routes are set up by the service in one go
+            NetworkTransaction transaction;
+#ifdef Q_OS_MACOS
+            transaction.setResolversInterface("utun22");
+#else
+            transaction.setResolversInterface("tun2");
+#endif
+            transaction.setResolvers(dnsAddr);
             // killSwitch toggle
             if (QVariant(m_configData.value(config_key::killSwitchOption).toString()).toBool()) {
-                IpcClient::Interface()->enableKillSwitch(m_configData, 0);
+                transaction.setEnableKillSwitch(true);
+                transaction.setKillSwitchConfig(m_configData);
             }
-#endif
+            if (m_routeMode == 0) {
+                transaction.setVpnGateway(m_vpnGateway);
+                transaction.setVpnRoutes(QStringList() << "0.0.0.0/1" << "128.0.0.0/1");
+                transaction.setRouteGateway(m_routeGateway);
+                transaction.setRouteGatewayRoutes(QStringList() << m_remoteAddress);
+            }
+            // The rest of the setup continues once the service has answered
+            auto *watcher = new QRemoteObjectPendingCallWatcher(IpcClient::Interface()->applyNetworkState(transaction), this);
+            connect(watcher, &QRemoteObjectPendingCallWatcher::finished, this,
+                    [this, finishSetup](QRemoteObjectPendingCallWatcher *call) {
+                call->deleteLater();
+                if (call->error() != QRemoteObjectPendingCall::NoError || !call->returnValue().toBool()) {
+                    qWarning() << "XrayProtocol: the service failed to apply the network state";
+                    setLastError(ErrorCode::NetworkSetupError);
+                    return;
+                }
+                finishSetup();
+            });
+#else
             if (m_routeMode == 0) {
                 IpcClient::Interface()->routeAddList(m_vpnGateway, QStringList() << "0.0.0.0/1");
                 IpcClient::Interface()->routeAddList(m_vpnGateway, QStringList() << "128.0.0.0/1");
                 IpcClient::Interface()->routeAddList(m_routeGateway, QStringList() << m_remoteAddress);
             }
-            IpcClient::Interface()->StopRoutingIpv6();
-#ifdef Q_OS_WIN
-            IpcClient::Interface()->updateResolvers("tun2", dnsAddr);
-            QList<QNetworkInterface> netInterfaces = QNetworkInterface::allInterfaces();
-            for (int i = 0; i < netInterfaces.size(); i++) {
-                for (int j=0; j < netInterfaces.at(i).addressEntries().size(); j++)
-                {
-                    // killSwitch toggle
-                    if (m_vpnLocalAddress == netInterfaces.at(i).addressEntries().at(j).ip().toString()) {
-                        if (QVariant(m_configData.value(config_key::killSwitchOption).toString()).toBool()) {
-                            IpcClient::Interface()->enableKillSwitch(QJsonObject(), netInterfaces.at(i).index());
-                        }
-                        m_configData.insert("vpnAdapterIndex", netInterfaces.at(i).index());
-                        m_configData.insert("vpnGateway", m_vpnGateway);
-                        m_configData.insert("vpnServer", m_remoteAddress);
-                        IpcClient::Interface()->enablePeerTraffic(m_configData);
-                    }
-                }
-            }
+            finishSetup();
 #endif
-            setConnectionState(Vpn::ConnectionState::Connected);
         }
     });
 
@@ -198,9 +245,6 @@ ErrorCode XrayProtocol::startTun2Sock()
 #endif
 
     m_t2sProcess->start();
-
-
-    return ErrorCode::NoError;
 }
 
 void XrayProtocol::stop()
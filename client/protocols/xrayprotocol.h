@@ -24,6 +24,7 @@ protected:
 private:
     static QString xrayExecPath();
     static QString tun2SocksExecPath();
+    void startTun2SockProcess();
 private:
     int m_localPort;
     QString m_remoteAddress;
@@ -2,6 +2,7 @@
 
 #include "QThread"
 #include "QCoreApplication"
+#include "QStandardPaths"
 
 #include "core/networkUtilities.h"
 #include "version.h"
@@ -268,61 +269,100 @@ void Settings::setSitesSplitTunnelingEnabled(bool enabled)
     setValue("Conf/sitesSplitTunnelingEnabled", enabled);
 }
 
+bool Settings::isSitesDnsInterceptionEnabled() const
+{
+    return value("Conf/sitesDnsInterceptionEnabled", false).toBool();
+}
+
+void Settings::setSitesDnsInterceptionEnabled(bool enabled)
+{
+    setValue("Conf/sitesDnsInterceptionEnabled", enabled);
+}
+
+SitesStore *Settings::sitesStore(RouteMode mode) const
+{
+    QSharedPointer<SitesStore> store = m_sitesStores.value(mode);
+    if (!store) {
+        const QString path = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/sites/";
+        store.reset(new SitesStore(path + routeModeString(mode) + ".log"));
+        m_sitesStores.insert(mode, store);
+        migrateVpnSites(mode, store.data());
+    }
+    return store.data();
+}
+
+// Sites used to be stored as one QVariantMap per mode in the settings. Moves
+// such a map into the store, this also picks up maps from restored backups.
+void Settings::migrateVpnSites(RouteMode mode, SitesStore *store) const
+{
+    const QString key = "Conf/" + routeModeString(mode);
+    const QVariant sites = m_settings.value(key);
+    if (!sites.isValid()) {
+        return;
+    }
+
+    store->replace(sites.toMap());
+    m_settings.remove(key);
+}
+
+QVariantMap Settings::vpnSites(RouteMode mode) const
+{
+    return sitesStore(mode)->toVariantMap();
+}
+
+void Settings::setVpnSites(RouteMode mode, const QVariantMap &sites)
+{
+    sitesStore(mode)->replace(sites);
+}
+
 bool Settings::addVpnSite(RouteMode mode, const QString &site, const QString &ip)
 {
-    QVariantMap sites = vpnSites(mode);
-    if (sites.contains(site) && ip.isEmpty())
+    SitesStore *store = sitesStore(mode);
+    if (store->contains(site) && ip.isEmpty())
         return false;
 
-    sites.insert(site, ip);
-    setVpnSites(mode, sites);
+    store->insert(site, ip);
     return true;
 }
 
 void Settings::addVpnSites(RouteMode mode, const QMap<QString, QString> &sites)
 {
-    QVariantMap allSites = vpnSites(mode);
-    for (auto i = sites.constBegin(); i != sites.constEnd(); ++i) {
-        const QString &site = i.key();
-        const QString &ip = i.value();
-
-        if (allSites.contains(site) && allSites.value(site) == ip)
-            continue;
-
-        allSites.insert(site, ip);
-    }
-
-    setVpnSites(mode, allSites);
+    sitesStore(mode)->insert(sites);
 }
 
 QStringList Settings::getVpnIps(RouteMode mode) const
 {
     QStringList ips;
-    const QVariantMap &m = vpnSites(mode);
+    const QHash<QString, QString> &m = sitesStore(mode)->sites();
     for (auto i = m.constBegin(); i != m.constEnd(); ++i) {
         if (NetworkUtilities::checkIpSubnetFormat(i.key())) {
             ips.append(i.key());
-        } else if (NetworkUtilities::checkIpSubnetFormat(i.value().toString())) {
-            ips.append(i.value().toString());
+        } else if (NetworkUtilities::checkIpSubnetFormat(i.value())) {
+            ips.append(i.value());
         }
     }
     ips.removeDuplicates();
     return ips;
 }
 
-void Settings::removeVpnSite(RouteMode mode, const QString &site)
+QStringList Settings::geoIpSelectors(RouteMode mode) const
 {
-    QVariantMap sites = vpnSites(mode);
-    if (!sites.contains(site))
-        return;
+    return value("Conf/geoIp/" + routeModeString(mode)).toStringList();
+}
 
-    sites.remove(site);
-    setVpnSites(mode, sites);
+void Settings::setGeoIpSelectors(RouteMode mode, const QStringList &selectors)
+{
+    setValue("Conf/geoIp/" + routeModeString(mode), selectors);
+}
+
+void Settings::removeVpnSite(RouteMode mode, const QString &site)
+{
+    sitesStore(mode)->remove(site);
 }
 
 void Settings::addVpnIps(RouteMode mode, const QStringList &ips)
 {
-    QVariantMap sites = vpnSites(mode);
+    QMap<QString, QString> sites;
     for (const QString &ip : ips) {
         if (ip.isEmpty())
             continue;
@@ -330,25 +370,44 @@ void Settings::addVpnIps(RouteMode mode, const QStringList &ips)
         sites.insert(ip, "");
     }
 
-    setVpnSites(mode, sites);
+    sitesStore(mode)->insert(sites);
 }
 
 void Settings::removeVpnSites(RouteMode mode, const QStringList &sites)
 {
-    QVariantMap sitesMap = vpnSites(mode);
-    for (const QString &site : sites) {
-        if (site.isEmpty())
-            continue;
+    sitesStore(mode)->remove(sites);
+}
 
-        sitesMap.remove(site);
+void Settings::removeAllVpnSites(RouteMode mode)
+{
+    sitesStore(mode)->clear();
+}
+
+QByteArray Settings::backupAppConfig() const
+{
+    QJsonObject cfg = QJsonDocument::fromJson(m_settings.backupAppConfig()).object();
+
+    // Sites live outside of the settings, store them under their old keys
+    for (RouteMode mode : { VpnAllSites, VpnOnlyForwardSites, VpnAllExceptSites }) {
+        const QVariantMap sites = vpnSites(mode);
+        if (!sites.isEmpty()) {
+            cfg.insert("Conf/" + routeModeString(mode), QJsonObject::fromVariantMap(sites));
+        }
     }
 
-    setVpnSites(mode, sitesMap);
+    return QJsonDocument(cfg).toJson();
 }
 
-void Settings::removeAllVpnSites(RouteMode mode)
+bool Settings::restoreAppConfig(const QByteArray &cfg)
 {
-    setVpnSites(mode, QVariantMap());
+    if (!m_settings.restoreAppConfig(cfg)) {
+        return false;
+    }
+
+    for (RouteMode mode : { VpnAllSites, VpnOnlyForwardSites, VpnAllExceptSites }) {
+        migrateVpnSites(mode, sitesStore(mode));
+    }
+    return true;
 }
 
 QString Settings::primaryDns() const
@@ -365,6 +424,9 @@ void Settings::clearSettings()
 {
     auto uuid = getInstallationUuid(false);
     m_settings.clearSettings();
+    for (RouteMode mode : { VpnAllSites, VpnOnlyForwardSites, VpnAllExceptSites }) {
+        sitesStore(mode)->clear();
+    }
     setInstallationUuid(uuid);
     emit settingsCleared();
 }
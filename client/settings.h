@@ -1,8 +1,10 @@
 #ifndef SETTINGS_H
 #define SETTINGS_H
 
+#include <QMap>
 #include <QObject>
 #include <QSettings>
+#include <QSharedPointer>
 #include <QString>
 
 #include <QJsonArray>
@@ -11,6 +13,7 @@
 
 #include "containers/containers_defs.h"
 #include "core/defs.h"
+#include "core/sitesStore.h"
 #include "secure_qsettings.h"
 
 using namespace amnezia;
@@ -117,19 +120,19 @@ public:
 
     bool isSitesSplitTunnelingEnabled() const;
     void setSitesSplitTunnelingEnabled(bool enabled);
+    // Route sites as they are resolved instead of resolving them all on connect
+    bool isSitesDnsInterceptionEnabled() const;
+    void setSitesDnsInterceptionEnabled(bool enabled);
 
-    QVariantMap vpnSites(RouteMode mode) const
-    {
-        return value("Conf/" + routeModeString(mode)).toMap();
-    }
-    void setVpnSites(RouteMode mode, const QVariantMap &sites)
-    {
-        setValue("Conf/" + routeModeString(mode), sites);
-        m_settings.sync();
-    }
+    QVariantMap vpnSites(RouteMode mode) const;
+    void setVpnSites(RouteMode mode, const QVariantMap &sites);
     bool addVpnSite(RouteMode mode, const QString &site, const QString &ip = "");
     void addVpnSites(RouteMode mode, const QMap<QString, QString> &sites); // map <site, ip>
     QStringList getVpnIps(RouteMode mode) const;
+
+    // Countries and ASNs (see GeoIpDatabase) whose ranges count as sites of the mode
+    QStringList geoIpSelectors(RouteMode mode) const;
+    void setGeoIpSelectors(RouteMode mode, const QStringList &selectors);
     void removeVpnSite(RouteMode mode, const QString &site);
 
     void addVpnIps(RouteMode mode, const QStringList &ip);
@@ -166,14 +169,8 @@ public:
     //    static constexpr char openNicNs5[] = "94.103.153.176";
     //    static constexpr char openNicNs13[] = "144.76.103.143";
 
-    QByteArray backupAppConfig() const
-    {
-        return m_settings.backupAppConfig();
-    }
-    bool restoreAppConfig(const QByteArray &cfg)
-    {
-        return m_settings.restoreAppConfig(cfg);
-    }
+    QByteArray backupAppConfig() const;
+    bool restoreAppConfig(const QByteArray &cfg);
 
     QLocale getAppLanguage()
     {
@@ -230,7 +227,11 @@ private:
 
     void setInstallationUuid(const QString &uuid);
 
+    SitesStore *sitesStore(RouteMode mode) const;
+    void migrateVpnSites(RouteMode mode, SitesStore *store) const;
+
     mutable SecureQSettings m_settings;
+    mutable QMap<RouteMode, QSharedPointer<SitesStore>> m_sitesStores;
 };
 
 #endif // SETTINGS_H
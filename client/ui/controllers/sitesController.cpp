@@ -6,6 +6,8 @@
 
 #include "systemController.h"
 #include "core/networkUtilities.h"
+#include "core/geoIpDatabase.h"
+#include "core/sitesImporter.h"
 
 SitesController::SitesController(const std::shared_ptr<Settings> &settings,
                                  const QSharedPointer<VpnConnection> &vpnConnection,
@@ -14,6 +16,15 @@ SitesController::SitesController(const std::shared_ptr<Settings> &settings,
 {
 }
 
+SitesController::~SitesController()
+{
+    if (m_importThread) {
+        m_importThread->requestInterruption();
+        m_importThread->quit();
+        m_importThread->wait();
+    }
+}
+
 void SitesController::addSite(QString hostname)
 {
     if (hostname.isEmpty()) {
@@ -80,55 +91,85 @@ void SitesController::removeSite(int index)
     emit finished(tr("Site removed: %1").arg(hostname));
 }
 
-void SitesController::importSites(const QString &fileName, bool replaceExisting)
+QStringList SitesController::geoIpSelectors() const
 {
-    QFile file(fileName);
+    return m_settings->geoIpSelectors(m_settings->routeMode());
+}
 
-    if (!file.open(QIODevice::ReadOnly)) {
-        emit errorOccurred(tr("Can't open file: %1").arg(fileName));
+void SitesController::setGeoIpSelectors(const QStringList &selectors)
+{
+    const GeoIpDatabase database;
+    if (!database.isValid() && !selectors.isEmpty()) {
+        emit errorOccurred(tr("The country and ASN database is not available"));
         return;
     }
 
-    QByteArray jsonData = file.readAll();
-    QJsonDocument jsonDocument = QJsonDocument::fromJson(jsonData);
-    if (jsonDocument.isNull()) {
-        emit errorOccurred(tr("Failed to parse JSON data from file: %1").arg(fileName));
-        return;
+    const QStringList known = database.selectors();
+    QStringList accepted;
+    QStringList unknown;
+    for (const QString &selector : selectors) {
+        const QString name = selector.trimmed().toUpper();
+        if (name.isEmpty() || accepted.contains(name)) {
+            continue;
+        }
+        (known.contains(name) ? accepted : unknown).append(name);
     }
 
-    if (!jsonDocument.isArray()) {
-        emit errorOccurred(tr("The JSON data is not an array in file: %1").arg(fileName));
+    m_settings->setGeoIpSelectors(m_settings->routeMode(), accepted);
+    if (!unknown.isEmpty()) {
+        emit errorOccurred(tr("Unknown countries or ASNs: %1").arg(unknown.join(", ")));
         return;
     }
+    emit finished(tr("Countries and ASNs saved, they apply on the next connection"));
+}
 
-    auto jsonArray = jsonDocument.array();
-    QMap<QString, QString> sites;
-    QStringList ips;
-
-    for (auto jsonValue : jsonArray) {
-        auto jsonObject = jsonValue.toObject();
-        auto hostname = jsonObject.value("hostname").toString("");
-        auto ip = jsonObject.value("ip").toString("");
-
-        if (!hostname.contains(".") && !NetworkUtilities::ipAddressWithSubnetRegExp().exactMatch(hostname)) {
-            qDebug() << hostname << " not look like ip adress or domain name";
-            continue;
-        }
+void SitesController::importSites(const QString &fileName, bool replaceExisting)
+{
+    if (m_importThread) {
+        emit errorOccurred(tr("Another import is still in progress"));
+        return;
+    }
 
-        if (ip.isEmpty()) {
-            ips.append(hostname);
-        } else {
-            ips.append(ip);
-        }
-        sites.insert(hostname, ip);
+    if (replaceExisting) {
+        m_sitesModel->addSites({}, true);
     }
 
-    m_sitesModel->addSites(sites, replaceExisting);
+    // Parsing runs on its own thread, sites come back in batches and are
+    // committed here, where the settings live
+    auto importer = new SitesImporter(fileName);
+    m_importThread = new QThread(this);
+    importer->moveToThread(m_importThread);
+
+    connect(m_importThread, &QThread::started, importer, &SitesImporter::run);
+    connect(importer, &SitesImporter::batchReady, this, &SitesController::onImportBatch);
+    connect(importer, &SitesImporter::progressChanged, this, &SitesController::importProgressChanged);
+    connect(importer, &SitesImporter::finished, this, &SitesController::onImportFinished);
+    connect(importer, &SitesImporter::finished, m_importThread, &QThread::quit);
+    connect(m_importThread, &QThread::finished, importer, &QObject::deleteLater);
+    connect(m_importThread, &QThread::finished, m_importThread, &QObject::deleteLater);
+
+    m_importThread->start();
+}
 
+void SitesController::onImportBatch(const QMap<QString, QString> &sites, const QStringList &ips)
+{
+    m_sitesModel->storeSites(sites);
     QMetaObject::invokeMethod(m_vpnConnection.get(), "addRoutes", Qt::QueuedConnection, Q_ARG(QStringList, ips));
-    QMetaObject::invokeMethod(m_vpnConnection.get(), "flushDns", Qt::QueuedConnection);
+}
 
-    emit finished(tr("Import completed"));
+void SitesController::onImportFinished(int imported, int skipped, const QString &errorMessage)
+{
+    m_sitesModel->reload();
+    if (imported > 0) {
+        QMetaObject::invokeMethod(m_vpnConnection.get(), "flushDns", Qt::QueuedConnection);
+    }
+
+    if (!errorMessage.isEmpty()) {
+        emit errorOccurred(errorMessage);
+    } else {
+        emit finished(tr("Import completed: %1 sites added, %2 skipped").arg(imported).arg(skipped));
+    }
+    emit importFinished();
 }
 
 void SitesController::exportSites(const QString &fileName)
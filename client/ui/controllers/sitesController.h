@@ -2,6 +2,8 @@
 #define SITESCONTROLLER_H
 
 #include <QObject>
+#include <QPointer>
+#include <QThread>
 
 #include "settings.h"
 #include "ui/models/sites_model.h"
@@ -14,6 +16,7 @@ public:
     explicit SitesController(const std::shared_ptr<Settings> &settings,
                              const QSharedPointer<VpnConnection> &vpnConnection,
                              const QSharedPointer<SitesModel> &sitesModel, QObject *parent = nullptr);
+    ~SitesController();
 
 public slots:
     void addSite(QString hostname);
@@ -22,17 +25,29 @@ public slots:
     void importSites(const QString &fileName, bool replaceExisting);
     void exportSites(const QString &fileName);
 
+    QStringList geoIpSelectors() const;
+    void setGeoIpSelectors(const QStringList &selectors);
+
 signals:
     void errorOccurred(const QString &errorMessage);
     void finished(const QString &message);
 
     void saveFile(const QString &fileName, const QString &data);
 
+    void importProgressChanged(int percent);
+    void importFinished();
+
+private slots:
+    void onImportBatch(const QMap<QString, QString> &sites, const QStringList &ips);
+    void onImportFinished(int imported, int skipped, const QString &errorMessage);
+
 private:
     std::shared_ptr<Settings> m_settings;
 
     QSharedPointer<VpnConnection> m_vpnConnection;
     QSharedPointer<SitesModel> m_sitesModel;
+
+    QPointer<QThread> m_importThread;
 };
 
 #endif // SITESCONTROLLER_H
@@ -0,0 +1,269 @@
+#include "sitesFilterModel.h"
+
+#include <QtConcurrent>
+
+#include <algorithm>
+
+#include "sites_model.h"
+
+namespace {
+// How often a search checks whether it was superseded
+constexpr int kCancelCheckInterval = 4096;
+
+bool matches(const QString &url, const QString &ip, const QString &text)
+{
+    return url.contains(text, Qt::CaseInsensitive) || ip.contains(text, Qt::CaseInsensitive);
+}
+}
+
+SitesFilterModel::SitesFilterModel(SitesModel *sitesModel, QObject *parent)
+    : QAbstractProxyModel(parent), m_sitesModel(sitesModel)
+{
+    setSourceModel(sitesModel);
+
+    connect(sitesModel, &QAbstractItemModel::rowsAboutToBeInserted, this, &SitesFilterModel::onSourceRowsAboutToBeInserted);
+    connect(sitesModel, &QAbstractItemModel::rowsInserted, this, &SitesFilterModel::onSourceRowsInserted);
+    connect(sitesModel, &QAbstractItemModel::rowsAboutToBeRemoved, this, &SitesFilterModel::onSourceRowsAboutToBeRemoved);
+    connect(sitesModel, &QAbstractItemModel::rowsRemoved, this, &SitesFilterModel::onSourceRowsRemoved);
+    connect(sitesModel, &QAbstractItemModel::dataChanged, this, &SitesFilterModel::onSourceDataChanged);
+    connect(sitesModel, &QAbstractItemModel::modelAboutToBeReset, this, &SitesFilterModel::onSourceAboutToBeReset);
+    connect(sitesModel, &QAbstractItemModel::modelReset, this, &SitesFilterModel::onSourceReset);
+
+    connect(&m_watcher, &QFutureWatcher<QVector<int>>::finished, this, &SitesFilterModel::onFilterFinished);
+}
+
+QModelIndex SitesFilterModel::index(int row, int column, const QModelIndex &parent) const
+{
+    return hasIndex(row, column, parent) ? createIndex(row, column) : QModelIndex();
+}
+
+QModelIndex SitesFilterModel::parent(const QModelIndex &child) const
+{
+    Q_UNUSED(child)
+    return QModelIndex();
+}
+
+int SitesFilterModel::rowCount(const QModelIndex &parent) const
+{
+    if (parent.isValid()) {
+        return 0;
+    }
+    return passThrough() ? m_sitesModel->rowCount() : m_rows.size();
+}
+
+int SitesFilterModel::columnCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : 1;
+}
+
+QModelIndex SitesFilterModel::mapToSource(const QModelIndex &proxyIndex) const
+{
+    if (!proxyIndex.isValid()) {
+        return QModelIndex();
+    }
+    return m_sitesModel->index(sourceRow(proxyIndex.row()), 0);
+}
+
+QModelIndex SitesFilterModel::mapFromSource(const QModelIndex &sourceIndex) const
+{
+    if (!sourceIndex.isValid()) {
+        return QModelIndex();
+    }
+    if (passThrough()) {
+        return index(sourceIndex.row(), 0);
+    }
+    const auto it = std::lower_bound(m_rows.cbegin(), m_rows.cend(), sourceIndex.row());
+    if (it == m_rows.cend() || *it != sourceIndex.row()) {
+        return QModelIndex();
+    }
+    return index(it - m_rows.cbegin(), 0);
+}
+
+int SitesFilterModel::sourceRow(int proxyRow) const
+{
+    return passThrough() ? proxyRow : m_rows.value(proxyRow, -1);
+}
+
+void SitesFilterModel::setFilterText(const QString &filterText)
+{
+    if (m_filterText == filterText) {
+        return;
+    }
+    m_filterText = filterText;
+    emit filterTextChanged();
+    refilter();
+}
+
+void SitesFilterModel::refilter()
+{
+    m_watcher.cancel();
+
+    if (m_filterText.isEmpty()) {
+        m_watcher.setFuture(QFuture<QVector<int>>());
+        if (!m_appliedText.isEmpty()) {
+            beginResetModel();
+            m_appliedText.clear();
+            m_rows.clear();
+            endResetModel();
+        }
+        emit isFilteringChanged();
+        return;
+    }
+
+    const QVector<QPair<QString, QString>> sites = m_sitesModel->getCurrentSites();
+    const QString text = m_filterText;
+    m_searchGeneration = m_generation;
+    m_watcher.setFuture(QtConcurrent::run([sites, text](QPromise<QVector<int>> &promise) {
+        QVector<int> rows;
+        for (int i = 0; i < sites.size(); ++i) {
+            if (i % kCancelCheckInterval == 0 && promise.isCanceled()) {
+                return;
+            }
+            if (matches(sites.at(i).first, sites.at(i).second, text)) {
+                rows.append(i);
+            }
+        }
+        promise.addResult(rows);
+    }));
+    emit isFilteringChanged();
+}
+
+void SitesFilterModel::onFilterFinished()
+{
+    emit isFilteringChanged();
+
+    const QFuture<QVector<int>> future = m_watcher.future();
+    if (future.isCanceled() || future.resultCount() == 0) {
+        return;
+    }
+    // The sites changed while searching, the rows may point anywhere
+    if (m_searchGeneration != m_generation) {
+        refilter();
+        return;
+    }
+
+    beginResetModel();
+    m_rows = future.result();
+    m_appliedText = m_filterText;
+    endResetModel();
+}
+
+bool SitesFilterModel::accepts(int sourceRow) const
+{
+    const QModelIndex index = m_sitesModel->index(sourceRow, 0);
+    return matches(index.data(SitesModel::UrlRole).toString(), index.data(SitesModel::IpRole).toString(), m_appliedText);
+}
+
+void SitesFilterModel::onSourceRowsAboutToBeInserted(const QModelIndex &parent, int first, int last)
+{
+    Q_UNUSED(parent)
+    ++m_generation;
+    if (passThrough()) {
+        beginInsertRows(QModelIndex(), first, last);
+    }
+}
+
+void SitesFilterModel::onSourceRowsInserted(const QModelIndex &parent, int first, int last)
+{
+    Q_UNUSED(parent)
+    if (passThrough()) {
+        endInsertRows();
+        return;
+    }
+
+    const int count = last - first + 1;
+    const int position = std::lower_bound(m_rows.cbegin(), m_rows.cend(), first) - m_rows.cbegin();
+    for (int i = position; i < m_rows.size(); ++i) {
+        m_rows[i] += count;
+    }
+
+    QVector<int> accepted;
+    for (int row = first; row <= last; ++row) {
+        if (accepts(row)) {
+            accepted.append(row);
+        }
+    }
+    if (accepted.isEmpty()) {
+        return;
+    }
+    beginInsertRows(QModelIndex(), position, position + accepted.size() - 1);
+    m_rows.insert(position, accepted.size(), 0);
+    std::copy(accepted.cbegin(), accepted.cend(), m_rows.begin() + position);
+    endInsertRows();
+}
+
+void SitesFilterModel::onSourceRowsAboutToBeRemoved(const QModelIndex &parent, int first, int last)
+{
+    Q_UNUSED(parent)
+    ++m_generation;
+    if (passThrough()) {
+        beginRemoveRows(QModelIndex(), first, last);
+        return;
+    }
+
+    m_removeBegin = std::lower_bound(m_rows.cbegin(), m_rows.cend(), first) - m_rows.cbegin();
+    m_removeEnd = std::lower_bound(m_rows.cbegin(), m_rows.cend(), last + 1) - m_rows.cbegin();
+    if (m_removeEnd > m_removeBegin) {
+        beginRemoveRows(QModelIndex(), m_removeBegin, m_removeEnd - 1);
+    }
+}
+
+void SitesFilterModel::onSourceRowsRemoved(const QModelIndex &parent, int first, int last)
+{
+    Q_UNUSED(parent)
+    if (passThrough()) {
+        endRemoveRows();
+        return;
+    }
+
+    const int count = last - first + 1;
+    m_rows.remove(m_removeBegin, m_removeEnd - m_removeBegin);
+    for (int i = m_removeBegin; i < m_rows.size(); ++i) {
+        m_rows[i] -= count;
+    }
+    if (m_removeEnd > m_removeBegin) {
+        endRemoveRows();
+    }
+}
+
+void SitesFilterModel::onSourceDataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight, const QList<int> &roles)
+{
+    ++m_generation;
+    if (passThrough()) {
+        emit dataChanged(index(topLeft.row(), 0), index(bottomRight.row(), 0), roles);
+        return;
+    }
+
+    for (int row = topLeft.row(); row <= bottomRight.row(); ++row) {
+        const int position = std::lower_bound(m_rows.cbegin(), m_rows.cend(), row) - m_rows.cbegin();
+        const bool shown = position < m_rows.size() && m_rows.at(position) == row;
+        const bool accepted = accepts(row);
+        if (shown && accepted) {
+            emit dataChanged(index(position, 0), index(position, 0), roles);
+        } else if (shown) {
+            beginRemoveRows(QModelIndex(), position, position);
+            m_rows.removeAt(position);
+            endRemoveRows();
+        } else if (accepted) {
+            beginInsertRows(QModelIndex(), position, position);
+            m_rows.insert(position, row);
+            endInsertRows();
+        }
+    }
+}
+
+void SitesFilterModel::onSourceAboutToBeReset()
+{
+    ++m_generation;
+    beginResetModel();
+}
+
+void SitesFilterModel::onSourceReset()
+{
+    // Nothing is shown for a filter until the new sites were searched
+    m_rows.clear();
+    endResetModel();
+    if (!m_filterText.isEmpty()) {
+        refilter();
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef SITESFILTERMODEL_H
+#define SITESFILTERMODEL_H
+
+#include <QAbstractProxyModel>
+#include <QFutureWatcher>
+#include <QVector>
+
+class SitesModel;
+
+/**
+ * @brief The SitesFilterModel class - searches the sites without blocking the UI
+ *
+ * A new filter text is matched against a snapshot of the sites on a worker
+ * thread, superseded searches are cancelled. Sites added, removed or changed
+ * while a filter is set are checked right away, so the view updates row by
+ * row instead of being reset. Without a filter text all rows are passed
+ * through as they are.
+ */
+class SitesFilterModel : public QAbstractProxyModel
+{
+    Q_OBJECT
+    Q_PROPERTY(QString filterText READ filterText WRITE setFilterText NOTIFY filterTextChanged)
+    Q_PROPERTY(bool isFiltering READ isFiltering NOTIFY isFilteringChanged)
+
+public:
+    explicit SitesFilterModel(SitesModel *sitesModel, QObject *parent = nullptr);
+
+    QModelIndex index(int row, int column, const QModelIndex &parent = QModelIndex()) const override;
+    QModelIndex parent(const QModelIndex &child) const override;
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+
+    QModelIndex mapToSource(const QModelIndex &proxyIndex) const override;
+    QModelIndex mapFromSource(const QModelIndex &sourceIndex) const override;
+
+    QString filterText() const { return m_filterText; }
+    void setFilterText(const QString &filterText);
+    bool isFiltering() const { return m_watcher.isRunning(); }
+
+public slots:
+    int sourceRow(int proxyRow) const;
+
+signals:
+    void filterTextChanged();
+    void isFilteringChanged();
+
+private slots:
+    void onFilterFinished();
+
+    void onSourceRowsAboutToBeInserted(const QModelIndex &parent, int first, int last);
+    void onSourceRowsInserted(const QModelIndex &parent, int first, int last);
+    void onSourceRowsAboutToBeRemoved(const QModelIndex &parent, int first, int last);
+    void onSourceRowsRemoved(const QModelIndex &parent, int first, int last);
+    void onSourceDataChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight, const QList<int> &roles);
+    void onSourceAboutToBeReset();
+    void onSourceReset();
+
+private:
+    bool passThrough() const { return m_appliedText.isEmpty(); }
+    bool accepts(int sourceRow) const;
+    void refilter();
+
+    SitesModel *m_sitesModel;
+    QString m_filterText;
+    // The filter m_rows was built for, it lags behind while a search runs
+    QString m_appliedText;
+
+    // Source rows shown while filtering, ascending
+    QVector<int> m_rows;
+    // Span of m_rows going away with the source rows being removed
+    int m_removeBegin = 0;
+    int m_removeEnd = 0;
+    // Bumped whenever the source changes, a search started on an older
+    // snapshot is started again
+    int m_generation = 0;
+    int m_searchGeneration = 0;
+    QFutureWatcher<QVector<int>> m_watcher;
+};
+
+#endif // SITESFILTERMODEL_H
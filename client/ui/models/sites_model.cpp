@@ -45,17 +45,21 @@ bool SitesModel::addSite(const QString &hostname, const QString &ip)
     if (!m_settings->addVpnSite(m_currentRouteMode, hostname, ip)) {
         return false;
     }
-    for (int i = 0; i < m_sites.size(); i++) {
-        if (m_sites[i].first == hostname && (m_sites[i].second.isEmpty() && !ip.isEmpty())) {
-            m_sites[i].second = ip;
-            QModelIndex index = createIndex(i, i);
+
+    const auto it = m_index.constFind(hostname);
+    if (it != m_index.constEnd()) {
+        QString &storedIp = m_sites[*it].second;
+        if (storedIp.isEmpty() && !ip.isEmpty()) {
+            storedIp = ip;
+            QModelIndex index = createIndex(*it, 0);
             emit dataChanged(index, index);
             return true;
-        } else if (m_sites[i].first == hostname && (m_sites[i].second == ip)) {
-            return false;
         }
+        return false;
     }
+
     beginInsertRows(QModelIndex(), rowCount(), rowCount());
+    m_index.insert(hostname, m_sites.size());
     m_sites.append(qMakePair(hostname, ip));
     endInsertRows();
     return true;
@@ -63,23 +67,66 @@ bool SitesModel::addSite(const QString &hostname, const QString &ip)
 
 void SitesModel::addSites(const QMap<QString, QString> &sites, bool replaceExisting)
 {
-    beginResetModel();
-
     if (replaceExisting) {
+        beginResetModel();
         m_settings->removeAllVpnSites(m_currentRouteMode);
+        m_settings->addVpnSites(m_currentRouteMode, sites);
+        fillSites();
+        endResetModel();
+        return;
     }
+
     m_settings->addVpnSites(m_currentRouteMode, sites);
-    fillSites();
 
-    endResetModel();
+    QVector<QPair<QString, QString>> added;
+    added.reserve(sites.size());
+    for (auto i = sites.constBegin(); i != sites.constEnd(); ++i) {
+        added.append(qMakePair(i.key(), i.value()));
+    }
+    mergeSites(added);
+}
+
+void SitesModel::storeSites(const QMap<QString, QString> &sites)
+{
+    m_settings->addVpnSites(m_currentRouteMode, sites);
+}
+
+void SitesModel::reload()
+{
+    const QVariantMap &stored = m_settings->vpnSites(m_currentRouteMode);
+
+    // Sites only ever get added behind the model's back, anything else is rare
+    // enough to just start over
+    bool removed = stored.size() < m_sites.size();
+    for (int i = 0; !removed && i < m_sites.size(); ++i) {
+        removed = !stored.contains(m_sites.at(i).first);
+    }
+    if (removed) {
+        beginResetModel();
+        fillSites();
+        endResetModel();
+        return;
+    }
+
+    QVector<QPair<QString, QString>> sites;
+    sites.reserve(stored.size());
+    for (auto i = stored.constBegin(); i != stored.constEnd(); ++i) {
+        sites.append(qMakePair(i.key(), i.value().toString()));
+    }
+    mergeSites(sites);
 }
 
 void SitesModel::removeSite(QModelIndex index)
 {
-    auto hostname = m_sites.at(index.row()).first;
-    beginRemoveRows(QModelIndex(), index.row(), index.row());
+    const int row = index.row();
+    auto hostname = m_sites.at(row).first;
+    beginRemoveRows(QModelIndex(), row, row);
     m_settings->removeVpnSite(m_currentRouteMode, hostname);
-    m_sites.removeAt(index.row());
+    m_sites.removeAt(row);
+    m_index.remove(hostname);
+    for (int i = row; i < m_sites.size(); ++i) {
+        m_index[m_sites.at(i).first] = i;
+    }
     endRemoveRows();
 }
 
@@ -126,10 +173,49 @@ QHash<int, QByteArray> SitesModel::roleNames() const
 void SitesModel::fillSites()
 {
     m_sites.clear();
+    m_index.clear();
     const QVariantMap &sites = m_settings->vpnSites(m_currentRouteMode);
+    m_sites.reserve(sites.size());
+    m_index.reserve(sites.size());
     auto i = sites.constBegin();
     while (i != sites.constEnd()) {
+        m_index.insert(i.key(), m_sites.size());
         m_sites.append(qMakePair(i.key(), i.value().toString()));
         ++i;
     }
 }
+
+void SitesModel::mergeSites(const QVector<QPair<QString, QString>> &sites)
+{
+    QVector<QPair<QString, QString>> added;
+    int firstChanged = -1;
+    int lastChanged = -1;
+    for (const auto &site : sites) {
+        const auto it = m_index.constFind(site.first);
+        if (it == m_index.constEnd()) {
+            added.append(site);
+            continue;
+        }
+        QString &ip = m_sites[*it].second;
+        if (ip != site.second) {
+            ip = site.second;
+            firstChanged = firstChanged < 0 ? *it : qMin(firstChanged, *it);
+            lastChanged = qMax(lastChanged, *it);
+        }
+    }
+
+    if (firstChanged >= 0) {
+        emit dataChanged(createIndex(firstChanged, 0), createIndex(lastChanged, 0), { IpRole });
+    }
+    if (added.isEmpty()) {
+        return;
+    }
+
+    beginInsertRows(QModelIndex(), m_sites.size(), m_sites.size() + added.size() - 1);
+    m_sites.reserve(m_sites.size() + added.size());
+    for (const auto &site : std::as_const(added)) {
+        m_index.insert(site.first, m_sites.size());
+        m_sites.append(site);
+    }
+    endInsertRows();
+}
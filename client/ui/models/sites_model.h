@@ -27,6 +27,9 @@ public:
 public slots:
     bool addSite(const QString &hostname, const QString &ip);
     void addSites(const QMap<QString, QString> &sites, bool replaceExisting);
+    // Writes sites to the settings only, the view picks them up on reload()
+    void storeSites(const QMap<QString, QString> &sites);
+    void reload();
     void removeSite(QModelIndex index);
 
     int getRouteMode();
@@ -35,6 +38,7 @@ public slots:
     bool isSplitTunnelingEnabled();
     void toggleSplitTunneling(bool enabled);
 
+    // Cheap to copy, the filter model takes snapshots of it
     QVector<QPair<QString, QString>> getCurrentSites();
 
 signals:
@@ -46,6 +50,8 @@ protected:
 
 private:
     void fillSites();
+    // Appends unknown sites in one insert and updates the ip of known ones
+    void mergeSites(const QVector<QPair<QString, QString>> &sites);
 
     std::shared_ptr<Settings> m_settings;
 
@@ -53,6 +59,8 @@ private:
     Settings::RouteMode m_currentRouteMode;
 
     QVector<QPair<QString, QString>> m_sites;
+    // hostname -> row in m_sites
+    QHash<QString, int> m_index;
 };
 
 #endif // SITESMODEL_H
@@ -5,8 +5,6 @@ import QtQuick.Dialogs
 
 import QtCore
 
-import SortFilterProxyModel 0.2
-
 import PageEnum 1.0
 import ProtocolEnum 1.0
 import ContainerProps 1.0
@@ -31,6 +29,8 @@ PageType {
     }
 
     property bool pageEnabled
+    // Percent of the running sites import, -1 while none is running
+    property int importProgress: -1
 
     Component.onCompleted: {
         if (ConnectionController.isConnected) {
@@ -54,6 +54,15 @@ PageType {
         function onErrorOccurred(errorMessage) {
             PageController.showErrorMessage(errorMessage)
         }
+
+        function onImportProgressChanged(percent) {
+            root.importProgress = percent
+        }
+
+        function onImportFinished() {
+            root.importProgress = -1
+            PageController.showBusyIndicator(false)
+        }
     }
 
     QtObject {
@@ -186,6 +195,21 @@ PageType {
                             searchField.textField
             }
         }
+
+        ProgressBarType {
+            id: importProgressBar
+
+            Layout.fillWidth: true
+            Layout.topMargin: 16
+            Layout.leftMargin: 16
+            Layout.rightMargin: 16
+
+            visible: root.importProgress >= 0
+
+            from: 0
+            to: 100
+            value: root.importProgress
+        }
     }
 
     FlickableType {
@@ -207,23 +231,12 @@ PageType {
                 width: parent.width
                 height: sites.contentItem.height
 
-                model: SortFilterProxyModel {
-                    id: proxySitesModel
-                    sourceModel: SitesModel
-                    filters: [
-                        AnyOf {
-                            RegExpFilter {
-                                roleName: "url"
-                                pattern: ".*" + searchField.textField.text + ".*"
-                                caseSensitivity: Qt.CaseInsensitive
-                            }
-                            RegExpFilter {
-                                roleName: "ip"
-                                pattern: ".*" + searchField.textField.text + ".*"
-                                caseSensitivity: Qt.CaseInsensitive
-                            }
-                        }
-                    ]
+                model: SitesFilterModel
+
+                Binding {
+                    target: SitesFilterModel
+                    property: "filterText"
+                    value: searchField.textField.text
                 }
 
                 clip: true
@@ -274,7 +287,7 @@ PageType {
                                 var noButtonText = qsTr("Cancel")
 
                                 var yesButtonFunction = function() {
-                                    SitesController.removeSite(proxySitesModel.mapToSource(index))
+                                    SitesController.removeSite(SitesFilterModel.sourceRow(index))
                                     if (!GC.isMobile()) {
                                         site.rightButton.forceActiveFocus()
                                     }
@@ -358,7 +371,7 @@ PageType {
         id: moreActionsDrawer
 
         anchors.fill: parent
-        expandedHeight: parent.height * 0.4375
+        expandedHeight: parent.height * 0.5
 
         onClosed: {
             if (root.defaultActiveFocusItem && !GC.isMobile()) {
@@ -420,7 +433,7 @@ PageType {
                 Layout.fillWidth: true
                 text: qsTr("Save site list")
 
-                KeyNavigation.tab: focusItem1
+                KeyNavigation.tab: geoIpButton
 
                 clickedFunction: function() {
                     var fileName = ""
@@ -443,6 +456,128 @@ PageType {
             }
 
             DividerType {}
+
+            LabelWithButtonType {
+                id: geoIpButton
+                Layout.fillWidth: true
+
+                text: qsTr("Countries and ASNs")
+                rightImageSource: "qrc:/images/controls/chevron-right.svg"
+
+                KeyNavigation.tab: focusItem1
+
+                clickedFunction: function() {
+                    geoIpDrawer.open()
+                }
+            }
+
+            DividerType {}
+        }
+    }
+
+    DrawerType2 {
+        id: geoIpDrawer
+
+        anchors.fill: parent
+        expandedHeight: parent.height * 0.6
+
+        onClosed: {
+            if (!GC.isMobile()) {
+                moreActionsDrawer.forceActiveFocus()
+            }
+        }
+
+        expandedContent: Item {
+            implicitHeight: geoIpDrawer.expandedHeight
+
+            Connections {
+                target: geoIpDrawer
+                function onOpened() {
+                    geoIpSelectors.textFieldText = SitesController.geoIpSelectors().join(", ")
+                    if (!GC.isMobile()) {
+                        focusItem3.forceActiveFocus()
+                    }
+                }
+            }
+
+            Item {
+                id: focusItem3
+                KeyNavigation.tab: geoIpDrawerBackButton
+            }
+
+            BackButtonType {
+                id: geoIpDrawerBackButton
+
+                anchors.top: parent.top
+                anchors.left: parent.left
+                anchors.right: parent.right
+                anchors.topMargin: 16
+
+                KeyNavigation.tab: geoIpSelectors.textField
+
+                backButtonFunction: function() {
+                    geoIpDrawer.close()
+                }
+            }
+
+            FlickableType {
+                anchors.top: geoIpDrawerBackButton.bottom
+                anchors.left: parent.left
+                anchors.right: parent.right
+                anchors.bottom: parent.bottom
+
+                contentHeight: geoIpDrawerContent.height
+
+                ColumnLayout {
+                    id: geoIpDrawerContent
+
+                    anchors.top: parent.top
+                    anchors.left: parent.left
+                    anchors.right: parent.right
+                    anchors.leftMargin: 16
+                    anchors.rightMargin: 16
+
+                    spacing: 16
+
+                    Header2Type {
+                        Layout.fillWidth: true
+                        Layout.topMargin: 16
+
+                        headerText: qsTr("Countries and ASNs")
+                    }
+
+                    ParagraphTextType {
+                        Layout.fillWidth: true
+                        text: qsTr("Addresses of these countries and networks are handled like the sites of the selected mode. Enter country codes (DE) or AS numbers (AS13335), separated by commas.")
+                    }
+
+                    TextFieldWithHeaderType {
+                        id: geoIpSelectors
+
+                        Layout.fillWidth: true
+                        headerText: qsTr("Countries and ASNs")
+                        textFieldPlaceholderText: qsTr("DE, AS13335")
+
+                        KeyNavigation.tab: geoIpSaveButton
+                    }
+
+                    BasicButtonType {
+                        id: geoIpSaveButton
+
+                        Layout.fillWidth: true
+
+                        text: qsTr("Save")
+
+                        clickedFunc: function() {
+                            SitesController.setGeoIpSelectors(geoIpSelectors.textFieldText.split(","))
+                            geoIpDrawer.close()
+                            moreActionsDrawer.close()
+                        }
+
+                        Keys.onTabPressed: lastItemTabClicked(focusItem3)
+                    }
+                }
+            }
         }
     }
 
@@ -520,7 +655,7 @@ PageType {
 
                         clickedFunction: function() {
                             var fileName = SystemController.getFileName(qsTr("Open sites file"),
-                                                                        qsTr("Sites files (*.json)"))
+                                                                        qsTr("Sites files (*.json *.txt *.lst *.hosts)"))
                             if (fileName !== "") {
                                 importSitesDrawerContent.importSites(fileName, true)
                             }
@@ -537,7 +672,7 @@ PageType {
 
                         clickedFunction: function() {
                             var fileName = SystemController.getFileName(qsTr("Open sites file"),
-                                                                        qsTr("Sites files (*.json)"))
+                                                                        qsTr("Sites files (*.json *.txt *.lst *.hosts)"))
                             if (fileName !== "") {
                                 importSitesDrawerContent.importSites(fileName, false)
                             }
@@ -545,9 +680,9 @@ PageType {
                     }
 
                     function importSites(fileName, replaceExistingSites) {
+                        root.importProgress = 0
                         PageController.showBusyIndicator(true)
                         SitesController.importSites(fileName, replaceExistingSites)
-                        PageController.showBusyIndicator(false)
                         importSitesDrawer.close()
                         moreActionsDrawer.close()
                     }
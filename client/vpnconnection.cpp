@@ -5,6 +5,7 @@
 #include <QHostInfo>
 #include <QJsonObject>
 #include <QEventLoop>
+#include <QStandardPaths>
 
 #include <configurators/cloak_configurator.h>
 #include <configurators/openvpn_configurator.h>
@@ -29,6 +30,36 @@
 #include "core/networkUtilities.h"
 #include "vpnconnection.h"
 
+#ifdef AMNEZIA_DESKTOP
+namespace {
+// Parallel DNS lookups when re-resolving split tunneling sites
+constexpr int kSitesResolverConcurrency = 16;
+
+QStringList routableAddresses(const QStringList &addresses, QAbstractSocket::NetworkLayerProtocol family)
+{
+    QStringList result;
+    for (const QString &address : addresses) {
+        if (QHostAddress(address).protocol() == family) {
+            result.append(address);
+        }
+    }
+    return result;
+}
+
+// Same for prefixes, which QHostAddress doesn't parse on its own
+QStringList routablePrefixes(const QStringList &prefixes, QAbstractSocket::NetworkLayerProtocol family)
+{
+    QStringList result;
+    for (const QString &prefix : prefixes) {
+        if (QHostAddress::parseSubnet(prefix).first.protocol() == family) {
+            result.append(prefix);
+        }
+    }
+    return result;
+}
+}
+#endif
+
 VpnConnection::VpnConnection(std::shared_ptr<Settings> settings, QObject *parent)
     : QObject(parent), m_settings(settings), m_checkTimer(new QTimer(this))
 {
@@ -45,6 +76,9 @@ VpnConnection::~VpnConnection()
 {
 #if defined AMNEZIA_DESKTOP
     disconnectFromVpn();
+    // Nothing will handle the replies, but the teardown calls must still
+    // reach the service before the application exits
+    IpcClient::flush();
 #endif
 }
 
@@ -61,29 +95,53 @@ void VpnConnection::onConnectionStateChanged(Vpn::ConnectionState state)
     
     if (IpcClient::Interface()) {
         if (state == Vpn::ConnectionState::Connected) {
-            IpcClient::Interface()->resetIpStack();
-            IpcClient::Interface()->flushDns();
+            // Everything the service sets up on connect goes over in one call
+            NetworkTransaction transaction;
+            transaction.setResetIpStack(true);
+            transaction.setFlushDns(true);
 
             if (!m_vpnConfiguration.value(config_key::configVersion).toInt()) {
-                QString dns1 = m_vpnConfiguration.value(config_key::dns1).toString();
-                QString dns2 = m_vpnConfiguration.value(config_key::dns2).toString();
-
-                IpcClient::Interface()->routeAddList(m_vpnProtocol->vpnGateway(), QStringList() << dns1 << dns2);
+                QStringList vpnRoutes;
+                for (const QString &dns : { m_vpnConfiguration.value(config_key::dns1).toString(),
+                                            m_vpnConfiguration.value(config_key::dns2).toString() }) {
+                    if (!dns.isEmpty()) {
+                        vpnRoutes.append(dns);
+                    }
+                }
+                transaction.setVpnGateway(m_vpnProtocol->vpnGateway());
 
                 if (m_settings->isSitesSplitTunnelingEnabled()) {
-                    IpcClient::Interface()->routeDeleteList(m_vpnProtocol->vpnGateway(), QStringList() << "0.0.0.0");
-                        // qDebug() << "VpnConnection::onConnectionStateChanged :: adding custom routes, count:" << forwardIps.size();
-                    if (m_settings->routeMode() == Settings::VpnOnlyForwardSites) {
-                        QTimer::singleShot(1000, m_vpnProtocol.data(),
-                                           [this]() { addSitesRoutes(m_vpnProtocol->vpnGateway(), m_settings->routeMode()); });
-                    } else if (m_settings->routeMode() == Settings::VpnAllExceptSites) {
-                        IpcClient::Interface()->routeAddList(m_vpnProtocol->vpnGateway(), QStringList() << "0.0.0.0/1");
-                        IpcClient::Interface()->routeAddList(m_vpnProtocol->vpnGateway(), QStringList() << "128.0.0.0/1");
-
-                        IpcClient::Interface()->routeAddList(m_vpnProtocol->routeGateway(), QStringList() << remoteAddress());
-                        addSitesRoutes(m_vpnProtocol->routeGateway(), m_settings->routeMode());
+                    transaction.setDeletedVpnRoutes(QStringList() << "0.0.0.0");
+                    if (m_settings->routeMode() == Settings::VpnAllExceptSites) {
+                        vpnRoutes << "0.0.0.0/1" << "128.0.0.0/1";
+                        transaction.setRouteGateway(m_vpnProtocol->routeGateway());
+                        transaction.setRouteGatewayRoutes(QStringList() << remoteAddress());
                     }
                 }
+                transaction.setVpnRoutes(vpnRoutes);
+            }
+
+            auto *watcher = new QRemoteObjectPendingCallWatcher(IpcClient::Interface()->applyNetworkState(transaction), this);
+            connect(watcher, &QRemoteObjectPendingCallWatcher::finished, this, [this](QRemoteObjectPendingCallWatcher *call) {
+                call->deleteLater();
+                if (call->error() == QRemoteObjectPendingCall::NoError && call->returnValue().toBool()) {
+                    return;
+                }
+                qWarning() << "VpnConnection: the service failed to apply the network state and rolled it back";
+                // A disconnect may have come first
+                if (m_vpnProtocol && m_vpnProtocol->isConnected()) {
+                    m_vpnProtocol->setLastError(ErrorCode::NetworkSetupError);
+                }
+            });
+
+            // Site routes follow the transaction, the service handles calls in order
+            if (!m_vpnConfiguration.value(config_key::configVersion).toInt() && m_settings->isSitesSplitTunnelingEnabled()) {
+                if (m_settings->routeMode() == Settings::VpnOnlyForwardSites) {
+                    QTimer::singleShot(1000, m_vpnProtocol.data(),
+                                       [this]() { addSitesRoutes(m_vpnProtocol->vpnGateway(), m_settings->routeMode()); });
+                } else if (m_settings->routeMode() == Settings::VpnAllExceptSites) {
+                    addSitesRoutes(m_vpnProtocol->routeGateway(), m_settings->routeMode());
+                }
             }
 
         } else if (state == Vpn::ConnectionState::Error) {
@@ -121,42 +179,139 @@ void VpnConnection::addSitesRoutes(const QString &gw, Settings::RouteMode mode)
 #ifdef AMNEZIA_DESKTOP
     QStringList ips;
     QStringList sites;
+    QHash<QString, QString> storedIps;
     const QVariantMap &m = m_settings->vpnSites(mode);
     for (auto i = m.constBegin(); i != m.constEnd(); ++i) {
         if (NetworkUtilities::checkIpSubnetFormat(i.key())) {
             ips.append(i.key());
         } else {
             if (NetworkUtilities::checkIpSubnetFormat(i.value().toString())) {
-                ips.append(i.value().toString());
+                storedIps.insert(i.key(), i.value().toString());
             }
             sites.append(i.key());
         }
     }
-    ips.removeDuplicates();
-
-    // add all IPs immediately
-    IpcClient::Interface()->routeAddList(gw, ips);
-
-    // re-resolve domains
-    for (const QString &site : sites) {
-        const auto &cbResolv = [this, site, gw, mode, ips](const QHostInfo &hostInfo) {
-            const QList<QHostAddress> &addresses = hostInfo.addresses();
-            QString ipv4Addr;
-            for (const QHostAddress &addr : hostInfo.addresses()) {
-                if (addr.protocol() == QAbstractSocket::NetworkLayerProtocol::IPv4Protocol) {
-                    const QString &ip = addr.toString();
-                    // qDebug() << "VpnConnection::addSitesRoutes updating site" << site << ip;
-                    if (!ips.contains(ip)) {
-                        IpcClient::Interface()->routeAddList(gw, QStringList() << ip);
-                        m_settings->addVpnSite(mode, site, ip);
-                    }
-                    flushDns();
-                    break;
-                }
+
+    if (!m_dnsCache) {
+        m_dnsCache.reset(new DnsCache(QStandardPaths::writableLocation(QStandardPaths::AppDataLocation)
+                                      + "/dns_cache.json"));
+    }
+    if (!m_sitesResolver) {
+        m_sitesResolver = new DnsResolverPool(kSitesResolverConcurrency, this);
+        connect(m_sitesResolver, &DnsResolverPool::resolved, this, &VpnConnection::onSitesResolved);
+        connect(m_sitesResolver, &DnsResolverPool::finished, this, [this]() { m_dnsCache->save(); });
+    }
+    m_sitesResolver->abort();
+    m_sitesGateway = gw;
+    m_sitesRouteMode = mode;
+    m_siteAddresses.clear();
+    m_routedIpRefs.clear();
+    m_installedSiteRoutes.clear();
+
+    // Domains are routed from the cache right away, or from the address
+    // stored with the site when they were never resolved
+    const auto family = QHostAddress(gw).protocol();
+    ips.append(routablePrefixes(geoIpPrefixes(mode), family));
+    for (const QString &ip : std::as_const(ips)) {
+        m_routedIpRefs[ip]++;
+    }
+    for (const QString &site : std::as_const(sites)) {
+        const QStringList known = m_dnsCache->contains(site) ? m_dnsCache->addresses(site) : QStringList(storedIps.value(site));
+        const QStringList addresses = routableAddresses(known, family);
+        for (const QString &ip : addresses) {
+            m_routedIpRefs[ip]++;
+        }
+        m_siteAddresses.insert(site, addresses);
+    }
+
+    // add all IPs immediately, merged into as few routes as possible
+    const QStringList routes = NetworkUtilities::summarizeRoutes(m_routedIpRefs.keys());
+    m_installedSiteRoutes = QSet<QString>(routes.cbegin(), routes.cend());
+    sendRoutes(gw, routes, true);
+
+#ifdef Q_OS_LINUX
+    // The service routes the names as applications resolve them, nothing to look up here
+    if (m_settings->isSitesDnsInterceptionEnabled()) {
+        QJsonObject config;
+        config.insert("gateway", gw);
+        config.insert("upstreams", QJsonArray { m_vpnConfiguration.value(config_key::dns1).toString(),
+                                                m_vpnConfiguration.value(config_key::dns2).toString() });
+        config.insert(config_key::splitTunnelType, mode);
+        config.insert(config_key::splitTunnelSites, QJsonArray::fromStringList(sites));
+
+        auto *watcher = new QRemoteObjectPendingCallWatcher(IpcClient::Interface()->startDnsInterceptor(config), this);
+        connect(watcher, &QRemoteObjectPendingCallWatcher::finished, this, [this, sites](QRemoteObjectPendingCallWatcher *call) {
+            call->deleteLater();
+            if (call->error() == QRemoteObjectPendingCall::NoError && call->returnValue().toBool()) {
+                return;
+            }
+            qWarning() << "VpnConnection::addSitesRoutes: DNS interception is not available, resolving sites";
+            m_sitesResolver->resolve(m_dnsCache->expired(sites));
+        });
+        return;
+    }
+#endif
+
+    // and only look up the names whose cached answers expired
+    m_sitesResolver->resolve(m_dnsCache->expired(sites));
+#endif
+}
+
+void VpnConnection::onSitesResolved(const QMap<QString, DnsAnswer> &results)
+{
+#ifdef AMNEZIA_DESKTOP
+    if (!IpcClient::Interface()) {
+        return;
+    }
+
+    // Only the difference to what is routed goes to the service
+    const auto family = QHostAddress(m_sitesGateway).protocol();
+    bool changed = false;
+    QMap<QString, QString> updatedSites;
+    for (auto i = results.constBegin(); i != results.constEnd(); ++i) {
+        const QString &site = i.key();
+        m_dnsCache->insert(site, i.value().addresses, i.value().ttl);
+
+        const QStringList addresses = routableAddresses(m_dnsCache->addresses(site), family);
+        const QStringList previous = m_siteAddresses.value(site);
+        for (const QString &ip : addresses) {
+            if (!previous.contains(ip) && m_routedIpRefs[ip]++ == 0) {
+                changed = true;
+            }
+        }
+        for (const QString &ip : previous) {
+            if (!addresses.contains(ip) && --m_routedIpRefs[ip] == 0) {
+                m_routedIpRefs.remove(ip);
+                changed = true;
             }
-        };
-        QHostInfo::lookupHost(site, this, cbResolv);
+        }
+        m_siteAddresses.insert(site, addresses);
+
+        if (!addresses.isEmpty()) {
+            updatedSites.insert(site, addresses.first());
+        }
+    }
+
+    // The installed routes are summarized, so an address may be covered by a
+    // wider prefix. Summarize again and exchange the prefixes that differ.
+    if (changed) {
+        const QStringList routes = NetworkUtilities::summarizeRoutes(m_routedIpRefs.keys());
+        const QSet<QString> summarized(routes.cbegin(), routes.cend());
+        const QStringList addedRoutes = QSet<QString>(summarized).subtract(m_installedSiteRoutes).values();
+        const QStringList removedRoutes = QSet<QString>(m_installedSiteRoutes).subtract(summarized).values();
+        m_installedSiteRoutes = summarized;
+
+        if (!addedRoutes.isEmpty()) {
+            sendRoutes(m_sitesGateway, addedRoutes, true);
+        }
+        if (!removedRoutes.isEmpty()) {
+            sendRoutes(m_sitesGateway, removedRoutes, false);
+        }
+        if (!addedRoutes.isEmpty() || !removedRoutes.isEmpty()) {
+            flushDns();
+        }
     }
+    m_settings->addVpnSites(m_sitesRouteMode, updatedSites);
 #endif
 }
 
@@ -170,9 +325,9 @@ void VpnConnection::addRoutes(const QStringList &ips)
 #ifdef AMNEZIA_DESKTOP
     if (connectionState() == Vpn::ConnectionState::Connected && IpcClient::Interface()) {
         if (m_settings->routeMode() == Settings::VpnOnlyForwardSites) {
-            IpcClient::Interface()->routeAddList(m_vpnProtocol->vpnGateway(), ips);
+            sendRoutes(m_vpnProtocol->vpnGateway(), ips, true);
         } else if (m_settings->routeMode() == Settings::VpnAllExceptSites) {
-            IpcClient::Interface()->routeAddList(m_vpnProtocol->routeGateway(), ips);
+            sendRoutes(m_vpnProtocol->routeGateway(), ips, true);
         }
     }
 #endif
@@ -183,14 +338,41 @@ void VpnConnection::deleteRoutes(const QStringList &ips)
 #ifdef AMNEZIA_DESKTOP
     if (connectionState() == Vpn::ConnectionState::Connected && IpcClient::Interface()) {
         if (m_settings->routeMode() == Settings::VpnOnlyForwardSites) {
-            IpcClient::Interface()->routeDeleteList(vpnProtocol()->vpnGateway(), ips);
+            sendRoutes(vpnProtocol()->vpnGateway(), ips, false);
         } else if (m_settings->routeMode() == Settings::VpnAllExceptSites) {
-            IpcClient::Interface()->routeDeleteList(m_vpnProtocol->routeGateway(), ips);
+            sendRoutes(m_vpnProtocol->routeGateway(), ips, false);
         }
     }
 #endif
 }
 
+#ifdef AMNEZIA_DESKTOP
+void VpnConnection::sendRoutes(const QString &gw, const QStringList &ips, bool add)
+{
+    if (ips.size() <= RouteStream::chunkSize()) {
+        if (add) {
+            IpcClient::Interface()->routeAddList(gw, ips);
+        } else {
+            IpcClient::Interface()->routeDeleteList(gw, ips);
+        }
+        return;
+    }
+
+    // Long lists are streamed so the service stays responsive while they are applied
+    if (!m_routeStream) {
+        m_routeStream = new RouteStream(this);
+        connect(m_routeStream, &RouteStream::finished, this, [](int batchId, int applied, bool cancelled) {
+            qDebug() << "VpnConnection: route batch" << batchId << (cancelled ? "cancelled after" : "applied") << applied << "routes";
+        });
+    }
+    if (add) {
+        m_routeStream->add(gw, ips);
+    } else {
+        m_routeStream->remove(gw, ips);
+    }
+}
+#endif
+
 void VpnConnection::flushDns()
 {
 #ifdef AMNEZIA_DESKTOP
@@ -232,8 +414,33 @@ void VpnConnection::connectToVpn(int serverIndex, const ServerCredentials &crede
             return;
         }
     }
+
+    if (m_teardownWatcher) {
+        qDebug() << "VpnConnection::connectToVpn: the previous disconnect is still being cleaned up";
+    }
+
+    const int attempt = ++m_connectAttempt;
+    IpcClient::whenReady(IpcClient::Interface().data(), this, 1000,
+                         [this, attempt, credentials, container, vpnConfiguration](bool ready) {
+        if (attempt != m_connectAttempt) {
+            return;
+        }
+        if (!ready) {
+            qWarning() << "IpcClient replica is not connected!";
+            emit serviceIsNotReady();
+            emit connectionStateChanged(Vpn::ConnectionState::Error);
+            return;
+        }
+        startConnection(credentials, container, vpnConfiguration);
+    });
+#else
+    startConnection(credentials, container, vpnConfiguration);
 #endif
+}
 
+void VpnConnection::startConnection(const ServerCredentials &credentials, DockerContainer container,
+                                    const QJsonObject &vpnConfiguration)
+{
     m_remoteAddress = credentials.hostName;
     emit connectionStateChanged(Vpn::ConnectionState::Connecting);
 
@@ -284,6 +491,18 @@ void VpnConnection::createProtocolConnections()
     connect(m_vpnProtocol.data(), SIGNAL(bytesChanged(quint64, quint64)), this, SLOT(onBytesChanged(quint64, quint64)));
 }
 
+QStringList VpnConnection::geoIpPrefixes(Settings::RouteMode mode)
+{
+    const QStringList selectors = m_settings->geoIpSelectors(mode);
+    if (selectors.isEmpty()) {
+        return {};
+    }
+    if (!m_geoIpDatabase) {
+        m_geoIpDatabase.reset(new GeoIpDatabase());
+    }
+    return m_geoIpDatabase->prefixes(selectors);
+}
+
 void VpnConnection::appendKillSwitchConfig()
 {
     m_vpnConfiguration.insert(config_key::killSwitchOption, QVariant(m_settings->isKillSwitchEnabled()).toString());
@@ -316,6 +535,9 @@ void VpnConnection::appendSplitTunnelingConfig()
             for (const auto &site : sites) {
                 sitesJsonArray.append(site);
             }
+            for (const auto &prefix : geoIpPrefixes(routeMode)) {
+                sitesJsonArray.append(prefix);
+            }
 
             // Allow traffic to Amnezia DNS
             if (routeMode == Settings::VpnOnlyForwardSites) {
@@ -378,13 +600,40 @@ QString VpnConnection::bytesPerSecToText(quint64 bytes)
 void VpnConnection::disconnectFromVpn()
 {
 #ifdef AMNEZIA_DESKTOP
+    if (m_sitesResolver) {
+        m_sitesResolver->abort();
+        m_dnsCache->save();
+    }
+    if (m_routeStream) {
+        m_routeStream->cancelAll();
+    }
+#ifdef Q_OS_LINUX
+    // The setting may have been turned off while connected
+    if (IpcClient::Interface()) {
+        IpcClient::Interface()->stopDnsInterceptor();
+    }
+#endif
+
+    // A connect still waiting for the service is dropped
+    ++m_connectAttempt;
+
     QString proto = m_settings->defaultContainerName(m_settings->defaultServerIndex());
     if (IpcClient::Interface()) {
         IpcClient::Interface()->flushDns();
 
-        // delete cached routes
-        QRemoteObjectPendingReply<bool> response = IpcClient::Interface()->clearSavedRoutes();
-        response.waitForFinished(1000);
+        // delete cached routes, the reply is only watched
+        auto *watcher = new QRemoteObjectPendingCallWatcher(IpcClient::Interface()->clearSavedRoutes(), this);
+        m_teardownWatcher = watcher;
+        connect(watcher, &QRemoteObjectPendingCallWatcher::finished, this, [this](QRemoteObjectPendingCallWatcher *call) {
+            if (call->error() != QRemoteObjectPendingCall::NoError || !call->returnValue().toBool()) {
+                qWarning() << "VpnConnection: the service failed to clear the saved routes";
+            }
+            if (m_teardownWatcher == call) {
+                m_teardownWatcher = nullptr;
+                emit teardownFinished();
+            }
+            call->deleteLater();
+        });
     }
 #endif
 
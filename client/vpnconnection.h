@@ -4,15 +4,21 @@
 #include <QObject>
 #include <QString>
 #include <QScopedPointer>
+#include <QSet>
 #include <QRemoteObjectNode>
+#include <QRemoteObjectPendingCallWatcher>
 #include <QTimer>
 
 #include "protocols/vpnprotocol.h"
 #include "core/defs.h"
+#include "core/dnsCache.h"
+#include "core/dnsResolverPool.h"
+#include "core/geoIpDatabase.h"
 #include "settings.h"
 
 #ifdef AMNEZIA_DESKTOP
 #include "core/ipcclient.h"
+#include "core/routeStream.h"
 #endif
 
 #ifdef Q_OS_ANDROID
@@ -63,10 +69,13 @@ signals:
     void vpnProtocolError(amnezia::ErrorCode error);
 
     void serviceIsNotReady();
+    // The service finished removing the routes of the last disconnect
+    void teardownFinished();
 
 protected slots:
     void onBytesChanged(quint64 receivedBytes, quint64 sentBytes);
     void onConnectionStateChanged(Vpn::ConnectionState state);
+    void onSitesResolved(const QMap<QString, DnsAnswer> &results);
 
 protected:
     QSharedPointer<VpnProtocol> m_vpnProtocol;
@@ -80,8 +89,33 @@ private:
     // Only for iOS for now, check counters
     QTimer m_checkTimer;
 
+    // Opened on first use, see geoIpPrefixes()
+    QScopedPointer<GeoIpDatabase> m_geoIpDatabase;
+
 #ifdef AMNEZIA_DESKTOP
     IpcClient *m_IpcClient {nullptr};
+
+    // Re-resolves expired site domains on connect, see addSitesRoutes()
+    DnsResolverPool *m_sitesResolver {nullptr};
+    QScopedPointer<DnsCache> m_dnsCache;
+    QString m_sitesGateway;
+    Settings::RouteMode m_sitesRouteMode {Settings::VpnOnlyForwardSites};
+    // Addresses routed for each domain, and how many sites need each address
+    QHash<QString, QStringList> m_siteAddresses;
+    QHash<QString, int> m_routedIpRefs;
+    // Prefixes the addresses above were summarized into, as installed
+    QSet<QString> m_installedSiteRoutes;
+
+    // Route lists too long for a single IPC call, see sendRoutes()
+    RouteStream *m_routeStream {nullptr};
+    void sendRoutes(const QString &gw, const QStringList &ips, bool add);
+
+    // Connecting waits for the service without blocking, a disconnect or a
+    // newer connect supersedes the attempt still waiting
+    int m_connectAttempt {0};
+    // Route cleanup of the last disconnect, a new connect doesn't wait for
+    // it as the service handles calls in order
+    QRemoteObjectPendingCallWatcher *m_teardownWatcher {nullptr};
 #endif
 
 #ifdef Q_OS_ANDROID
@@ -92,8 +126,11 @@ private:
 #endif
 
    void createProtocolConnections();
+   void startConnection(const ServerCredentials &credentials, DockerContainer container,
+                        const QJsonObject &vpnConfiguration);
 
    void appendSplitTunnelingConfig();
+   QStringList geoIpPrefixes(Settings::RouteMode mode);
    void appendKillSwitchConfig();
 };
 
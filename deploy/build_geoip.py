@@ -0,0 +1,101 @@
+#!/usr/bin/env python3
+"""Builds geoip.dat, the country and ASN database read by GeoIpDatabase.
+
+The input is the combined IPv4 and IPv6 table from https://iptoasn.com
+(ip2asn-combined.tsv.gz, public domain): one range per line with its first
+and last address, AS number, country code and AS description. Every range
+is listed under its country ("DE") and its AS number ("AS13335").
+
+The layout of the output is documented in client/core/geoIpDatabase.h.
+
+Usage: build_geoip.py ip2asn-combined.tsv.gz geoip.dat
+"""
+
+import gzip
+import ipaddress
+import struct
+import sys
+from collections import defaultdict
+
+MAGIC = b"AGEO"
+VERSION = 1
+HEADER_SIZE = 16
+SELECTOR_SIZE = 28
+NAME_SIZE = 12
+
+
+def merge(ranges):
+    """Sorts the ranges and merges overlapping and adjacent ones."""
+    merged = []
+    for first, last in sorted(ranges):
+        if merged and first <= merged[-1][1] + 1:
+            merged[-1][1] = max(merged[-1][1], last)
+        else:
+            merged.append([first, last])
+    return merged
+
+
+def read_ranges(path):
+    selectors = defaultdict(lambda: ([], []))
+    opener = gzip.open if path.endswith(".gz") else open
+    with opener(path, "rt", encoding="utf-8", errors="replace") as source:
+        for line in source:
+            fields = line.rstrip("\n").split("\t")
+            if len(fields) < 4:
+                continue
+            first = ipaddress.ip_address(fields[0])
+            last = ipaddress.ip_address(fields[1])
+            asn = int(fields[2])
+            country = fields[3].strip().upper()
+
+            # Unrouted space has neither an AS nor a country
+            names = []
+            if asn:
+                names.append("AS%d" % asn)
+            if len(country) == 2 and country.isalpha():
+                names.append(country)
+
+            family = 0 if first.version == 4 else 1
+            for name in names:
+                selectors[name][family].append((int(first), int(last)))
+    return selectors
+
+
+def write_database(selectors, path):
+    names = sorted(name.encode("ascii") for name in selectors)
+    for name in names:
+        if len(name) > NAME_SIZE:
+            raise ValueError("selector name too long: %s" % name.decode())
+
+    records = []
+    ranges = bytearray()
+    offset = HEADER_SIZE + len(names) * SELECTOR_SIZE
+    for name in names:
+        v4, v6 = (merge(family) for family in selectors[name.decode()])
+
+        v4_offset = offset + len(ranges)
+        for first, last in v4:
+            ranges += struct.pack("<II", first, last)
+        v6_offset = offset + len(ranges)
+        for first, last in v6:
+            ranges += first.to_bytes(16, "big") + last.to_bytes(16, "big")
+
+        records.append(struct.pack("<12sIIII", name, v4_offset, len(v4), v6_offset, len(v6)))
+
+    with open(path, "wb") as output:
+        output.write(struct.pack("<4sIII", MAGIC, VERSION, len(names), 0))
+        output.write(b"".join(records))
+        output.write(ranges)
+    print("%s: %d selectors, %d bytes" % (path, len(names), offset + len(ranges)))
+
+
+def main():
+    if len(sys.argv) != 3:
+        print(__doc__.strip().splitlines()[-1], file=sys.stderr)
+        return 1
+    write_database(read_ranges(sys.argv[1]), sys.argv[2])
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -65,6 +65,12 @@ cmake --build . --config release
 cp -r $DEPLOY_DATA_DIR/* $APP_DIR
 cp -r $PREBUILT_DEPLOY_DATA_DIR $APP_DIR/client
 
+# Country and ASN ranges for split tunneling, see client/core/geoIpDatabase.h
+if [ ! -f $TOOLS_DIR/ip2asn-combined.tsv.gz ]; then
+  wget -O $TOOLS_DIR/ip2asn-combined.tsv.gz https://iptoasn.com/data/ip2asn-combined.tsv.gz
+fi
+python3 $DEPLOY_DIR/build_geoip.py $TOOLS_DIR/ip2asn-combined.tsv.gz $APP_DIR/client/bin/geoip.dat
+
 if [ ! -f $CQTDEPLOYER_DIR/cqtdeployer.sh ]; then
   wget -O $TOOLS_DIR/CQtDeployer.zip https://github.com/QuasarApp/CQtDeployer/releases/download/v1.5.4.17/CQtDeployer_1.5.4.17_Linux_x86_64.zip
   unzip -o $TOOLS_DIR/CQtDeployer.zip -d $CQTDEPLOYER_DIR/
@@ -2,13 +2,17 @@
 
 #include <QObject>
 #include <QDateTime>
+#include <QElapsedTimer>
 #include <QLocalSocket>
 #include <QFileInfo>
 
+#include <functional>
+
 #include "router.h"
 #include "logger.h"
 
 #include "../client/protocols/protocols_defs.h"
+#include "../client/core/networkUtilities.h"
 #ifdef Q_OS_WIN
 #include "tapcontroller_win.h"
 #include "../client/platforms/windows/daemon/windowsfirewall.h"
@@ -17,6 +21,7 @@
 
 #ifdef Q_OS_LINUX
 #include "../client/platforms/linux/daemon/linuxfirewall.h"
+#include "dnsinterceptor_linux.h"
 #endif
 
 #ifdef Q_OS_MACOS
@@ -26,7 +31,11 @@
 IpcServer::IpcServer(QObject *parent):
     IpcInterfaceSource(parent)
 
-{}
+{
+    m_routeBatchTimer.setSingleShot(true);
+    m_routeBatchTimer.setInterval(0);
+    connect(&m_routeBatchTimer, &QTimer::timeout, this, &IpcServer::processRouteBatches);
+}
 
 int IpcServer::createPrivilegedProcess()
 {
@@ -108,6 +117,92 @@ bool IpcServer::routeDeleteList(const QString &gw, const QStringList &ips)
     return Router::routeDeleteList(gw ,ips);
 }
 
+void IpcServer::routeBatchBegin(int batchId, const QString &gw, bool add, int total)
+{
+    RouteBatch batch;
+    batch.gw = gw;
+    batch.add = add;
+    batch.total = total;
+    m_routeBatches.insert(batchId, batch);
+}
+
+void IpcServer::routeBatchChunk(int batchId, const QStringList &ips)
+{
+    auto it = m_routeBatches.find(batchId);
+    if (it == m_routeBatches.end()) {
+        // Cancelled, or never begun
+        return;
+    }
+    it->chunks.append(ips);
+    m_routeBatchTimer.start();
+}
+
+void IpcServer::routeBatchEnd(int batchId)
+{
+    auto it = m_routeBatches.find(batchId);
+    if (it == m_routeBatches.end()) {
+        return;
+    }
+    it->ended = true;
+    m_routeBatchTimer.start();
+}
+
+void IpcServer::routeBatchCancel(int batchId)
+{
+    auto it = m_routeBatches.find(batchId);
+    if (it == m_routeBatches.end()) {
+        return;
+    }
+    qDebug() << "IpcServer::routeBatchCancel" << batchId << "after" << it->done << "of" << it->total << "routes";
+    const int applied = it->applied;
+    m_routeBatches.erase(it);
+    emit routeBatchFinished(batchId, applied, true);
+}
+
+void IpcServer::processRouteBatches()
+{
+    for (auto it = m_routeBatches.begin(); it != m_routeBatches.end(); ++it) {
+        if (it->chunks.isEmpty() && !it->ended) {
+            continue;
+        }
+
+        const int batchId = it.key();
+        if (!it->chunks.isEmpty()) {
+            const QStringList ips = it->chunks.takeFirst();
+            QStringList failed;
+            const int applied = it->add ? Router::routeAddList(it->gw, ips, &failed)
+                                        : Router::routeDeleteList(it->gw, ips, &failed);
+            it->applied += applied;
+            it->done += ips.size();
+
+            if (!failed.isEmpty()) {
+                emit routeBatchFailed(batchId, failed, it->add ? "route add failed" : "route delete failed");
+            }
+#ifndef Q_OS_LINUX
+            // Other platforms don't name the failed routes, only how many there were
+            else if (it->add && applied < ips.size()) {
+                emit routeBatchFailed(batchId, {}, QString("%1 of %2 routes were not added").arg(ips.size() - applied).arg(ips.size()));
+            }
+#endif
+            emit routeBatchProgress(batchId, it->done, it->total);
+        }
+
+        if (it->chunks.isEmpty() && it->ended) {
+            const int applied = it->applied;
+            m_routeBatches.erase(it);
+            emit routeBatchFinished(batchId, applied, false);
+        }
+        break;
+    }
+
+    for (const RouteBatch &batch : std::as_const(m_routeBatches)) {
+        if (!batch.chunks.isEmpty() || batch.ended) {
+            m_routeBatchTimer.start();
+            break;
+        }
+    }
+}
+
 void IpcServer::flushDns()
 {
 #ifdef MZ_DEBUG
@@ -126,6 +221,102 @@ void IpcServer::resetIpStack()
     Router::resetIpStack();
 }
 
+bool IpcServer::applyNetworkState(const NetworkTransaction &transaction)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    // Undoes the steps applied so far, latest first
+    QList<std::function<void()>> undo;
+    const auto rollback = [&undo](const char *step) {
+        qWarning() << "IpcServer::applyNetworkState:" << step << "failed, rolling back" << undo.size() << "steps";
+        while (!undo.isEmpty()) {
+            undo.takeLast()();
+        }
+        return false;
+    };
+
+    const QString vpnGateway = transaction.vpnGateway();
+    const QStringList deletedVpnRoutes = transaction.deletedVpnRoutes();
+    // Routes that weren't there are fine, only put back what was removed
+    if (!deletedVpnRoutes.isEmpty() && Router::routeDeleteList(vpnGateway, deletedVpnRoutes) > 0) {
+        undo.append([vpnGateway, deletedVpnRoutes]() { Router::routeAddList(vpnGateway, deletedVpnRoutes); });
+    }
+
+    // Only routes put in place here are undone. Entries that aren't addresses
+    // (a server given by its host name) and routes that were already there
+    // are skipped as they always were, only a route the system refused fails.
+    const auto addRoutes = [&undo](const QString &gw, const QStringList &ips) {
+        QStringList routable;
+        for (const QString &ip : ips) {
+            if (QHostAddress(ip).isNull() && QHostAddress::parseSubnet(ip).first.isNull()) {
+                qDebug() << "IpcServer::applyNetworkState: skipping route to" << ip << ", not an address";
+                continue;
+            }
+            routable.append(ip);
+        }
+        if (routable.isEmpty()) {
+            return true;
+        }
+
+        QStringList failed;
+        QStringList existing;
+        const int applied = Router::routeAddList(gw, routable, &failed, &existing);
+#ifdef Q_OS_LINUX
+        Q_UNUSED(applied)
+        QStringList added = routable;
+        for (const QString &ip : failed + existing) {
+            added.removeAll(ip);
+        }
+        if (!added.isEmpty()) {
+            undo.append([gw, added]() { Router::routeDeleteList(gw, added); });
+        }
+        return failed.isEmpty();
+#else
+        // Only a count is reported here, so the whole list is undone; routes
+        // that didn't go in are simply not found
+        if (applied > 0) {
+            undo.append([gw, routable]() { Router::routeDeleteList(gw, routable); });
+        }
+        if (applied < routable.size()) {
+            qDebug() << "IpcServer::applyNetworkState: added" << applied << "of" << routable.size() << "routes via" << gw;
+            return false;
+        }
+        return true;
+#endif
+    };
+    if (!addRoutes(vpnGateway, transaction.vpnRoutes())) {
+        return rollback("routes through the VPN gateway");
+    }
+    if (!addRoutes(transaction.routeGateway(), transaction.routeGatewayRoutes())) {
+        return rollback("routes through the default gateway");
+    }
+
+    if (transaction.enableKillSwitch()) {
+        const bool enabled = enableKillSwitch(transaction.killSwitchConfig(), transaction.vpnAdapterIndex());
+        undo.append([this]() { disableKillSwitch(); });
+        if (!enabled) {
+            return rollback("kill switch");
+        }
+    }
+
+    if (!transaction.resolversInterface().isEmpty()
+        && !Router::updateResolvers(transaction.resolversInterface(), transaction.resolvers())) {
+        return rollback("resolvers");
+    }
+
+    // These can't be undone, so they only run once everything else is in
+    if (transaction.resetIpStack()) {
+        Router::resetIpStack();
+    }
+    if (transaction.flushDns()) {
+        Router::flushDns();
+    }
+
+    qDebug() << "IpcServer::applyNetworkState took" << timer.elapsed() << "ms";
+    return true;
+}
+
 bool IpcServer::checkAndInstallDriver()
 {
 #ifdef MZ_DEBUG
@@ -181,6 +372,23 @@ bool IpcServer::updateResolvers(const QString& ifname, const QList<QHostAddress>
     return Router::updateResolvers(ifname, resolvers);
 }
 
+bool IpcServer::startDnsInterceptor(const QJsonObject &config)
+{
+#ifdef Q_OS_LINUX
+    return DnsInterceptorLinux::Instance().start(config);
+#else
+    Q_UNUSED(config)
+    return false;
+#endif
+}
+
+void IpcServer::stopDnsInterceptor()
+{
+#ifdef Q_OS_LINUX
+    DnsInterceptorLinux::Instance().stop();
+#endif
+}
+
 void IpcServer::StartRoutingIpv6()
 {
     Router::StartRoutingIpv6();
@@ -239,15 +447,27 @@ bool IpcServer::enableKillSwitch(const QJsonObject &configStr, int vpnAdapterInd
             allownets.append(v.toString());
         }
     }
+
+    // Fewer, wider prefixes mean fewer firewall entries
+    allownets = NetworkUtilities::summarizeRoutes(allownets);
+    blocknets = NetworkUtilities::summarizeRoutes(blocknets);
 #endif
 
 #ifdef Q_OS_LINUX
-    // double-check + ensure our firewall is installed and enabled
+    QElapsedTimer timer;
+    timer.start();
+
+    // double-check + ensure our firewall is installed and enabled. Other
+    // software may have flushed our chains (e.g. a firewalld reload), so the
+    // state is re-read from the kernel once; anchors that are still staged
+    // are then skipped using it.
+    LinuxFirewall::refreshState();
+    LinuxFirewall::prepareKillSwitch();
     LinuxFirewall::setAnchorEnabled(LinuxFirewall::Both, QStringLiteral("000.allowLoopback"), true);
     LinuxFirewall::setAnchorEnabled(LinuxFirewall::Both, QStringLiteral("100.blockAll"), blockAll);
     LinuxFirewall::setAnchorEnabled(LinuxFirewall::IPv4, QStringLiteral("110.allowNets"), allowNets);
     LinuxFirewall::updateAllowNets(allownets);
-    LinuxFirewall::setAnchorEnabled(LinuxFirewall::IPv4, QStringLiteral("120.blockNets"), blockAll);
+    LinuxFirewall::setAnchorEnabled(LinuxFirewall::IPv4, QStringLiteral("120.blockNets"), blockNets && !blocknets.isEmpty());
     LinuxFirewall::updateBlockNets(blocknets);
     LinuxFirewall::setAnchorEnabled(LinuxFirewall::IPv4, QStringLiteral("200.allowVPN"), true);
     LinuxFirewall::setAnchorEnabled(LinuxFirewall::IPv6, QStringLiteral("250.blockIPv6"), true);
@@ -262,6 +482,8 @@ bool IpcServer::enableKillSwitch(const QJsonObject &configStr, int vpnAdapterInd
     LinuxFirewall::updateDNSServers(dnsServers);
     LinuxFirewall::setAnchorEnabled(LinuxFirewall::IPv4, QStringLiteral("320.allowDNS"), true);
     LinuxFirewall::setAnchorEnabled(LinuxFirewall::Both, QStringLiteral("400.allowPIA"), true);
+    LinuxFirewall::setKillSwitchActive(true);
+    qDebug() << "IpcServer::enableKillSwitch took" << timer.elapsed() << "ms";
 #endif
 
 #ifdef Q_OS_MACOS
@@ -302,7 +524,8 @@ bool IpcServer::disableKillSwitch()
 #endif
 
 #ifdef Q_OS_LINUX
-    LinuxFirewall::uninstall();
+    // Keep the staged filter chains around for the next connection
+    LinuxFirewall::deactivateKillSwitch();
 #endif
 
 #ifdef Q_OS_MACOS
@@ -5,6 +5,7 @@
 #include <QObject>
 #include <QRemoteObjectNode>
 #include <QJsonObject>
+#include <QTimer>
 #include "../client/daemon/interfaceconfig.h"
 
 #include "ipc.h"
@@ -21,8 +22,13 @@ public:
     virtual int routeAddList(const QString &gw, const QStringList &ips) override;
     virtual bool clearSavedRoutes() override;
     virtual bool routeDeleteList(const QString &gw, const QStringList &ips) override;
+    virtual void routeBatchBegin(int batchId, const QString &gw, bool add, int total) override;
+    virtual void routeBatchChunk(int batchId, const QStringList &ips) override;
+    virtual void routeBatchEnd(int batchId) override;
+    virtual void routeBatchCancel(int batchId) override;
     virtual void flushDns() override;
     virtual void resetIpStack() override;
+    virtual bool applyNetworkState(const NetworkTransaction &transaction) override;
     virtual bool checkAndInstallDriver() override;
     virtual QStringList getTapList() override;
     virtual void cleanUp() override;
@@ -36,10 +42,29 @@ public:
     virtual bool enableKillSwitch(const QJsonObject &excludeAddr, int vpnAdapterIndex) override;
     virtual bool disableKillSwitch() override;
     virtual bool updateResolvers(const QString& ifname, const QList<QHostAddress>& resolvers) override;
+    virtual bool startDnsInterceptor(const QJsonObject &config) override;
+    virtual void stopDnsInterceptor() override;
 
 private:
+    void processRouteBatches();
+
     int m_localpid = 0;
 
+    struct RouteBatch {
+        QString gw;
+        bool add = true;
+        int total = 0;
+        int done = 0;
+        int applied = 0;
+        bool ended = false;
+        QList<QStringList> chunks;
+    };
+
+    // Chunks are applied from the event loop, one at a time, so a cancel
+    // arriving behind them is seen before they all went through
+    QMap<int, RouteBatch> m_routeBatches;
+    QTimer m_routeBatchTimer;
+
     struct ProcessDescriptor {
         ProcessDescriptor (QObject *parent = nullptr) {
             serverNode = QSharedPointer<QRemoteObjectHost>(new QRemoteObjectHost(parent));
@@ -0,0 +1,204 @@
+#include "backendbenchmark.h"
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QStringList>
+
+#include <arpa/inet.h>
+#include <linux/rtnetlink.h>
+#include <net/route.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <functional>
+
+#include "core/networkUtilities.h"
+#include "ipcserver.h"
+#include "platforms/linux/daemon/linuxfirewall.h"
+#include "routebatch_linux.h"
+
+namespace {
+// before runs ahead of every call, outside of the measured time
+QJsonObject measureCycles(const QString &name, int iterations, const std::function<void()> &before,
+                          const std::function<void()> &call)
+{
+    std::vector<qint64> nsecs;
+    nsecs.reserve(iterations);
+    QElapsedTimer timer;
+    for (int i = 0; i < iterations; ++i) {
+        before();
+        timer.start();
+        call();
+        nsecs.push_back(timer.nsecsElapsed());
+    }
+    return latencyResult(name, nsecs);
+}
+
+// Addresses of the 198.18.0.0/15 benchmarking range, so the host keeps its
+// connectivity while they are blocked
+QStringList benchmarkAddresses(int count)
+{
+    QStringList addresses;
+    addresses.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        addresses.append(QString("198.%1.%2.%3").arg(18 + ((i >> 16) & 1)).arg((i >> 8) & 0xFF).arg(i & 0xFF));
+    }
+    return addresses;
+}
+
+// One SIOCADDRT / SIOCDELRT ioctl per route with the address parsed again
+// for each, as RouterLinux programmed routes before the netlink batches
+int ioctlRoutes(unsigned long request, const QString &gw, const QStringList &ips)
+{
+    const auto setAddress = [](struct sockaddr *addr, const QString &value) {
+        struct sockaddr_in *in = reinterpret_cast<struct sockaddr_in *>(addr);
+        in->sin_family = AF_INET;
+        in->sin_addr.s_addr = inet_addr(value.toStdString().c_str());
+    };
+
+    const int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+    int count = 0;
+    for (const QString &ipWithSubnet : ips) {
+        const QString ip = NetworkUtilities::ipAddressFromIpWithSubnet(ipWithSubnet);
+        const QString mask = NetworkUtilities::netMaskFromIpWithSubnet(ipWithSubnet);
+        if (!NetworkUtilities::checkIPv4Format(ip) || !NetworkUtilities::checkIPv4Format(gw)) {
+            continue;
+        }
+
+        struct rtentry route;
+        memset(&route, 0, sizeof(route));
+        setAddress(&route.rt_gateway, gw);
+        setAddress(&route.rt_dst, ip);
+        setAddress(&route.rt_genmask, mask);
+        route.rt_flags = RTF_UP | RTF_GATEWAY;
+        if (ioctl(sock, request, &route) == 0) {
+            count++;
+        }
+    }
+    close(sock);
+    return count;
+}
+
+int netlinkRoutes(bool add, const QString &gw, const QStringList &ips)
+{
+    RouteBatchLinux batch;
+    for (const QString &ip : ips) {
+        if (add) {
+            batch.add(ip, gw);
+        } else {
+            batch.remove(ip, gw);
+        }
+    }
+    int count = 0;
+    for (int err : batch.commit()) {
+        if (err == 0) {
+            count++;
+        }
+    }
+    return count;
+}
+}
+
+QJsonObject killSwitchConfig(int sites)
+{
+    QJsonObject config;
+    config.insert("splitTunnelType", 1);
+    config.insert("splitTunnelSites", QJsonArray::fromStringList(benchmarkAddresses(sites)));
+    config.insert("hostName", "203.0.113.10");
+    config.insert("dns1", "1.1.1.1");
+    config.insert("dns2", "1.0.0.1");
+    return config;
+}
+
+QJsonArray measureFirewallCommit(int nets, int iterations)
+{
+    QJsonArray results;
+    if (LinuxFirewall::useNftables()) {
+        const QString skipped = "the nftables backend is in use, unset AMNEZIA_FIREWALL_BACKEND";
+        results.append(QJsonObject { { "name", "firewall_install" }, { "skipped", skipped } });
+        results.append(QJsonObject { { "name", QString("firewall_allowNets_%1").arg(nets) }, { "skipped", skipped } });
+        return results;
+    }
+
+    const QStringList addresses = benchmarkAddresses(nets);
+    // One iptables-restore call per table against one iptables call per rule
+    for (const QString &mode : { QString("restore"), QString("per_rule") }) {
+        LinuxFirewall::setRestoreEnabled(mode == "restore");
+        results.append(measureCycles(QString("firewall_install_%1").arg(mode), iterations,
+                                     []() { LinuxFirewall::uninstall(); },
+                                     []() { LinuxFirewall::install(); }));
+        results.append(measureCycles(QString("firewall_allowNets_%1_%2").arg(nets).arg(mode), iterations,
+                                     []() { LinuxFirewall::updateAllowNets({}); },
+                                     [&]() { LinuxFirewall::updateAllowNets(addresses); }));
+        LinuxFirewall::updateAllowNets({});
+    }
+    LinuxFirewall::setRestoreEnabled(true);
+    LinuxFirewall::uninstall();
+    return results;
+}
+
+QJsonArray measureKillSwitchActivation(int sites, int iterations)
+{
+    // The kill switch is staged by the first enableKillSwitch, as in the service
+    IpcServer server;
+    const QJsonObject config = killSwitchConfig(sites);
+
+    QJsonArray results;
+    // Before the gate, a disconnect removed our chains and the next connect
+    // built them again
+    results.append(measureCycles(QString("enableKillSwitch_%1_rebuilt").arg(sites), iterations,
+                                 []() { LinuxFirewall::uninstall(); },
+                                 [&]() { server.enableKillSwitch(config, 0); }));
+    // Now a disconnect only closes the gate
+    results.append(measureCycles(QString("enableKillSwitch_%1_prestaged").arg(sites), iterations,
+                                 [&]() { server.disableKillSwitch(); },
+                                 [&]() { server.enableKillSwitch(config, 0); }));
+    LinuxFirewall::uninstall();
+    return results;
+}
+
+QJsonArray measureRouteProgramming(const QList<int> &counts)
+{
+    QJsonArray results;
+
+    // The routes go through the current default gateway, like split tunnel
+    // exclusions, and only cover the benchmarking range
+    QHash<QString, QString> mainRoutes;
+    RouteBatchLinux probe;
+    const QString gw = probe.dump(RT_TABLE_MAIN, mainRoutes) ? mainRoutes.value("0.0.0.0/0") : QString();
+    if (gw.isEmpty()) {
+        results.append(QJsonObject { { "name", "routes" }, { "skipped", "no IPv4 default gateway" } });
+        return results;
+    }
+
+    for (int count : counts) {
+        QStringList ips = benchmarkAddresses(count);
+        for (QString &ip : ips) {
+            ip += "/32";
+        }
+
+        for (const QString &mode : { QString("ioctl"), QString("netlink") }) {
+            QElapsedTimer timer;
+            timer.start();
+            const int added = mode == "ioctl" ? ioctlRoutes(SIOCADDRT, gw, ips) : netlinkRoutes(true, gw, ips);
+            const double addSeconds = timer.nsecsElapsed() / 1e9;
+            timer.start();
+            const int deleted = mode == "ioctl" ? ioctlRoutes(SIOCDELRT, gw, ips) : netlinkRoutes(false, gw, ips);
+            const double deleteSeconds = timer.nsecsElapsed() / 1e9;
+
+            QJsonObject result;
+            result.insert("name", QString("routes_%1_%2").arg(count).arg(mode));
+            result.insert("routes", count);
+            result.insert("added", added);
+            result.insert("deleted", deleted);
+            result.insert("add_seconds", addSeconds);
+            result.insert("delete_seconds", deleteSeconds);
+            result.insert("add_routes_per_sec", added / addSeconds);
+            result.insert("delete_routes_per_sec", deleted / deleteSeconds);
+            results.append(result);
+        }
+    }
+    return results;
+}
@@ -0,0 +1,33 @@
+#ifndef BACKENDBENCHMARK_H
+#define BACKENDBENCHMARK_H
+
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QList>
+#include <QString>
+
+#include <vector>
+
+// Percentiles of the measured durations, in microseconds
+QJsonObject latencyResult(const QString &name, std::vector<qint64> &nsecs);
+
+// A kill switch configuration blocking the given number of sites
+QJsonObject killSwitchConfig(int sites);
+
+// The Linux backends measured directly, without IPC, each next to the way
+// it worked before. They change the host firewall and routing, so they need
+// root and must not run while the service is connected.
+
+// Installing the firewall and filling an address list through
+// iptables-restore against one iptables call per rule
+QJsonArray measureFirewallCommit(int nets, int iterations);
+
+// Connect-time kill switch activation with the chains rebuilt every time
+// against the pre-staged gate
+QJsonArray measureKillSwitchActivation(int sites, int iterations);
+
+// Adding and deleting that many routes through rtnetlink batches against one
+// ioctl per route
+QJsonArray measureRouteProgramming(const QList<int> &counts);
+
+#endif // BACKENDBENCHMARK_H
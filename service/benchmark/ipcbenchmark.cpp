@@ -0,0 +1,421 @@
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QProcess>
+#include <QRemoteObjectHost>
+#include <QRemoteObjectNode>
+#include <QSemaphore>
+#include <QThread>
+#include <QTimer>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <vector>
+
+#include <unistd.h>
+
+#include "backendbenchmark.h"
+#include "ipcserver.h"
+#include "rep_ipc_interface_merged.h"
+#include "rep_ipc_process_interface_merged.h"
+
+// Measures what the client pays for calls into the service: IpcServer served
+// over the same local socket transport as LocalServer uses, with a mocked
+// router so routes never reach the kernel. The kill switch goes through the
+// real firewall backend and is only measured when running as root.
+
+namespace {
+constexpr int kConnectTimeout = 5000;
+
+// Stands in for a privileged process writing to stdout: start() produces the
+// chunk count and size given as arguments, a chunk per event loop pass. The
+// real IpcServerProcess only runs the VPN binaries it permits.
+class MockProcessSource : public IpcProcessInterfaceSource
+{
+public:
+    void start() override
+    {
+        const int chunks = m_arguments.value(0).toInt();
+        const QByteArray chunk(m_arguments.value(1).toInt(), 'x');
+        emit started();
+        produce(chunks, chunk);
+    }
+    void close() override {}
+
+    void setArguments(const QStringList &arguments) override { m_arguments = arguments; }
+    void setInputChannelMode(QProcess::InputChannelMode mode) override { Q_UNUSED(mode) }
+    void setNativeArguments(const QString &arguments) override { Q_UNUSED(arguments) }
+    void setProcessChannelMode(QProcess::ProcessChannelMode mode) override { Q_UNUSED(mode) }
+    void setProgram(int programId) override { Q_UNUSED(programId) }
+    void setWorkingDirectory(const QString &dir) override { Q_UNUSED(dir) }
+
+    QByteArray readAll() override { return readAllStandardOutput(); }
+    QByteArray readAllStandardError() override { return {}; }
+    QByteArray readAllStandardOutput() override
+    {
+        QByteArray output;
+        output.swap(m_output);
+        return output;
+    }
+
+private:
+    void produce(int remaining, const QByteArray &chunk)
+    {
+        if (remaining == 0) {
+            emit finished(0, QProcess::NormalExit);
+            return;
+        }
+        m_output.append(chunk);
+        emit readyReadStandardOutput();
+        QTimer::singleShot(0, this, [this, remaining, chunk]() { produce(remaining - 1, chunk); });
+    }
+
+    QStringList m_arguments;
+    QByteArray m_output;
+};
+
+// Serves IpcServer the way LocalServer does
+class BenchServer
+{
+public:
+    bool listen(const QString &name)
+    {
+        QLocalServer::removeServer(name);
+        if (!m_server.listen(name)) {
+            qWarning() << "IpcBenchmark: can't listen on" << name << m_server.errorString();
+            return false;
+        }
+        QObject::connect(&m_server, &QLocalServer::newConnection, &m_server, [this]() {
+            m_node.addHostSideConnection(m_server.nextPendingConnection());
+            if (!m_isRemotingEnabled) {
+                m_isRemotingEnabled = true;
+                m_node.enableRemoting(&m_interface);
+                m_node.enableRemoting(&m_process);
+            }
+        });
+        return true;
+    }
+
+private:
+    QLocalServer m_server;
+    QRemoteObjectHost m_node;
+    IpcServer m_interface;
+    MockProcessSource m_process;
+    bool m_isRemotingEnabled = false;
+};
+
+class ServerThread : public QThread
+{
+public:
+    explicit ServerThread(const QString &name) : m_name(name) {}
+
+    bool waitForListening()
+    {
+        m_ready.acquire();
+        return m_listening;
+    }
+
+protected:
+    void run() override
+    {
+        BenchServer server;
+        m_listening = server.listen(m_name);
+        m_ready.release();
+        if (m_listening) {
+            exec();
+        }
+    }
+
+private:
+    QString m_name;
+    QSemaphore m_ready;
+    bool m_listening = false;
+};
+
+// before runs ahead of every call, outside of the measured time
+template<typename Call>
+QJsonObject measureLatency(const QString &name, int iterations, Call call, const std::function<void()> &before = {})
+{
+    // Warm up the connection and the metatype machinery first
+    for (int i = 0; i < qMin(iterations, 100); ++i) {
+        if (before) {
+            before();
+        }
+        call().waitForFinished(kConnectTimeout);
+    }
+
+    std::vector<qint64> nsecs;
+    nsecs.reserve(iterations);
+    QElapsedTimer timer;
+    for (int i = 0; i < iterations; ++i) {
+        if (before) {
+            before();
+        }
+        timer.start();
+        auto reply = call();
+        if (!reply.waitForFinished(kConnectTimeout)) {
+            qWarning() << "IpcBenchmark:" << name << "timed out";
+            break;
+        }
+        nsecs.push_back(timer.nsecsElapsed());
+    }
+    if (nsecs.empty()) {
+        return QJsonObject { { "name", name }, { "error", "timed out" } };
+    }
+    return latencyResult(name, nsecs);
+}
+
+QStringList makeRoutes(int count)
+{
+    QStringList routes;
+    routes.reserve(count);
+    for (int i = 0; i < count; ++i) {
+        routes.append(QString("10.%1.%2.0/24").arg((i >> 8) & 0xFF).arg(i & 0xFF));
+    }
+    return routes;
+}
+
+// Calls are pipelined like a client sending many lists without waiting
+QJsonObject measureRouteThroughput(IpcInterfaceReplica *service, int calls, int routesPerCall)
+{
+    const QStringList routes = makeRoutes(routesPerCall);
+    QList<QRemoteObjectPendingReply<int>> replies;
+    replies.reserve(calls);
+
+    QElapsedTimer timer;
+    timer.start();
+    for (int i = 0; i < calls; ++i) {
+        replies.append(service->routeAddList("10.8.0.1", routes));
+    }
+    qint64 applied = 0;
+    for (auto &reply : replies) {
+        reply.waitForFinished(kConnectTimeout);
+        applied += reply.returnValue();
+    }
+    const double seconds = timer.nsecsElapsed() / 1e9;
+
+    QJsonObject result;
+    result.insert("name", "routeAddList_throughput");
+    result.insert("calls", calls);
+    result.insert("routes_per_call", routesPerCall);
+    result.insert("routes_applied", applied);
+    result.insert("seconds", seconds);
+    result.insert("calls_per_sec", calls / seconds);
+    result.insert("routes_per_sec", applied / seconds);
+    return result;
+}
+
+// Output is pulled the way the client reads a privileged process: every
+// readyRead is answered with a readAllStandardOutput() call
+QJsonObject measureProcessOutput(IpcProcessInterfaceReplica *process, int chunks, int chunkSize)
+{
+    qint64 bytes = 0;
+    int reads = 0;
+    QEventLoop loop;
+    QElapsedTimer timer;
+
+    const auto readyRead = QObject::connect(process, &IpcProcessInterfaceReplica::readyReadStandardOutput, &loop, [&]() {
+        auto *watcher = new QRemoteObjectPendingCallWatcher(process->readAllStandardOutput(), &loop);
+        QObject::connect(watcher, &QRemoteObjectPendingCallWatcher::finished, &loop, [&](QRemoteObjectPendingCallWatcher *call) {
+            bytes += call->returnValue().toByteArray().size();
+            reads++;
+            call->deleteLater();
+            if (bytes >= qint64(chunks) * chunkSize) {
+                loop.quit();
+            }
+        });
+    });
+    QTimer::singleShot(60000, &loop, &QEventLoop::quit);
+
+    timer.start();
+    process->setArguments({ QString::number(chunks), QString::number(chunkSize) });
+    process->start();
+    loop.exec();
+    const double seconds = timer.nsecsElapsed() / 1e9;
+    QObject::disconnect(readyRead);
+
+    QJsonObject result;
+    result.insert("name", "process_output_stream");
+    result.insert("chunks", chunks);
+    result.insert("chunk_size", chunkSize);
+    result.insert("bytes", bytes);
+    result.insert("reads", reads);
+    result.insert("seconds", seconds);
+    result.insert("mb_per_sec", bytes / seconds / (1024 * 1024));
+    return result;
+}
+}
+
+QJsonObject latencyResult(const QString &name, std::vector<qint64> &nsecs)
+{
+    std::sort(nsecs.begin(), nsecs.end());
+    const auto percentile = [&nsecs](double p) {
+        const size_t index = std::max<size_t>(1, static_cast<size_t>(std::ceil(p / 100.0 * nsecs.size()))) - 1;
+        return nsecs.at(index) / 1000.0;
+    };
+    double total = 0;
+    for (qint64 ns : nsecs) {
+        total += ns;
+    }
+
+    QJsonObject result;
+    result.insert("name", name);
+    result.insert("iterations", qint64(nsecs.size()));
+    result.insert("mean_us", total / nsecs.size() / 1000.0);
+    result.insert("p50_us", percentile(50));
+    result.insert("p90_us", percentile(90));
+    result.insert("p99_us", percentile(99));
+    result.insert("max_us", nsecs.back() / 1000.0);
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("AmneziaVPN-ipc-benchmark");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Measures IPC latency and throughput between the client and IpcServer with a mocked router. "
+                                     "Run as root to include the kill switch, which is applied to the host firewall while it is measured. "
+                                     "Results are printed to stdout as JSON.");
+    parser.addHelpOption();
+    const QCommandLineOption inProcessOption("in-process", "Serve from a thread of this process instead of a child process.");
+    const QCommandLineOption iterationsOption("iterations", "Calls per latency measurement.", "count", "2000");
+    const QCommandLineOption routesOption("routes", "Routes per call in the throughput measurement.", "count", "1000");
+    const QCommandLineOption callsOption("calls", "Calls in the throughput measurement.", "count", "200");
+    const QCommandLineOption killSwitchIterationsOption("killswitch-iterations", "Connect-time kill switch activations to measure.",
+                                                        "count", "50");
+    const QCommandLineOption backendsOption("backends", "Also measure the Linux firewall and route backends directly, each next to "
+                                                        "the way it worked before. Needs root and changes the host firewall and routing.");
+    const QCommandLineOption serverOption("server", "Only serve IpcServer on the given socket name.", "name");
+    serverOption.setFlags(QCommandLineOption::HiddenFromHelp);
+    parser.addOptions({ inProcessOption, iterationsOption, routesOption, callsOption, killSwitchIterationsOption, backendsOption,
+                        serverOption });
+    parser.process(app);
+
+    if (parser.isSet(serverOption)) {
+        BenchServer server;
+        return server.listen(parser.value(serverOption)) ? app.exec() : 1;
+    }
+
+    const QString name = QString("AmneziaVpnIpcBenchmark_%1").arg(QCoreApplication::applicationPid());
+    const bool inProcess = parser.isSet(inProcessOption);
+
+    ServerThread serverThread(name);
+    QProcess serverProcess;
+    if (inProcess) {
+        serverThread.start();
+        if (!serverThread.waitForListening()) {
+            return 1;
+        }
+    } else {
+        serverProcess.setProcessChannelMode(QProcess::ForwardedErrorChannel);
+        serverProcess.start(QCoreApplication::applicationFilePath(), { "--server", name });
+        if (!serverProcess.waitForStarted(kConnectTimeout)) {
+            qWarning() << "IpcBenchmark: can't start the server process" << serverProcess.errorString();
+            return 1;
+        }
+    }
+
+    // The child may need a moment before it listens
+    QLocalSocket socket;
+    QElapsedTimer connectTimer;
+    connectTimer.start();
+    do {
+        socket.connectToServer(name);
+        if (socket.waitForConnected(100)) {
+            break;
+        }
+        QThread::msleep(50);
+    } while (connectTimer.elapsed() < kConnectTimeout);
+    if (socket.state() != QLocalSocket::ConnectedState) {
+        qWarning() << "IpcBenchmark: can't connect to" << name;
+        return 1;
+    }
+
+    QRemoteObjectNode node;
+    node.addClientSideConnection(&socket);
+    QScopedPointer<IpcInterfaceReplica> service(node.acquire<IpcInterfaceReplica>());
+    QScopedPointer<IpcProcessInterfaceReplica> process(node.acquire<IpcProcessInterfaceReplica>());
+    if (!service->waitForSource(kConnectTimeout) || !process->waitForSource(kConnectTimeout)) {
+        qWarning() << "IpcBenchmark: the replicas didn't initialize";
+        return 1;
+    }
+
+    const int iterations = qMax(1, parser.value(iterationsOption).toInt());
+    const int routes = qMax(1, parser.value(routesOption).toInt());
+    const int calls = qMax(1, parser.value(callsOption).toInt());
+    const int killSwitchIterations = qMax(1, parser.value(killSwitchIterationsOption).toInt());
+    const QStringList singleRoute { "10.0.0.0/24" };
+    const QJsonObject smallKillSwitch = killSwitchConfig(10);
+    const QJsonObject largeKillSwitch = killSwitchConfig(routes);
+
+    QJsonArray results;
+    results.append(measureLatency("clearSavedRoutes_latency", iterations, [&]() { return service->clearSavedRoutes(); }));
+    results.append(measureLatency("routeAddList_1_latency", iterations,
+                                  [&]() { return service->routeAddList("10.8.0.1", singleRoute); }));
+    results.append(measureLatency(QString("routeAddList_%1_latency").arg(routes), iterations,
+                                  [&, list = makeRoutes(routes)]() { return service->routeAddList("10.8.0.1", list); }));
+    if (geteuid() == 0) {
+        // Every activation follows a disconnect, as on a reconnect
+        const auto disable = [&]() { service->disableKillSwitch().waitForFinished(kConnectTimeout); };
+        results.append(measureLatency("enableKillSwitch_10_latency", killSwitchIterations,
+                                      [&]() { return service->enableKillSwitch(smallKillSwitch, 0); }, disable));
+        results.append(measureLatency(QString("enableKillSwitch_%1_latency").arg(routes), killSwitchIterations,
+                                      [&]() { return service->enableKillSwitch(largeKillSwitch, 0); }, disable));
+        disable();
+    } else {
+        for (const QString &skipped : { QString("enableKillSwitch_10_latency"), QString("enableKillSwitch_%1_latency").arg(routes) }) {
+            results.append(QJsonObject { { "name", skipped }, { "skipped", "needs root" } });
+        }
+    }
+    results.append(measureRouteThroughput(service.data(), calls, routes));
+    results.append(measureProcessOutput(process.data(), iterations, 4096));
+
+    process.reset();
+    service.reset();
+    if (inProcess) {
+        serverThread.quit();
+        serverThread.wait();
+    } else {
+        serverProcess.kill();
+        serverProcess.waitForFinished();
+    }
+
+    // The server is gone by now, so nothing else holds firewall state
+    QJsonArray backendResults;
+    if (parser.isSet(backendsOption)) {
+        if (geteuid() == 0) {
+            // A per-rule list update runs one process per address, a few
+            // rounds of it are enough
+            const QList<QJsonArray> measured { measureFirewallCommit(routes, qMin(killSwitchIterations, 5)),
+                                               measureKillSwitchActivation(routes, killSwitchIterations),
+                                               measureRouteProgramming({ 1000, 10000, 100000 }) };
+            for (const QJsonArray &section : measured) {
+                for (const QJsonValue &result : section) {
+                    backendResults.append(result);
+                }
+            }
+        } else {
+            qWarning() << "IpcBenchmark: --backends needs root, skipping";
+        }
+    }
+
+    QJsonObject report;
+    report.insert("benchmark", "ipc");
+    report.insert("transport", inProcess ? "in-process" : "local-socket");
+    report.insert("qt_version", qVersion());
+    report.insert("results", results);
+    if (parser.isSet(backendsOption)) {
+        report.insert("backend_results", backendResults);
+    }
+    std::fputs(QJsonDocument(report).toJson(QJsonDocument::Indented).constData(), stdout);
+    return 0;
+}
@@ -0,0 +1,61 @@
+#include "router.h"
+
+// Replaces router.cpp in the benchmark: IpcServer runs unchanged, but its
+// calls into the platform router succeed right away without touching routes,
+// DNS or interfaces.
+
+int Router::routeAddList(const QString &gw, const QStringList &ips, QStringList *failed, QStringList *existing)
+{
+    Q_UNUSED(gw)
+    Q_UNUSED(failed)
+    Q_UNUSED(existing)
+    return ips.size();
+}
+
+bool Router::clearSavedRoutes()
+{
+    return true;
+}
+
+int Router::routeDeleteList(const QString &gw, const QStringList &ips, QStringList *failed)
+{
+    Q_UNUSED(gw)
+    Q_UNUSED(failed)
+    return ips.size();
+}
+
+void Router::flushDns()
+{
+}
+
+void Router::resetIpStack()
+{
+}
+
+bool Router::createTun(const QString &dev, const QString &subnet)
+{
+    Q_UNUSED(dev)
+    Q_UNUSED(subnet)
+    return true;
+}
+
+bool Router::deleteTun(const QString &dev)
+{
+    Q_UNUSED(dev)
+    return true;
+}
+
+void Router::StartRoutingIpv6()
+{
+}
+
+void Router::StopRoutingIpv6()
+{
+}
+
+bool Router::updateResolvers(const QString &ifname, const QList<QHostAddress> &resolvers)
+{
+    Q_UNUSED(ifname)
+    Q_UNUSED(resolvers)
+    return true;
+}
@@ -0,0 +1,8 @@
+#ifndef BENCHMARK_REP_IPC_INTERFACE_SOURCE_H
+#define BENCHMARK_REP_IPC_INTERFACE_SOURCE_H
+
+// IpcServer includes the source header; the benchmark generates the merged
+// one so the replica classes live in the same binary without duplicates
+#include "rep_ipc_interface_merged.h"
+
+#endif // BENCHMARK_REP_IPC_INTERFACE_SOURCE_H
@@ -0,0 +1,7 @@
+#ifndef BENCHMARK_REP_IPC_PROCESS_INTERFACE_SOURCE_H
+#define BENCHMARK_REP_IPC_PROCESS_INTERFACE_SOURCE_H
+
+// See rep_ipc_interface_source.h
+#include "rep_ipc_process_interface_merged.h"
+
+#endif // BENCHMARK_REP_IPC_PROCESS_INTERFACE_SOURCE_H
@@ -0,0 +1,411 @@
+#include "dnsinterceptor_linux.h"
+#include "router_linux.h"
+
+#include <QDebug>
+#include <QJsonArray>
+#include <QNetworkDatagram>
+#include <QProcess>
+#include <QRandomGenerator>
+#include <QUdpSocket>
+#include <QtEndian>
+
+#include <sys/socket.h>
+
+#include "../client/platforms/linux/daemon/linuxfirewall.h"
+#include "../client/protocols/protocols_defs.h"
+
+namespace {
+// Queries from local processes are redirected here
+constexpr quint16 kListenPort = 45353;
+// Marks the forwarder's own queries so they are not redirected back to it
+constexpr quint32 kSocketMark = 0x3212;
+// An upstream that does not answer in time is replaced by the next one
+constexpr int kQueryTimeoutMsec = 2000;
+constexpr int kMaxPendingQueries = 4096;
+
+constexpr int kHeaderSize = 12;
+constexpr quint16 kTypeA = 1;
+constexpr quint16 kTypeAAAA = 28;
+constexpr int kMaxPointerJumps = 16;
+
+quint16 readU16(const QByteArray &packet, int offset)
+{
+    return qFromBigEndian<quint16>(packet.constData() + offset);
+}
+
+void writeId(QByteArray &packet, quint16 id)
+{
+    qToBigEndian<quint16>(id, packet.data());
+}
+
+// Reads a possibly compressed name at offset and moves offset past it
+bool readName(const QByteArray &packet, int &offset, QString *name)
+{
+    QStringList labels;
+    int pos = offset;
+    int jumps = 0;
+    bool jumped = false;
+    while (true) {
+        if (pos >= packet.size()) {
+            return false;
+        }
+        const quint8 length = packet.at(pos);
+        if ((length & 0xC0) == 0xC0) {
+            if (pos + 1 >= packet.size() || ++jumps > kMaxPointerJumps) {
+                return false;
+            }
+            if (!jumped) {
+                offset = pos + 2;
+                jumped = true;
+            }
+            pos = ((length & 0x3F) << 8) | static_cast<quint8>(packet.at(pos + 1));
+            continue;
+        }
+        if (length & 0xC0) {
+            return false;
+        }
+        if (length == 0) {
+            if (!jumped) {
+                offset = pos + 1;
+            }
+            break;
+        }
+        if (pos + 1 + length > packet.size()) {
+            return false;
+        }
+        if (name) {
+            labels.append(QString::fromLatin1(packet.constData() + pos + 1, length));
+        }
+        pos += 1 + length;
+    }
+
+    if (name) {
+        *name = labels.join('.').toLower();
+    }
+    return true;
+}
+
+QString questionName(const QByteArray &packet)
+{
+    int offset = kHeaderSize;
+    QString name;
+    if (packet.size() < kHeaderSize || readU16(packet, 4) == 0 || !readName(packet, offset, &name)) {
+        return QString();
+    }
+    return name;
+}
+
+// A and AAAA records of the answer section, CNAME chains included
+QList<QHostAddress> answerAddresses(const QByteArray &packet)
+{
+    QList<QHostAddress> addresses;
+    if (packet.size() < kHeaderSize) {
+        return addresses;
+    }
+
+    const int questions = readU16(packet, 4);
+    const int answers = readU16(packet, 6);
+    int offset = kHeaderSize;
+    for (int i = 0; i < questions; ++i) {
+        if (!readName(packet, offset, nullptr)) {
+            return addresses;
+        }
+        offset += 4;
+    }
+
+    for (int i = 0; i < answers; ++i) {
+        if (!readName(packet, offset, nullptr) || offset + 10 > packet.size()) {
+            break;
+        }
+        const quint16 type = readU16(packet, offset);
+        const int length = readU16(packet, offset + 8);
+        offset += 10;
+        if (offset + length > packet.size()) {
+            break;
+        }
+
+        if (type == kTypeA && length == 4) {
+            addresses.append(QHostAddress(qFromBigEndian<quint32>(packet.constData() + offset)));
+        } else if (type == kTypeAAAA && length == 16) {
+            addresses.append(QHostAddress(reinterpret_cast<const quint8 *>(packet.constData() + offset)));
+        }
+        offset += length;
+    }
+    return addresses;
+}
+
+int runIptables(const QStringList &args)
+{
+    QProcess p;
+    p.setProcessChannelMode(QProcess::MergedChannels);
+    p.start("iptables", args);
+    if (!p.waitForFinished() || p.exitStatus() != QProcess::NormalExit) {
+        qDebug().noquote() << "iptables" << args.join(' ') << "failed to run";
+        return -1;
+    }
+    return p.exitCode();
+}
+}
+
+void DomainSuffixTrie::clear()
+{
+    m_nodes = { Node() };
+}
+
+void DomainSuffixTrie::insert(const QString &pattern)
+{
+    QString name = pattern.trimmed().toLower();
+    if (name.endsWith('.')) {
+        name.chop(1);
+    }
+    const bool wildcard = name.startsWith("*.");
+    if (wildcard) {
+        name.remove(0, 2);
+    }
+    if (name.isEmpty()) {
+        return;
+    }
+
+    int node = 0;
+    const QStringList labels = name.split('.', Qt::SkipEmptyParts);
+    for (auto label = labels.crbegin(); label != labels.crend(); ++label) {
+        const auto child = m_nodes.at(node).children.constFind(*label);
+        if (child != m_nodes.at(node).children.constEnd()) {
+            node = *child;
+            continue;
+        }
+        m_nodes.append(Node());
+        m_nodes[node].children.insert(*label, m_nodes.size() - 1);
+        node = m_nodes.size() - 1;
+    }
+
+    if (wildcard) {
+        m_nodes[node].wildcard = true;
+    } else {
+        m_nodes[node].exact = true;
+    }
+}
+
+bool DomainSuffixTrie::matches(const QString &hostname) const
+{
+    const QStringList labels = hostname.split('.', Qt::SkipEmptyParts);
+    int node = 0;
+    for (int i = labels.size() - 1; i >= 0; --i) {
+        const auto child = m_nodes.at(node).children.constFind(labels.at(i));
+        if (child == m_nodes.at(node).children.constEnd()) {
+            return false;
+        }
+        node = *child;
+        if (i > 0 && m_nodes.at(node).wildcard) {
+            return true;
+        }
+    }
+    return node != 0 && m_nodes.at(node).exact;
+}
+
+DnsInterceptorLinux &DnsInterceptorLinux::Instance()
+{
+    static DnsInterceptorLinux s;
+    return s;
+}
+
+DnsInterceptorLinux::DnsInterceptorLinux()
+{
+    m_clock.start();
+    m_expireTimer.setInterval(kQueryTimeoutMsec / 2);
+    connect(&m_expireTimer, &QTimer::timeout, this, &DnsInterceptorLinux::expireQueries);
+}
+
+bool DnsInterceptorLinux::start(const QJsonObject &config)
+{
+    m_gateway = config.value("gateway").toString();
+    m_splitTunnelType = config.value(amnezia::config_key::splitTunnelType).toInt();
+    m_upstreams.clear();
+    for (const QJsonValue &upstream : config.value("upstreams").toArray()) {
+        const QHostAddress address(upstream.toString());
+        // Queries leave through a single IPv4 socket
+        if (address.protocol() == QAbstractSocket::IPv4Protocol && !address.isLoopback()) {
+            m_upstreams.append(address);
+        }
+    }
+    m_sites.clear();
+    for (const QJsonValue &site : config.value(amnezia::config_key::splitTunnelSites).toArray()) {
+        m_sites.insert(site.toString());
+    }
+
+    if (m_upstreams.isEmpty() || m_gateway.isEmpty()) {
+        qWarning() << "DnsInterceptor: no upstream resolvers or gateway given";
+        stop();
+        return false;
+    }
+    if (isRunning()) {
+        return true;
+    }
+
+    m_listenSocket = new QUdpSocket(this);
+    m_upstreamSocket = new QUdpSocket(this);
+    const int mark = kSocketMark;
+    if (!m_listenSocket->bind(QHostAddress::LocalHost, kListenPort)
+        || !m_upstreamSocket->bind(QHostAddress::AnyIPv4, 0)
+        || setsockopt(m_upstreamSocket->socketDescriptor(), SOL_SOCKET, SO_MARK, &mark, sizeof(mark)) != 0) {
+        qWarning() << "DnsInterceptor: failed to set up sockets" << m_listenSocket->errorString();
+        stop();
+        return false;
+    }
+    connect(m_listenSocket, &QUdpSocket::readyRead, this, &DnsInterceptorLinux::onQueriesReady);
+    connect(m_upstreamSocket, &QUdpSocket::readyRead, this, &DnsInterceptorLinux::onAnswersReady);
+
+    if (!setRedirect(true)) {
+        stop();
+        return false;
+    }
+    m_expireTimer.start();
+
+    // Cached answers would never pass through here
+    RouterLinux::Instance().flushDns();
+    qDebug() << "DnsInterceptor: started, forwarding to" << m_upstreams;
+    return true;
+}
+
+// Also removes a redirect some earlier instance may have left behind
+void DnsInterceptorLinux::stop()
+{
+    setRedirect(false);
+    m_expireTimer.stop();
+    delete m_listenSocket;
+    m_listenSocket = nullptr;
+    delete m_upstreamSocket;
+    m_upstreamSocket = nullptr;
+    m_pending.clear();
+    m_routedIps.clear();
+}
+
+bool DnsInterceptorLinux::setRedirect(bool enabled)
+{
+    // Queries to local resolvers (e.g. the systemd-resolved stub) are left
+    // alone, the resolver's own upstream queries are caught instead
+    const QStringList rule = { "OUTPUT", "-p", "udp", "--dport", "53", "!", "-d", "127.0.0.0/8",
+                               "-m", "mark", "!", "--mark", QString::number(kSocketMark),
+                               "-j", "REDIRECT", "--to-ports", QString::number(kListenPort) };
+
+    // Drop whatever a previous instance may have left behind
+    while (runIptables(QStringList { "-w", "-t", "nat", "-D" } + rule) == 0) { }
+    if (!enabled) {
+        return true;
+    }
+    if (runIptables(QStringList { "-w", "-t", "nat", "-I" } + rule) != 0) {
+        qWarning() << "DnsInterceptor: failed to redirect DNS queries";
+        return false;
+    }
+    return true;
+}
+
+void DnsInterceptorLinux::onQueriesReady()
+{
+    while (m_listenSocket && m_listenSocket->hasPendingDatagrams()) {
+        const QNetworkDatagram datagram = m_listenSocket->receiveDatagram();
+        if (datagram.data().size() < kHeaderSize || m_pending.size() >= kMaxPendingQueries) {
+            continue;
+        }
+
+        PendingQuery query;
+        query.packet = datagram.data();
+        query.clientId = readU16(query.packet, 0);
+        query.clientAddress = datagram.senderAddress();
+        query.clientPort = datagram.senderPort();
+        query.matched = m_sites.matches(questionName(query.packet));
+
+        // Queries of different clients may share an id, give each its own.
+        // Random, so that an off-path spoofer can't guess the next one.
+        quint16 id;
+        do {
+            id = static_cast<quint16>(QRandomGenerator::system()->bounded(0x10000));
+        } while (m_pending.contains(id));
+        writeId(query.packet, id);
+        forward(id, m_pending.insert(id, query).value());
+    }
+}
+
+void DnsInterceptorLinux::forward(quint16 id, PendingQuery &query)
+{
+    query.sentAt = m_clock.elapsed();
+    const QHostAddress &upstream = m_upstreams.at(query.upstream % m_upstreams.size());
+    if (m_upstreamSocket->writeDatagram(query.packet, upstream, 53) < 0) {
+        qDebug() << "DnsInterceptor: failed to forward query to" << upstream << m_upstreamSocket->errorString();
+        m_pending.remove(id);
+    }
+}
+
+void DnsInterceptorLinux::onAnswersReady()
+{
+    while (m_upstreamSocket && m_upstreamSocket->hasPendingDatagrams()) {
+        const QNetworkDatagram datagram = m_upstreamSocket->receiveDatagram();
+        QByteArray answer = datagram.data();
+        if (answer.size() < kHeaderSize) {
+            continue;
+        }
+
+        const auto it = m_pending.constFind(readU16(answer, 0));
+        if (it == m_pending.constEnd()
+            || datagram.senderAddress() != m_upstreams.at(it->upstream % m_upstreams.size())) {
+            continue;
+        }
+        const PendingQuery query = *it;
+        m_pending.erase(it);
+
+        // The route has to exist before the application gets to connect
+        if (query.matched) {
+            routeAnswer(answer);
+        }
+        writeId(answer, query.clientId);
+        m_listenSocket->writeDatagram(answer, query.clientAddress, query.clientPort);
+    }
+}
+
+void DnsInterceptorLinux::routeAnswer(const QByteArray &answer)
+{
+    const auto family = QHostAddress(m_gateway).protocol();
+    QStringList ips;
+    for (const QHostAddress &address : answerAddresses(answer)) {
+        const QString ip = address.toString();
+        if (address.protocol() == family && !m_routedIps.contains(ip)) {
+            m_routedIps.insert(ip);
+            ips.append(ip);
+        }
+    }
+    if (ips.isEmpty()) {
+        return;
+    }
+
+    RouterLinux::Instance().routeAddList(m_gateway, ips);
+
+    // Keep the kill switch lists in line with the routes, see IpcServer::enableKillSwitch()
+    if (m_splitTunnelType == 1 && LinuxFirewall::isAnchorEnabled(LinuxFirewall::IPv4, QStringLiteral("120.blockNets"))) {
+        LinuxFirewall::addBlockNets(ips);
+    } else if (m_splitTunnelType == 2 && LinuxFirewall::isAnchorEnabled(LinuxFirewall::IPv4, QStringLiteral("110.allowNets"))) {
+        LinuxFirewall::addAllowNets(ips);
+    }
+}
+
+void DnsInterceptorLinux::expireQueries()
+{
+    const qint64 now = m_clock.elapsed();
+    QList<quint16> retries;
+    for (auto it = m_pending.begin(); it != m_pending.end();) {
+        if (now - it->sentAt < kQueryTimeoutMsec) {
+            ++it;
+            continue;
+        }
+        // Each upstream gets one try, the application retries on its own
+        if (++it->upstream >= m_upstreams.size()) {
+            it = m_pending.erase(it);
+            continue;
+        }
+        retries.append(it.key());
+        ++it;
+    }
+
+    for (const quint16 id : std::as_const(retries)) {
+        forward(id, m_pending[id]);
+    }
+}
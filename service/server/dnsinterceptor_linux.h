@@ -0,0 +1,102 @@
+#ifndef DNSINTERCEPTORLINUX_H
+#define DNSINTERCEPTORLINUX_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QHostAddress>
+#include <QJsonObject>
+#include <QList>
+#include <QObject>
+#include <QSet>
+#include <QString>
+#include <QTimer>
+
+class QUdpSocket;
+
+/**
+ * @brief The DomainSuffixTrie class - matches hostnames against the split tunneling sites
+ *
+ * Names are stored label by label starting from the top level domain, so a
+ * lookup costs one step per label of the queried name no matter how many
+ * sites there are. "example.com" matches only that name, "*.example.com"
+ * every name below it.
+ */
+class DomainSuffixTrie
+{
+public:
+    void clear();
+    void insert(const QString &pattern);
+    // hostname must be lower case
+    bool matches(const QString &hostname) const;
+
+private:
+    struct Node {
+        QHash<QString, int> children;
+        bool exact = false;
+        bool wildcard = false;
+    };
+
+    QList<Node> m_nodes { Node() };
+};
+
+/**
+ * @brief The DnsInterceptorLinux class - routes split tunneling sites as they are resolved
+ *
+ * Outgoing DNS queries (UDP port 53) are redirected to a local forwarder,
+ * which passes them on to the upstream resolvers. When a query is for one of
+ * the sites, the addresses in the answer are routed through the configured
+ * gateway, and added to the kill switch lists, before the answer is handed
+ * back to the application. The forwarder's own queries carry a socket mark
+ * that keeps them out of the redirect.
+ */
+class DnsInterceptorLinux : public QObject
+{
+    Q_OBJECT
+public:
+    static DnsInterceptorLinux &Instance();
+
+    // Takes "gateway", "upstreams", splitTunnelType and splitTunnelSites.
+    // Calling it again while running only replaces the settings.
+    bool start(const QJsonObject &config);
+    void stop();
+    bool isRunning() const { return m_listenSocket != nullptr; }
+
+private slots:
+    void onQueriesReady();
+    void onAnswersReady();
+    void expireQueries();
+
+private:
+    struct PendingQuery {
+        QByteArray packet;
+        quint16 clientId = 0;
+        QHostAddress clientAddress;
+        quint16 clientPort = 0;
+        bool matched = false;
+        int upstream = 0;
+        qint64 sentAt = 0;
+    };
+
+    DnsInterceptorLinux();
+    DnsInterceptorLinux(DnsInterceptorLinux const &) = delete;
+    DnsInterceptorLinux& operator= (DnsInterceptorLinux const&) = delete;
+
+    bool setRedirect(bool enabled);
+    void forward(quint16 id, PendingQuery &query);
+    void routeAnswer(const QByteArray &answer);
+
+    DomainSuffixTrie m_sites;
+    QList<QHostAddress> m_upstreams;
+    QString m_gateway;
+    int m_splitTunnelType = 0;
+    // Addresses routed since start(), answers repeat them all the time
+    QSet<QString> m_routedIps;
+
+    QUdpSocket *m_listenSocket = nullptr;
+    QUdpSocket *m_upstreamSocket = nullptr;
+    QHash<quint16, PendingQuery> m_pending;
+    QElapsedTimer m_clock;
+    QTimer m_expireTimer;
+};
+
+#endif // DNSINTERCEPTORLINUX_H
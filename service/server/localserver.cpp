@@ -14,6 +14,11 @@
 #include "tapcontroller_win.h"
 #endif
 
+#ifdef Q_OS_LINUX
+#include "dnsinterceptor_linux.h"
+#include "../client/platforms/linux/daemon/linuxfirewall.h"
+#endif
+
 namespace {
 Logger logger("WgDaemonServer");
 }
@@ -47,9 +52,18 @@ LocalServer::LocalServer(QObject *parent) : QObject(parent),
     }
 
 #ifdef Q_OS_LINUX
+    // A redirect left behind by a crashed instance sends every DNS query
+    // to a port nobody listens on
+    DnsInterceptorLinux::Instance().stop();
+
     // Signal handling for a proper shutdown.
-    QObject::connect(qApp, &QCoreApplication::aboutToQuit,
-                     []() { LinuxDaemon::instance()->deactivate(); });
+    QObject::connect(qApp, &QCoreApplication::aboutToQuit, []() {
+        DnsInterceptorLinux::Instance().stop();
+        LinuxDaemon::instance()->deactivate();
+        // The kill switch chains are staged on the first connection and
+        // must not outlive the service
+        LinuxFirewall::uninstall();
+    });
 #endif
 
 #ifdef Q_OS_MAC
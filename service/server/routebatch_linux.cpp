@@ -0,0 +1,346 @@
+#include "routebatch_linux.h"
+
+#include <QDateTime>
+#include <QDebug>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace {
+// Upper bound for a single sendmsg, roughly 1000 IPv4 routes
+constexpr int kMaxBatchSize = 64 * 1024;
+constexpr int kRecvBufferSize = 4 * 1024 * 1024;
+constexpr int kAckTimeoutSec = 5;
+constexpr int kPending = -1;
+
+struct Address {
+    int family = AF_UNSPEC;
+    int size = 0;
+    int prefix = 0;
+    unsigned char data[16] = {};
+};
+
+bool parseAddress(const QString &str, Address &addr)
+{
+    const QByteArray ip = str.section('/', 0, 0).trimmed().toLatin1();
+    if (inet_pton(AF_INET, ip.constData(), addr.data) == 1) {
+        addr.family = AF_INET;
+        addr.size = 4;
+    } else if (inet_pton(AF_INET6, ip.constData(), addr.data) == 1) {
+        addr.family = AF_INET6;
+        addr.size = 16;
+    } else {
+        return false;
+    }
+
+    addr.prefix = addr.size * 8;
+    if (str.contains('/')) {
+        bool ok = false;
+        const int prefix = str.section('/', 1, 1).toInt(&ok);
+        if (!ok || prefix < 0 || prefix > addr.prefix) {
+            return false;
+        }
+        addr.prefix = prefix;
+    }
+
+    // The kernel rejects destinations with host bits set
+    for (int i = 0; i < addr.size; ++i) {
+        const int bits = qBound(0, addr.prefix - i * 8, 8);
+        addr.data[i] &= static_cast<unsigned char>(0xFF << (8 - bits));
+    }
+    return true;
+}
+
+QString formatAddress(int family, const void *data, int prefix)
+{
+    char buf[INET6_ADDRSTRLEN];
+    if (!inet_ntop(family, data, buf, sizeof(buf))) {
+        return QString();
+    }
+    return QString("%1/%2").arg(QLatin1String(buf)).arg(prefix);
+}
+
+void appendAttr(QByteArray &msg, int type, const void *data, int len)
+{
+    struct rtattr attr;
+    attr.rta_type = type;
+    attr.rta_len = RTA_LENGTH(len);
+    msg.append(reinterpret_cast<const char *>(&attr), RTA_LENGTH(0));
+    msg.append(reinterpret_cast<const char *>(data), len);
+    msg.append(RTA_ALIGN(len) - len, '\0');
+}
+}
+
+RouteBatchLinux::RouteBatchLinux()
+{
+    m_fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (m_fd < 0) {
+        qCritical().noquote() << "RouteBatchLinux: failed to open netlink socket:" << strerror(errno);
+        return;
+    }
+
+    // A full batch produces one ACK per message, make sure they all fit
+    int rcvbuf = kRecvBufferSize;
+    if (setsockopt(m_fd, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)) < 0) {
+        setsockopt(m_fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    }
+#ifdef NETLINK_CAP_ACK
+    // Don't echo the whole request back in every ACK
+    int one = 1;
+    setsockopt(m_fd, SOL_NETLINK, NETLINK_CAP_ACK, &one, sizeof(one));
+#endif
+    struct timeval timeout = { kAckTimeoutSec, 0 };
+    setsockopt(m_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    struct sockaddr_nl addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    if (bind(m_fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0) {
+        qCritical().noquote() << "RouteBatchLinux: failed to bind netlink socket:" << strerror(errno);
+        close(m_fd);
+        m_fd = -1;
+        return;
+    }
+
+    m_seq = static_cast<quint32>(QDateTime::currentMSecsSinceEpoch());
+    m_firstSeq = m_seq + 1;
+}
+
+RouteBatchLinux::~RouteBatchLinux()
+{
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+bool RouteBatchLinux::add(const QString &dst, const QString &gw, int table)
+{
+    return queue(RTM_NEWROUTE, dst, gw, table);
+}
+
+bool RouteBatchLinux::remove(const QString &dst, const QString &gw, int table)
+{
+    return queue(RTM_DELROUTE, dst, gw, table);
+}
+
+bool RouteBatchLinux::queue(int type, const QString &dst, const QString &gw, int table)
+{
+    Address dstAddr;
+    if (!parseAddress(dst, dstAddr)) {
+        return false;
+    }
+    Address gwAddr;
+    if (!gw.isEmpty() && (!parseAddress(gw, gwAddr) || gwAddr.family != dstAddr.family)) {
+        return false;
+    }
+    if (table <= 0) {
+        table = RT_TABLE_MAIN;
+    }
+
+    QByteArray msg;
+    msg.reserve(NLMSG_SPACE(sizeof(struct rtmsg)) + 3 * RTA_SPACE(16));
+    msg.resize(NLMSG_SPACE(sizeof(struct rtmsg)));
+    msg.fill('\0');
+
+    struct rtmsg *rtm = reinterpret_cast<struct rtmsg *>(msg.data() + NLMSG_HDRLEN);
+    rtm->rtm_family = dstAddr.family;
+    rtm->rtm_dst_len = dstAddr.prefix;
+    rtm->rtm_table = table < 256 ? table : RT_TABLE_UNSPEC;
+    rtm->rtm_protocol = RTPROT_BOOT;
+    rtm->rtm_scope = type == RTM_NEWROUTE ? RT_SCOPE_UNIVERSE : RT_SCOPE_NOWHERE;
+    rtm->rtm_type = RTN_UNICAST;
+
+    appendAttr(msg, RTA_DST, dstAddr.data, dstAddr.size);
+    if (gwAddr.family != AF_UNSPEC) {
+        appendAttr(msg, RTA_GATEWAY, gwAddr.data, gwAddr.size);
+    }
+    if (table >= 256) {
+        const quint32 tableId = table;
+        appendAttr(msg, RTA_TABLE, &tableId, sizeof(tableId));
+    }
+
+    struct nlmsghdr *nlmsg = reinterpret_cast<struct nlmsghdr *>(msg.data());
+    nlmsg->nlmsg_len = msg.size();
+    nlmsg->nlmsg_type = type;
+    // Refuse to take over an existing route, so we never delete one we don't own
+    nlmsg->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+    if (type == RTM_NEWROUTE) {
+        nlmsg->nlmsg_flags |= NLM_F_CREATE | NLM_F_EXCL;
+    }
+    nlmsg->nlmsg_seq = ++m_seq;
+
+    if (m_batches.isEmpty() || m_batches.last().payload.size() + msg.size() > kMaxBatchSize) {
+        m_batches.append(Batch());
+        m_batches.last().payload.reserve(kMaxBatchSize);
+    }
+    m_batches.last().payload.append(msg);
+    m_batches.last().count++;
+    m_count++;
+    return true;
+}
+
+QList<int> RouteBatchLinux::commit()
+{
+    QList<int> results(m_count, kPending);
+    if (!isValid()) {
+        results.fill(EBADF);
+    } else {
+        for (const Batch &batch : std::as_const(m_batches)) {
+            sendBatch(batch, results);
+        }
+    }
+
+    for (int &result : results) {
+        if (result == kPending) {
+            result = ETIMEDOUT;
+        }
+    }
+
+    m_batches.clear();
+    m_count = 0;
+    m_firstSeq = m_seq + 1;
+    return results;
+}
+
+bool RouteBatchLinux::dump(int table, QHash<QString, QString> &routes)
+{
+    Q_ASSERT(m_count == 0);
+    if (!isValid()) {
+        return false;
+    }
+
+    struct {
+        struct nlmsghdr nh;
+        struct rtmsg rtm;
+    } req;
+    memset(&req, 0, sizeof(req));
+    req.nh.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+    req.nh.nlmsg_type = RTM_GETROUTE;
+    req.nh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.nh.nlmsg_seq = ++m_seq;
+    req.rtm.rtm_family = AF_UNSPEC;
+    m_firstSeq = m_seq + 1;
+
+    if (send(m_fd, &req, req.nh.nlmsg_len, 0) < 0) {
+        qCritical().noquote() << "RouteBatchLinux: route dump failed:" << strerror(errno);
+        return false;
+    }
+
+    char buf[32 * 1024];
+    for (;;) {
+        const ssize_t len = recv(m_fd, buf, sizeof(buf), 0);
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            qWarning().noquote() << "RouteBatchLinux: reading route dump failed:" << strerror(errno);
+            return false;
+        }
+
+        int remaining = static_cast<int>(len);
+        for (struct nlmsghdr *nh = reinterpret_cast<struct nlmsghdr *>(buf); NLMSG_OK(nh, remaining);
+             nh = NLMSG_NEXT(nh, remaining)) {
+            if (nh->nlmsg_seq != req.nh.nlmsg_seq) {
+                continue;
+            }
+            if (nh->nlmsg_type == NLMSG_DONE) {
+                return true;
+            }
+            if (nh->nlmsg_type == NLMSG_ERROR) {
+                const struct nlmsgerr *err = reinterpret_cast<const struct nlmsgerr *>(NLMSG_DATA(nh));
+                qWarning().noquote() << "RouteBatchLinux: route dump failed:" << strerror(-err->error);
+                return false;
+            }
+            if (nh->nlmsg_type != RTM_NEWROUTE) {
+                continue;
+            }
+
+            const struct rtmsg *rtm = reinterpret_cast<const struct rtmsg *>(NLMSG_DATA(nh));
+            if (rtm->rtm_type != RTN_UNICAST || (rtm->rtm_family != AF_INET && rtm->rtm_family != AF_INET6)) {
+                continue;
+            }
+            const int size = rtm->rtm_family == AF_INET ? 4 : 16;
+            unsigned char dst[16] = {};
+            QString gw;
+            int routeTable = rtm->rtm_table;
+            int attrlen = RTM_PAYLOAD(nh);
+            for (const struct rtattr *attr = RTM_RTA(rtm); RTA_OK(attr, attrlen); attr = RTA_NEXT(attr, attrlen)) {
+                if (attr->rta_type == RTA_DST && static_cast<int>(RTA_PAYLOAD(attr)) >= size) {
+                    memcpy(dst, RTA_DATA(attr), size);
+                } else if (attr->rta_type == RTA_GATEWAY && static_cast<int>(RTA_PAYLOAD(attr)) >= size) {
+                    gw = formatAddress(rtm->rtm_family, RTA_DATA(attr), size * 8);
+                } else if (attr->rta_type == RTA_TABLE) {
+                    routeTable = *reinterpret_cast<const quint32 *>(RTA_DATA(attr));
+                }
+            }
+            if (routeTable == table) {
+                routes.insert(formatAddress(rtm->rtm_family, dst, rtm->rtm_dst_len), gw);
+            }
+        }
+    }
+}
+
+QString RouteBatchLinux::canonical(const QString &addr)
+{
+    Address parsed;
+    if (!parseAddress(addr, parsed)) {
+        return QString();
+    }
+    return formatAddress(parsed.family, parsed.data, parsed.prefix);
+}
+
+void RouteBatchLinux::sendBatch(const Batch &batch, QList<int> &results)
+{
+    struct sockaddr_nl kernel;
+    memset(&kernel, 0, sizeof(kernel));
+    kernel.nl_family = AF_NETLINK;
+
+    struct iovec iov = { const_cast<char *>(batch.payload.constData()), static_cast<size_t>(batch.payload.size()) };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &kernel;
+    msg.msg_namelen = sizeof(kernel);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if (sendmsg(m_fd, &msg, 0) < 0) {
+        qCritical().noquote() << "RouteBatchLinux: sendmsg failed:" << strerror(errno);
+        return;
+    }
+
+    char buf[32 * 1024];
+    int pending = batch.count;
+    while (pending > 0) {
+        const ssize_t len = recv(m_fd, buf, sizeof(buf), 0);
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // Timed out or ACKs were dropped; whatever is left stays unconfirmed
+            qWarning().noquote() << "RouteBatchLinux: waiting for ACKs failed:" << strerror(errno) << pending << "left";
+            return;
+        }
+
+        int remaining = static_cast<int>(len);
+        for (struct nlmsghdr *nh = reinterpret_cast<struct nlmsghdr *>(buf); NLMSG_OK(nh, remaining);
+             nh = NLMSG_NEXT(nh, remaining)) {
+            if (nh->nlmsg_type != NLMSG_ERROR) {
+                continue;
+            }
+            const quint32 index = nh->nlmsg_seq - m_firstSeq;
+            if (index >= static_cast<quint32>(results.size()) || results.at(index) != kPending) {
+                continue;
+            }
+            const struct nlmsgerr *err = reinterpret_cast<const struct nlmsgerr *>(NLMSG_DATA(nh));
+            results[index] = -err->error;
+            pending--;
+        }
+    }
+}
@@ -0,0 +1,66 @@
+#ifndef ROUTEBATCHLINUX_H
+#define ROUTEBATCHLINUX_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QString>
+
+/**
+ * @brief The RouteBatchLinux class - programs many routes over one rtnetlink socket
+ *
+ * Routes are encoded into RTM_NEWROUTE / RTM_DELROUTE messages as they are
+ * queued and sent in large batches by commit(). Every message carries its own
+ * sequence number, so kernel ACKs are matched back to the queued route
+ * regardless of how they are split across reads. Both IPv4 and IPv6 are
+ * supported; a route and its gateway must be of the same family.
+ */
+class RouteBatchLinux
+{
+public:
+    RouteBatchLinux();
+    ~RouteBatchLinux();
+
+    bool isValid() const { return m_fd >= 0; }
+
+    // Queue a route, dst is "addr" or "addr/prefix" and table 0 means the main
+    // table. Returns false when the route can't be parsed; it is not queued then.
+    bool add(const QString &dst, const QString &gw, int table = 0);
+    bool remove(const QString &dst, const QString &gw, int table = 0);
+
+    int size() const { return m_count; }
+
+    // Sends all queued messages and waits for their ACKs. Returns one errno
+    // value per queued route, in queue order (0 on success), and empties the
+    // queue.
+    QList<int> commit();
+
+    // Reads the unicast routes of one table from the kernel into routes, as
+    // canonical destination -> canonical gateway (see canonical()). Must not
+    // be called while routes are queued.
+    bool dump(int table, QHash<QString, QString> &routes);
+
+    // "addr" or "addr/prefix" as "addr/prefix" with the host bits cleared, so
+    // that routes can be compared with what dump() returns. Empty if invalid.
+    static QString canonical(const QString &addr);
+
+private:
+    struct Batch {
+        QByteArray payload;
+        int count = 0;
+    };
+
+    RouteBatchLinux(RouteBatchLinux const &) = delete;
+    RouteBatchLinux& operator= (RouteBatchLinux const&) = delete;
+
+    bool queue(int type, const QString &dst, const QString &gw, int table);
+    void sendBatch(const Batch &batch, QList<int> &results);
+
+    int m_fd = -1;
+    quint32 m_seq = 0;
+    quint32 m_firstSeq = 0;
+    int m_count = 0;
+    QList<Batch> m_batches;
+};
+
+#endif // ROUTEBATCHLINUX_H
@@ -9,14 +9,18 @@
 #endif
 
 
-int Router::routeAddList(const QString &gw, const QStringList &ips)
+int Router::routeAddList(const QString &gw, const QStringList &ips, QStringList *failed, QStringList *existing)
 {
 #ifdef Q_OS_WIN
+    Q_UNUSED(failed)
+    Q_UNUSED(existing)
     return RouterWin::Instance().routeAddList(gw, ips);
 #elif defined (Q_OS_MAC)
+    Q_UNUSED(failed)
+    Q_UNUSED(existing)
     return RouterMac::Instance().routeAddList(gw, ips);
 #elif defined Q_OS_LINUX
-    return RouterLinux::Instance().routeAddList(gw, ips);
+    return RouterLinux::Instance().routeAddList(gw, ips, failed, existing);
 #endif
 }
 
@@ -31,14 +35,16 @@ bool Router::clearSavedRoutes()
 #endif
 }
 
-int Router::routeDeleteList(const QString &gw, const QStringList &ips)
+int Router::routeDeleteList(const QString &gw, const QStringList &ips, QStringList *failed)
 {
 #ifdef Q_OS_WIN
+    Q_UNUSED(failed)
     return RouterWin::Instance().routeDeleteList(gw, ips);
 #elif defined (Q_OS_MAC)
+    Q_UNUSED(failed)
     return RouterMac::Instance().routeDeleteList(gw, ips);
 #elif defined Q_OS_LINUX
-    return RouterLinux::Instance().routeDeleteList(gw, ips);
+    return RouterLinux::Instance().routeDeleteList(gw, ips, failed);
 #endif
 }
 
@@ -16,9 +16,13 @@ class Router : public QObject
 {
     Q_OBJECT
 public:
-    static int routeAddList(const QString &gw, const QStringList &ips);
+    // Routes that could not be changed are appended to failed, and routes
+    // that were already in place to existing, where the platform reports
+    // them one by one
+    static int routeAddList(const QString &gw, const QStringList &ips, QStringList *failed = nullptr,
+                            QStringList *existing = nullptr);
     static bool clearSavedRoutes();
-    static int routeDeleteList(const QString &gw, const QStringList &ips);
+    static int routeDeleteList(const QString &gw, const QStringList &ips, QStringList *failed = nullptr);
     static void flushDns();
     static void resetIpStack();
     static bool createTun(const QString &dev, const QString &subnet);
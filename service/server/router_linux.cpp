@@ -1,5 +1,9 @@
 #include "router_linux.h"
+#include "routebatch_linux.h"
 
+#include <QDBusConnection>
+#include <QDBusMessage>
+#include <QElapsedTimer>
 #include <QProcess>
 #include <QThread>
 #include <utilities.h>
@@ -17,6 +21,7 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <QFileInfo>
 
@@ -28,145 +33,392 @@ RouterLinux &RouterLinux::Instance()
     return s;
 }
 
-bool RouterLinux::routeAdd(const QString &ipWithSubnet, const QString &gw, const int &sock)
+namespace {
+// Split tunnel routes live in their own table, selected by a rule placed
+// right after the traffic splitting fwmark rule (priority 100). Tearing
+// them down only detaches the table, reconnects reconcile its contents
+// before attaching it again.
+constexpr int kSplitTunnelTable = 8301;
+constexpr int kSplitTunnelRulePriority = 102;
+// Ahead of the table, main is consulted for everything but the default route
+// and its catch-all halves, so LAN, link and other specific routes of the
+// system keep winning over a wider site prefix
+constexpr int kMainGuardRulePriority = 101;
+constexpr int kMainGuardSuppressedLength = 1;
+// Flush requests arriving within this window result in one flush
+constexpr int kFlushDnsDelayMsec = 300;
+constexpr int kFlushDnsTimeoutMsec = 2000;
+
+struct QueuedRoute {
+    QString dst;
+    bool add;
+    bool mainTable;
+    // As the caller asked for it, set for additions
+    QString ip = {};
+};
+
+int prefixLength(const QString &ip)
 {
-    QString ip = NetworkUtilities::ipAddressFromIpWithSubnet(ipWithSubnet);
-    QString mask = NetworkUtilities::netMaskFromIpWithSubnet(ipWithSubnet);
+    if (!ip.contains('/')) {
+        return ip.contains(':') ? 128 : 32;
+    }
+    return ip.section('/', 1, 1).toInt();
+}
 
-    if (!NetworkUtilities::checkIPv4Format(ip) || !NetworkUtilities::checkIPv4Format(gw)) {
-        qCritical().noquote() << "Critical, trying to add invalid route: " << ip << gw;
-        return false;
+// Catch-all halves of the default route (0.0.0.0/1, 128.0.0.0/1) must stay in
+// the main table where the rest of the system's routing decisions are made.
+bool isMainTableRoute(const QString &ip)
+{
+    return prefixLength(ip) <= 1;
+}
+
+int runIp(const QStringList &args)
+{
+    QProcess p;
+    p.setProcessChannelMode(QProcess::MergedChannels);
+    p.start("ip", args);
+    if (!p.waitForFinished() || p.exitStatus() != QProcess::NormalExit) {
+        qDebug().noquote() << "ip" << args.join(' ') << "failed to run";
+        return -1;
     }
+    return p.exitCode();
+}
 
-    struct rtentry route;
-    memset(&route, 0, sizeof( route ));
+// Selectors of the split tunnel rules, in lookup order
+QList<QStringList> splitTunnelRules()
+{
+    return {
+        { "priority", QString::number(kMainGuardRulePriority), "lookup", "main",
+          "suppress_prefixlength", QString::number(kMainGuardSuppressedLength) },
+        { "priority", QString::number(kSplitTunnelRulePriority), "lookup", QString::number(kSplitTunnelTable) },
+    };
+}
+}
 
-    // set gateway
-    ((struct sockaddr_in *)&route.rt_gateway)->sin_family = AF_INET;
-    ((struct sockaddr_in *)&route.rt_gateway)->sin_addr.s_addr = inet_addr(gw.toStdString().c_str());
-    ((struct sockaddr_in *)&route.rt_gateway)->sin_port = 0;
-    // set host rejecting
-    ((struct sockaddr_in *)&route.rt_dst)->sin_family = AF_INET;
-    ((struct sockaddr_in *)&route.rt_dst)->sin_addr.s_addr = inet_addr(ip.toStdString().c_str());
-    ((struct sockaddr_in *)&route.rt_dst)->sin_port = 0;
-    // set mask
-    ((struct sockaddr_in *)&route.rt_genmask)->sin_family = AF_INET;
-    ((struct sockaddr_in *)&route.rt_genmask)->sin_addr.s_addr = inet_addr(mask.toStdString().c_str());
-    ((struct sockaddr_in *)&route.rt_genmask)->sin_port = 0;
+RouterLinux::RouterLinux()
+{
+    m_dnsUtil = new DnsUtilsLinux(this);
 
-    route.rt_flags = RTF_UP | RTF_GATEWAY;
-    route.rt_metric = 0;
+    m_flushDnsTimer.setSingleShot(true);
+    m_flushDnsTimer.setInterval(kFlushDnsDelayMsec);
+    connect(&m_flushDnsTimer, &QTimer::timeout, this, &RouterLinux::flushDnsNow);
+}
 
-    if (int err = ioctl(sock, SIOCADDRT, &route) < 0)
-    {
-        qDebug().noquote() << "route add error: gw "
-                           << ((struct sockaddr_in *)&route.rt_gateway)->sin_addr.s_addr
-                           << " ip " << ((struct sockaddr_in *)&route.rt_dst)->sin_addr.s_addr
-                           << " mask " << ((struct sockaddr_in *)&route.rt_genmask)->sin_addr.s_addr << " " << err;
-        return false;
+// The table is kept between connections. Routes the new connection asks for
+// again are reused as they are. Nothing looks the table up until
+// installSplitTunnelRule() has pruned the rest.
+void RouterLinux::loadSplitTunnelTable()
+{
+    if (m_splitTunnelTableLoaded) {
+        return;
     }
 
-    m_addedRoutes.append({ipWithSubnet, gw});
-    return true;
+    const QString table = QString::number(kSplitTunnelTable);
+    for (const QString &family : { QStringLiteral("-4"), QStringLiteral("-6") }) {
+        // Drop whatever a previous instance may have left behind
+        for (const QStringList &rule : splitTunnelRules()) {
+            while (runIp(QStringList { family, "rule", "del" } + rule) == 0) { }
+        }
+    }
+
+    m_tableRoutes.clear();
+    m_desiredRoutes.clear();
+    RouteBatchLinux batch;
+    if (!batch.dump(kSplitTunnelTable, m_tableRoutes)) {
+        m_tableRoutes.clear();
+        runIp({ "-4", "route", "flush", "table", table });
+        runIp({ "-6", "route", "flush", "table", table });
+    }
+    qDebug().noquote() << "RouterLinux: split tunnel table holds" << m_tableRoutes.size() << "routes";
+
+    m_splitTunnelTableLoaded = true;
 }
 
-int RouterLinux::routeAddList(const QString &gw, const QStringList &ips)
+void RouterLinux::installSplitTunnelRule()
 {
-    int temp_sock = socket(AF_INET, SOCK_DGRAM,  IPPROTO_IP);
-    int cnt = 0;
-    for (const QString &ip: ips) {
-        if (routeAdd(ip, gw, temp_sock)) cnt++;
+    if (m_splitTunnelRuleInstalled) {
+        return;
     }
-    close(temp_sock);
-    return cnt;
+
+    // Routes of a previous connection must never be looked up by this one
+    pruneStaleRoutes();
+
+    for (const QString &family : { QStringLiteral("-4"), QStringLiteral("-6") }) {
+        for (const QStringList &rule : splitTunnelRules()) {
+            runIp(QStringList { family, "rule", "add" } + rule);
+        }
+    }
+
+    m_splitTunnelRuleInstalled = true;
 }
 
-bool RouterLinux::clearSavedRoutes()
+// Detaches the table without flushing it, so that the next connection can
+// pick its routes up again.
+void RouterLinux::removeSplitTunnelRule()
 {
-    int temp_sock = socket(AF_INET, SOCK_DGRAM,  IPPROTO_IP);
-    int cnt = 0;
-    for (const Route &r: m_addedRoutes) {
-        if (routeDelete(r.dst, r.gw, temp_sock)) cnt++;
+    m_splitTunnelTableLoaded = false;
+    if (!m_splitTunnelRuleInstalled) {
+        return;
     }
-    bool ret = (cnt == m_addedRoutes.count());
-    m_addedRoutes.clear();
-    close(temp_sock);
-    return ret;
+
+    for (const QString &family : { QStringLiteral("-4"), QStringLiteral("-6") }) {
+        for (const QStringList &rule : splitTunnelRules()) {
+            runIp(QStringList { family, "rule", "del" } + rule);
+        }
+    }
+    m_splitTunnelRuleInstalled = false;
 }
 
-bool RouterLinux::routeDelete(const QString &ipWithSubnet, const QString &gw, const int &sock)
+// Removes the table routes the current connection has not asked for
+void RouterLinux::pruneStaleRoutes()
 {
-#ifdef MZ_DEBUG
-    qDebug().noquote() << "RouterLinux::routeDelete: " << ipWithSubnet << gw;
-#endif
+    QElapsedTimer timer;
+    timer.start();
+
+    RouteBatchLinux batch;
+    QStringList queued;
+    for (auto it = m_tableRoutes.cbegin(); it != m_tableRoutes.cend(); ++it) {
+        if (!m_desiredRoutes.contains(it.key()) && batch.remove(it.key(), it.value(), kSplitTunnelTable)) {
+            queued.append(it.key());
+        }
+    }
+    if (queued.isEmpty()) {
+        return;
+    }
+
+    const QList<int> results = batch.commit();
+    for (int i = 0; i < results.size(); ++i) {
+        if (results.at(i) == 0 || results.at(i) == ESRCH) {
+            m_tableRoutes.remove(queued.at(i));
+        } else {
+            qDebug().noquote() << "stale route delete error: ip " << queued.at(i) << " " << strerror(results.at(i));
+        }
+    }
 
-    QString ip = NetworkUtilities::ipAddressFromIpWithSubnet(ipWithSubnet);
-    QString mask = NetworkUtilities::netMaskFromIpWithSubnet(ipWithSubnet);
+    qDebug().noquote() << QString("RouterLinux::pruneStaleRoutes: removed %1 stale routes in %2 ms")
+                              .arg(queued.size()).arg(timer.elapsed());
+}
 
-    if (!NetworkUtilities::checkIPv4Format(ip) || !NetworkUtilities::checkIPv4Format(gw)) {
-        qCritical().noquote() << "Critical, trying to remove invalid route: " << ip << gw;
-        return false;
+int RouterLinux::routeAddList(const QString &gw, const QStringList &ips, QStringList *failed, QStringList *existing)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    const QString gwKey = RouteBatchLinux::canonical(gw);
+    RouteBatchLinux batch;
+    QList<QueuedRoute> queued;
+    QSet<QString> queuedTableRoutes;
+    int cnt = 0;
+    int reused = 0;
+    for (const QString &ip: ips) {
+        if (isMainTableRoute(ip)) {
+            if (batch.add(ip, gw)) {
+                queued.append({ip, true, true, ip});
+            } else {
+                qCritical().noquote() << "Critical, trying to add invalid route: " << ip << gw;
+                if (failed) {
+                    failed->append(ip);
+                }
+            }
+            continue;
+        }
+
+        loadSplitTunnelTable();
+        const QString dst = RouteBatchLinux::canonical(ip);
+        if (dst.isEmpty()) {
+            qCritical().noquote() << "Critical, trying to add invalid route: " << ip << gw;
+            if (failed) {
+                failed->append(ip);
+            }
+            continue;
+        }
+        m_desiredRoutes.insert(dst);
+        if (queuedTableRoutes.contains(dst)) {
+            continue;
+        }
+
+        // Only touch the kernel for routes that are missing or point elsewhere
+        const auto current = m_tableRoutes.constFind(dst);
+        if (current != m_tableRoutes.cend()) {
+            if (current.value() == gwKey) {
+                // Kept from a previous connection, not ours to roll back
+                if (existing) {
+                    existing->append(ip);
+                }
+                reused++;
+                cnt++;
+                continue;
+            }
+            if (batch.remove(dst, current.value(), kSplitTunnelTable)) {
+                queued.append({dst, false, false});
+            }
+        }
+        if (batch.add(dst, gw, kSplitTunnelTable)) {
+            queued.append({dst, true, false, ip});
+            queuedTableRoutes.insert(dst);
+        } else {
+            qCritical().noquote() << "Critical, trying to add invalid route: " << ip << gw;
+            if (failed) {
+                failed->append(ip);
+            }
+        }
     }
 
-    if (ipWithSubnet == "0.0.0.0/0") {
-        qDebug().noquote() << "Warning, trying to remove default route, skipping: " << ip << gw;
-        return true;
+    const QList<int> results = batch.commit();
+    for (int i = 0; i < results.size(); ++i) {
+        const QueuedRoute &route = queued.at(i);
+        if (!route.add) {
+            if (results.at(i) == 0 || results.at(i) == ESRCH) {
+                m_tableRoutes.remove(route.dst);
+            }
+            continue;
+        }
+        if (results.at(i) == 0) {
+            // Table routes are tracked by the table state, only track the others
+            if (route.mainTable) {
+                m_addedRoutes.append({route.dst, gw});
+            } else {
+                m_tableRoutes.insert(route.dst, gwKey);
+            }
+            cnt++;
+        } else if (results.at(i) == EEXIST) {
+            // Someone else's route, left alone and not tracked
+            qDebug().noquote() << "route already present: gw " << gw << " ip " << route.dst;
+            if (existing) {
+                existing->append(route.ip);
+            }
+        } else {
+            qDebug().noquote() << "route add error: gw " << gw << " ip " << route.dst << " " << strerror(results.at(i));
+            if (failed) {
+                failed->append(route.ip);
+            }
+        }
     }
 
-    struct rtentry route;
-    memset(&route, 0, sizeof( route ));
+    if (m_splitTunnelTableLoaded) {
+        installSplitTunnelRule();
+    }
 
-    // set gateway
-    ((struct sockaddr_in *)&route.rt_gateway)->sin_family = AF_INET;
-    ((struct sockaddr_in *)&route.rt_gateway)->sin_addr.s_addr = inet_addr(gw.toStdString().c_str());
-    ((struct sockaddr_in *)&route.rt_gateway)->sin_port = 0;
-    // set host rejecting
-    ((struct sockaddr_in *)&route.rt_dst)->sin_family = AF_INET;
-    ((struct sockaddr_in *)&route.rt_dst)->sin_addr.s_addr = inet_addr(ip.toStdString().c_str());
-    ((struct sockaddr_in *)&route.rt_dst)->sin_port = 0;
-    // set mask
-    ((struct sockaddr_in *)&route.rt_genmask)->sin_family = AF_INET;
-    ((struct sockaddr_in *)&route.rt_genmask)->sin_addr.s_addr = inet_addr(mask.toStdString().c_str());
-    ((struct sockaddr_in *)&route.rt_genmask)->sin_port = 0;
+    qDebug().noquote() << QString("RouterLinux::routeAddList: added %1 of %2 routes (%3 already in place) in %4 ms")
+                              .arg(cnt).arg(ips.size()).arg(reused).arg(timer.elapsed());
+    return cnt;
+}
 
-    route.rt_flags = RTF_UP | RTF_GATEWAY;
-    route.rt_metric = 0;
-    //route.rt_dev = "ens33";
+bool RouterLinux::clearSavedRoutes()
+{
+    RouteBatchLinux batch;
+    for (const Route &r: m_addedRoutes) {
+        batch.remove(r.dst, r.gw);
+    }
 
-    if (ioctl(sock, SIOCDELRT, &route) < 0)
-    {
-        qDebug().noquote() << "route delete error: gw " << gw << " ip " << ip << " mask " << mask;
-        return false;
+    int cnt = 0;
+    for (int result : batch.commit()) {
+        if (result == 0) cnt++;
     }
-    return true;
+    bool ret = (cnt == m_addedRoutes.count());
+    m_addedRoutes.clear();
+
+    removeSplitTunnelRule();
+    return ret;
 }
 
-bool RouterLinux::routeDeleteList(const QString &gw, const QStringList &ips)
+int RouterLinux::routeDeleteList(const QString &gw, const QStringList &ips, QStringList *failed)
 {
-    int temp_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
-    int cnt = 0;
+    QElapsedTimer timer;
+    timer.start();
+
+    RouteBatchLinux batch;
+    QList<QueuedRoute> queued;
     for (const QString &ip: ips) {
-        if (routeDelete(ip, gw, temp_sock)) cnt++;
+        if (ip == "0.0.0.0/0") {
+            qDebug().noquote() << "Warning, trying to remove default route, skipping: " << ip << gw;
+            continue;
+        }
+        const bool mainTable = isMainTableRoute(ip);
+        const QString dst = mainTable ? ip : RouteBatchLinux::canonical(ip);
+        if (!mainTable) {
+            m_desiredRoutes.remove(dst);
+        }
+        if (batch.remove(dst, gw, mainTable ? 0 : kSplitTunnelTable)) {
+            queued.append({dst, false, mainTable});
+        } else {
+            qCritical().noquote() << "Critical, trying to remove invalid route: " << ip << gw;
+            if (failed) {
+                failed->append(ip);
+            }
+        }
     }
-    close(temp_sock);
+
+    const QList<int> results = batch.commit();
+    int cnt = 0;
+    for (int i = 0; i < results.size(); ++i) {
+        const QueuedRoute &route = queued.at(i);
+        if (!route.mainTable && (results.at(i) == 0 || results.at(i) == ESRCH)) {
+            m_tableRoutes.remove(route.dst);
+        }
+        if (results.at(i) == 0) {
+            cnt++;
+        } else {
+            qDebug().noquote() << "route delete error: gw " << gw << " ip " << route.dst << " " << strerror(results.at(i));
+            if (failed) {
+                failed->append(route.dst);
+            }
+        }
+    }
+
+    qDebug().noquote() << QString("RouterLinux::routeDeleteList: deleted %1 of %2 routes in %3 ms")
+                              .arg(cnt).arg(ips.size()).arg(timer.elapsed());
     return cnt;
 }
 
 void RouterLinux::flushDns()
 {
+    // Not restarted on every request, so a steady stream still flushes in time
+    if (!m_flushDnsTimer.isActive()) {
+        m_flushDnsTimer.start();
+    }
+}
+
+void RouterLinux::flushDnsNow()
+{
+    bool flushed = false;
+
+    // Both caches are dropped in place, the resolvers keep running
+    QDBusMessage call = QDBusMessage::createMethodCall("org.freedesktop.resolve1", "/org/freedesktop/resolve1",
+                                                       "org.freedesktop.resolve1.Manager", "FlushCaches");
+    const QDBusMessage reply = QDBusConnection::systemBus().call(call, QDBus::Block, kFlushDnsTimeoutMsec);
+    if (reply.type() == QDBusMessage::ReplyMessage) {
+        qDebug().noquote() << "Flush dns completed: systemd-resolved";
+        flushed = true;
+    }
+
+    const bool hasNscd = QFileInfo::exists("/usr/bin/nscd") || QFileInfo::exists("/usr/sbin/nscd");
+    if (hasNscd) {
+        QProcess p;
+        p.setProcessChannelMode(QProcess::MergedChannels);
+        p.start("nscd", { "-i", "hosts" });
+        if (p.waitForFinished(kFlushDnsTimeoutMsec) && p.exitStatus() == QProcess::NormalExit && p.exitCode() == 0) {
+            qDebug().noquote() << "Flush dns completed: nscd";
+            flushed = true;
+        }
+    }
+
+    if (flushed) {
+        return;
+    }
+
+    // Resolvers that can't be asked to flush are restarted
     QProcess p;
     p.setProcessChannelMode(QProcess::MergedChannels);
 
     //check what the dns manager use
-    if (QFileInfo::exists("/usr/bin/nscd")
-        || QFileInfo::exists("/usr/sbin/nscd")
-        || QFileInfo::exists("/usr/lib/systemd/system/nscd.service"))
+    if (hasNscd || QFileInfo::exists("/usr/lib/systemd/system/nscd.service"))
     {
-        p.start("systemctl restart nscd");
+        p.start("systemctl", { "restart", "nscd" });
     }
     else
     {
-        p.start("systemctl restart systemd-resolved");
+        p.start("systemctl", { "restart", "systemd-resolved" });
     }
 
     p.waitForFinished();
@@ -5,6 +5,7 @@
 #include <QString>
 #include <QSettings>
 #include <QHash>
+#include <QSet>
 #include <QDebug>
 #include <QObject>
 
@@ -24,11 +25,10 @@ public:
 
     static RouterLinux& Instance();
 
-    bool routeAdd(const QString &ip, const QString &gw, const int &sock);
-    int routeAddList(const QString &gw, const QStringList &ips);
+    int routeAddList(const QString &gw, const QStringList &ips, QStringList *failed = nullptr,
+                     QStringList *existing = nullptr);
     bool clearSavedRoutes();
-    bool routeDelete(const QString &ip, const QString &gw, const int &sock);
-    bool routeDeleteList(const QString &gw, const QStringList &ips);
+    int routeDeleteList(const QString &gw, const QStringList &ips, QStringList *failed = nullptr);
     QString getgatewayandiface();
     void flushDns();
     bool createTun(const QString &dev, const QString &subnet);
@@ -39,11 +39,25 @@ public:
 public slots:
 
 private:
-    RouterLinux() {m_dnsUtil = new DnsUtilsLinux(this);}
+    RouterLinux();
     RouterLinux(RouterLinux const &) = delete;
     RouterLinux& operator= (RouterLinux const&) = delete;
 
+    void loadSplitTunnelTable();
+    void installSplitTunnelRule();
+    void removeSplitTunnelRule();
+    void pruneStaleRoutes();
+    void flushDnsNow();
+
     QList<Route> m_addedRoutes;
+    bool m_splitTunnelTableLoaded = false;
+    bool m_splitTunnelRuleInstalled = false;
+    // Split tunnel table as the kernel has it (canonical dst -> gateway) and
+    // the destinations requested during the current connection
+    QHash<QString, QString> m_tableRoutes;
+    QSet<QString> m_desiredRoutes;
+    // Collects flushDns() requests into a single flush
+    QTimer m_flushDnsTimer;
     DnsUtilsLinux *m_dnsUtil;
 };
 